@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "../../LSGSDLtest/LSGSDLtest/MusicPreset.h"
+#include "../../LSGSDLtest/LSGSDLtest/SongSetup.h"
+#include "../../LSGTest/LSGcore/LSGlog.h"
+
+// Offline renderer: renders (preset, MIDI) jobs to WAV files on a thread pool.
+// usage: lsg-render [-j threads] [-o outdir] [-n loops] [-t tail_seconds] [-r sample_rate] [-s] [-m] [-c] [-w wave_cache_file] preset.yaml[:song.mid]|song.lsgc ...
+// -s: smooth the mix with the post filter
+// -m: stream the MIDI file instead of expanding it before rendering
+// -c: write compiled songs (.lsgc) instead of WAV files. Compiled songs are rendered at the rate they were compiled for.
+
+#define kRenderBlockSamples 4096
+#define kRenderChannels 2
+
+typedef struct _RenderJob {
+    std::string presetFilename;
+    std::string midiFilename; // empty: use preset input
+    std::string outFilename;  // set by parseArguments
+    bool succeeded;
+} RenderJob;
+
+typedef struct _RenderOptions {
+    int nThreads;
+    int nLoops;
+    int sampleRate;
+    bool bSmooth;
+    bool bStreamMidi;
+    bool bCompile;
+    float tailSeconds;
+    std::string outDir;
+    std::string waveCacheFilename; // empty: build the waves in memory
+} RenderOptions;
+
+typedef struct _RenderQueue {
+    std::vector<RenderJob>* pJobs;
+    const RenderOptions* pOptions;
+    size_t nextIndex;
+    pthread_mutex_t mutex;
+} RenderQueue;
+
+static bool parseArguments(int argc, char* argv[], RenderOptions& outOptions, std::vector<RenderJob>& outJobs);
+static std::string resolveRelativePath(const std::string& baseFile, const std::string& path);
+static std::string makeOutputFilename(const std::string& outDir, const std::string& sourceFilename, const char* extension);
+static bool isCompiledSongFilename(const std::string& filename);
+static void* renderWorkerProc(void* userData);
+static bool renderJob(RenderJob& job, const RenderOptions& options);
+static bool renderCompiledJob(RenderJob& job, const RenderOptions& options);
+static bool writeRendering(lsg_context_t* ctx, const std::string& outFilename, int64_t nTotalFrames, int sampleRate, const RenderOptions& options);
+static bool writeWavHeader(FILE* fp, uint32_t nFrames, uint32_t sampleRate);
+static void writeLE32(unsigned char* p, uint32_t v);
+static void writeLE16(unsigned char* p, uint16_t v);
+
+int main(int argc, char * argv[])
+{
+    RenderOptions options;
+    std::vector<RenderJob> jobs;
+    if (!parseArguments(argc, argv, options, jobs) || jobs.empty()) {
+        fputs("usage: lsg-render [-j threads] [-o outdir] [-n loops] [-t tail_seconds] [-r sample_rate] [-s] [-m] [-c] [-w wave_cache_file] preset.yaml[:song.mid]|song.lsgc ...\n", stderr);
+        return -1;
+    }
+    
+    if (!options.waveCacheFilename.empty() && lsg_use_wave_cache_file(options.waveCacheFilename.c_str()) != LSG_OK) {
+        fprintf(stderr, "Could not use wave cache file: %s\n", options.waveCacheFilename.c_str());
+    }
+    
+    lsg_log_start();
+    
+    RenderQueue queue;
+    queue.pJobs = &jobs;
+    queue.pOptions = &options;
+    queue.nextIndex = 0;
+    pthread_mutex_init(&queue.mutex, NULL);
+
+    int nThreads = options.nThreads;
+    if (nThreads > (int)jobs.size()) { nThreads = (int)jobs.size(); }
+    
+    // Jobs already keep the CPUs busy; concurrent loads would multiply the threads
+    if (nThreads > 1) {
+        lsg_mlf_set_max_decode_threads(1);
+    }
+    
+    std::vector<pthread_t> threads(nThreads);
+    int nStarted = 0;
+    while (nStarted < nThreads && pthread_create(&threads[nStarted], NULL, renderWorkerProc, &queue) == 0) {
+        ++nStarted;
+    }
+    
+    if (nStarted == 0) {
+        fputs("Could not start worker threads; rendering on the main thread\n", stderr);
+        renderWorkerProc(&queue);
+    }
+    
+    for (int i = 0;i < nStarted;++i) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    pthread_mutex_destroy(&queue.mutex);
+    lsg_log_stop();
+
+    int nFailed = 0;
+    for (size_t i = 0;i < jobs.size();++i) {
+        if (!jobs[i].succeeded) {
+            fprintf(stderr, "FAILED: %s\n", jobs[i].presetFilename.c_str());
+            ++nFailed;
+        }
+    }
+    
+    fprintf(stderr, "%d/%d rendered\n", (int)jobs.size() - nFailed, (int)jobs.size());
+    return nFailed ? 1 : 0;
+}
+
+bool parseArguments(int argc, char* argv[], RenderOptions& outOptions, std::vector<RenderJob>& outJobs) {
+    const long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    outOptions.nThreads = (nCPUs > 0) ? (int)nCPUs : 1;
+    outOptions.nLoops = 1;
+    outOptions.sampleRate = kLSGOutSamplingRate;
+    outOptions.bSmooth = false;
+    outOptions.bStreamMidi = false;
+    outOptions.bCompile = false;
+    outOptions.tailSeconds = 1.0f;
+    outOptions.outDir = ".";
+    
+    for (int i = 1;i < argc;++i) {
+        const char* arg = argv[i];
+        const bool hasValue = (i + 1) < argc;
+        
+        if (strcmp(arg, "-j") == 0 && hasValue) {
+            outOptions.nThreads = atoi(argv[++i]);
+            if (outOptions.nThreads < 1) { outOptions.nThreads = 1; }
+        } else if (strcmp(arg, "-o") == 0 && hasValue) {
+            outOptions.outDir = argv[++i];
+        } else if (strcmp(arg, "-n") == 0 && hasValue) {
+            outOptions.nLoops = atoi(argv[++i]);
+            if (outOptions.nLoops < 1) { outOptions.nLoops = 1; }
+        } else if (strcmp(arg, "-r") == 0 && hasValue) {
+            outOptions.sampleRate = atoi(argv[++i]);
+            if (outOptions.sampleRate < kLSGMinSamplingRate || outOptions.sampleRate > kLSGMaxSamplingRate) {
+                return false;
+            }
+        } else if (strcmp(arg, "-s") == 0) {
+            outOptions.bSmooth = true;
+        } else if (strcmp(arg, "-m") == 0) {
+            outOptions.bStreamMidi = true;
+        } else if (strcmp(arg, "-c") == 0) {
+            outOptions.bCompile = true;
+        } else if (strcmp(arg, "-t") == 0 && hasValue) {
+            outOptions.tailSeconds = (float)atof(argv[++i]);
+            if (outOptions.tailSeconds < 0) {
+                return false;
+            }
+        } else if (strcmp(arg, "-w") == 0 && hasValue) {
+            outOptions.waveCacheFilename = argv[++i];
+        } else if (arg[0] == '-') {
+            return false;
+        } else {
+            RenderJob job;
+            job.presetFilename = arg;
+            job.succeeded = false;
+            
+            const std::string::size_type sep = job.presetFilename.find(':');
+            if (sep != std::string::npos) {
+                job.midiFilename = job.presetFilename.substr(sep + 1);
+                job.presetFilename = job.presetFilename.substr(0, sep);
+            }
+            
+            outJobs.push_back(job);
+        }
+    }
+    
+    // Name outputs after the MIDI file if specified, or the preset. Duplicates get the job number.
+    for (size_t i = 0;i < outJobs.size();++i) {
+        RenderJob& job = outJobs[i];
+        const char* extension = (outOptions.bCompile && !isCompiledSongFilename(job.presetFilename)) ? ".lsgc" : ".wav";
+        job.outFilename = makeOutputFilename(outOptions.outDir, job.midiFilename.empty() ? job.presetFilename : job.midiFilename, extension);
+        
+        for (size_t k = 0;k < i;++k) {
+            if (outJobs[k].outFilename == job.outFilename) {
+                char suffix[32];
+                snprintf(suffix, sizeof(suffix), "-%d%s", (int)i, extension);
+                job.outFilename = job.outFilename.substr(0, job.outFilename.size() - strlen(extension)) + suffix;
+                break;
+            }
+        }
+    }
+    
+    return true;
+}
+
+// Paths in a preset are relative to the preset file
+std::string resolveRelativePath(const std::string& baseFile, const std::string& path) {
+    if (path.empty() || path[0] == '/') {
+        return path;
+    }
+    
+    const std::string::size_type slash = baseFile.rfind('/');
+    if (slash == std::string::npos) {
+        return path;
+    }
+    
+    return baseFile.substr(0, slash + 1) + path;
+}
+
+std::string makeOutputFilename(const std::string& outDir, const std::string& sourceFilename, const char* extension) {
+    std::string name = sourceFilename;
+    const std::string::size_type slash = name.rfind('/');
+    if (slash != std::string::npos) {
+        name = name.substr(slash + 1);
+    }
+    
+    const std::string::size_type dot = name.rfind('.');
+    if (dot != std::string::npos) {
+        name = name.substr(0, dot);
+    }
+    
+    return outDir + "/" + name + extension;
+}
+
+bool isCompiledSongFilename(const std::string& filename) {
+    static const std::string kExtension = ".lsgc";
+    return filename.size() > kExtension.size() && filename.compare(filename.size() - kExtension.size(), kExtension.size(), kExtension) == 0;
+}
+
+void* renderWorkerProc(void* userData) {
+    RenderQueue* queue = (RenderQueue*)userData;
+    
+    for (;;) {
+        pthread_mutex_lock(&queue->mutex);
+        const size_t index = queue->nextIndex++;
+        pthread_mutex_unlock(&queue->mutex);
+        
+        if (index >= queue->pJobs->size()) {
+            break;
+        }
+        
+        RenderJob& job = (*queue->pJobs)[index];
+        job.succeeded = renderJob(job, *queue->pOptions);
+    }
+    
+    return NULL;
+}
+
+bool renderJob(RenderJob& job, const RenderOptions& options) {
+    if (isCompiledSongFilename(job.presetFilename)) {
+        return renderCompiledJob(job, options);
+    }
+    
+    MusicPreset preset;
+    if (!preset.loadFromYAMLFile(job.presetFilename.c_str())) {
+        return false;
+    }
+    
+    const std::string midiFilename = job.midiFilename.empty() ?
+        resolveRelativePath(job.presetFilename, preset.getInputName()) : job.midiFilename;
+    
+    SongSetup song;
+    const bool bLoaded = (options.bStreamMidi && !options.bCompile) ?
+        song.streamMidi(preset, midiFilename.c_str(), options.sampleRate) :
+        song.loadMidi(preset, midiFilename.c_str(), options.sampleRate);
+    if (!bLoaded) {
+        return false;
+    }
+    
+    if (options.bCompile) {
+        if (!song.writeCompiled(preset, job.outFilename.c_str())) {
+            return false;
+        }
+        
+        fprintf(stderr, "Compiled %s\n", job.outFilename.c_str());
+        return true;
+    }
+    
+    lsg_context_t* ctx = lsg_context_create_with_sample_rate(options.sampleRate);
+    if (!ctx) {
+        return false;
+    }
+    
+    if (!song.bind(ctx, preset, 0)) {
+        lsg_context_destroy(ctx);
+        return false;
+    }
+    
+    const int64_t nTotalFrames = song.calcEndTick(0, options.nLoops) + (int64_t)(options.tailSeconds * options.sampleRate);
+    const bool bRendered = writeRendering(ctx, job.outFilename, nTotalFrames, options.sampleRate, options);
+    lsg_context_destroy(ctx);
+    return bRendered;
+}
+
+// No preset or SMF: the compiled song brings its own channel setup and sample rate
+bool renderCompiledJob(RenderJob& job, const RenderOptions& options) {
+    lsg_song_t* pSong = lsg_song_open(job.presetFilename.c_str());
+    if (!pSong) {
+        return false;
+    }
+    
+    const int sampleRate = lsg_song_get_sample_rate(pSong);
+    lsg_context_t* ctx = lsg_context_create_with_sample_rate(sampleRate);
+    bool bRendered = false;
+    if (ctx && lsg_ctx_song_bind(ctx, pSong, 0) == LSG_OK) {
+        const int64_t nTotalFrames = lsg_song_calc_end_tick(pSong, 0, options.nLoops) + (int64_t)(options.tailSeconds * sampleRate);
+        bRendered = writeRendering(ctx, job.outFilename, nTotalFrames, sampleRate, options);
+    }
+    
+    if (ctx) {
+        lsg_context_destroy(ctx);
+    }
+    lsg_song_close(pSong);
+    return bRendered;
+}
+
+bool writeRendering(lsg_context_t* ctx, const std::string& outFilename, int64_t nTotalFrames, int sampleRate, const RenderOptions& options) {
+    lsg_ctx_set_post_filter_enabled(ctx, options.bSmooth);
+    
+    unsigned char* buf = (unsigned char*)malloc(kRenderBlockSamples * kRenderChannels * 2);
+    if (!buf) {
+        return false;
+    }
+    
+    FILE* fp = fopen(outFilename.c_str(), "wb");
+    if (!fp) {
+        free(buf);
+        return false;
+    }
+    
+    bool bGood = writeWavHeader(fp, (uint32_t)nTotalFrames, (uint32_t)sampleRate);
+    for (int64_t done = 0;bGood && done < nTotalFrames;) {
+        int64_t n = nTotalFrames - done;
+        if (n > kRenderBlockSamples) { n = kRenderBlockSamples; }
+        
+        lsg_ctx_synthesize_LE16(ctx, buf, (size_t)n, kRenderChannels * 2, 1);
+        bGood = (fwrite(buf, kRenderChannels * 2, (size_t)n, fp) == (size_t)n);
+        done += n;
+    }
+    
+    free(buf);
+    bGood = (fclose(fp) == 0) && bGood;
+    
+    // A short WAV would claim the full length in its header
+    if (!bGood) {
+        unlink(outFilename.c_str());
+        return false;
+    }
+    
+    fprintf(stderr, "Rendered %s (%.1f sec)\n", outFilename.c_str(), (double)nTotalFrames / (double)sampleRate);
+    return true;
+}
+
+bool writeWavHeader(FILE* fp, uint32_t nFrames, uint32_t sampleRate) {
+    const uint32_t blockAlign = kRenderChannels * 2;
+    const uint32_t dataBytes = nFrames * blockAlign;
+    unsigned char h[44];
+    
+    memcpy(h, "RIFF", 4);
+    writeLE32(h + 4, 36 + dataBytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    writeLE32(h + 16, 16);
+    writeLE16(h + 20, 1); // PCM
+    writeLE16(h + 22, kRenderChannels);
+    writeLE32(h + 24, sampleRate);
+    writeLE32(h + 28, sampleRate * blockAlign);
+    writeLE16(h + 32, blockAlign);
+    writeLE16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    writeLE32(h + 40, dataBytes);
+    
+    return fwrite(h, 1, sizeof(h), fp) == sizeof(h);
+}
+
+void writeLE32(unsigned char* p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+void writeLE16(unsigned char* p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
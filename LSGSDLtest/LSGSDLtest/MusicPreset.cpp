@@ -231,6 +231,11 @@ bool MusicPreset::readChannelConfiguration(MappedChannelConf& outChConf, yaml_do
             case kChannelConfiguration_UseCustomNotes:
                 outChConf.useCustomMapping = readBool(valueNode);
                 break;
+                
+            case kChannelConfiguration_Polyphony:
+                outChConf.polyphony = readInt(valueNode);
+                if (outChConf.polyphony < 1) { outChConf.polyphony = 1; }
+                break;
         }
         
         
@@ -303,6 +308,8 @@ int MusicPreset::lookupChannelConfigurationType(yaml_node_t* node) {
             return kChannelConfiguration_ADSR; break;
         case 'u':
             return kChannelConfiguration_UseCustomNotes; break;
+        case 'p':
+            return kChannelConfiguration_Polyphony; break;
     }
     
     return kUnknownNode;
@@ -25,6 +25,7 @@ typedef struct _MappedChannelConf {
         generatorType = G_SQUARE;
         detune = 0;
         useCustomMapping = false;
+        polyphony = 1;
     }
     
     ConfGeneratorType generatorType;
@@ -34,6 +35,7 @@ typedef struct _MappedChannelConf {
     float detune;
     LSG_ADSR adsr;
     bool useCustomMapping;
+    int polyphony;
 } MappedChannelConf;
 
 typedef std::map<int, MappedChannelConf> ChannelConfMap;
@@ -56,6 +58,7 @@ public:
     static const int kChannelConfiguration_Detune    = 4;
     static const int kChannelConfiguration_ADSR      = 5;
     static const int kChannelConfiguration_UseCustomNotes = 6;
+    static const int kChannelConfiguration_Polyphony = 7;
 
     bool loadFromYAMLFile(const char* filename);
     void dump();
@@ -0,0 +1,310 @@
+#include "SongSetup.h"
+
+SongSetup::SongSetup() : mStream(NULL), mSampleRate(kLSGOutSamplingRate) {
+    lsg_mlf_init_play_setup_struct(&mMLFSetup);
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        lsg_rsvcmd_init(&mRsvbufs[i], kRsvBufLength);
+    }
+}
+
+SongSetup::~SongSetup() {
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        lsg_rsvcmd_destroy(&mRsvbufs[i]);
+    }
+    
+    lsg_mlf_destroy_play_setup_struct(&mMLFSetup);
+    lsg_mlf_stream_close(mStream);
+}
+
+bool SongSetup::loadMidi(const MusicPreset& preset, const char* midiFilename, int sampleRate) {
+    lsg_mlf_destroy_channel_mapping(mMLFSetup.chmap, kLSGNumOutChannels);
+    lsg_mlf_init_channel_mapping(mMLFSetup.chmap, kLSGNumOutChannels);
+    lsg_mlf_stream_close(mStream);
+    mStream = NULL;
+    
+    fprintf(stderr, "- - Loading sequence... - -\n");
+    lsg_mlf_t mlf;
+    if (lsg_load_mlf(&mlf, midiFilename ? midiFilename : preset.getInputName(), preset.getShouldUseAutoDrumMapping() ? 9 : -1) != LSG_OK) {
+        return false;
+    }
+    fprintf(stderr, "Tempo=%d  Timebase=%d\n", mlf.tempo, mlf.timeBase);
+    
+    setupChannelMapping(preset, mlf, sampleRate);
+    
+    MLFEvent_t* channelEvents[kLSGNumMIDIChannels];
+    int channelLengths[kLSGNumMIDIChannels];
+    const LSGStatus sortStatus = lsg_mlf_create_all_sorted_channel_events(&mlf, channelEvents, channelLengths);
+    lsg_free_mlf(&mlf);
+    if (sortStatus != LSG_OK) {
+        return false;
+    }
+    
+    // The first channel mapped from a MIDI channel takes its events; others get copies
+    bool bTaken[kLSGNumMIDIChannels] = {false};
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        const int midiCh = mMLFSetup.chmap[i].midiChannel;
+        if (!preset.isChannelMapped(i) || midiCh < 0 || midiCh >= kLSGNumMIDIChannels || !channelEvents[midiCh]) {
+            continue;
+        }
+        
+        MLFEvent_t* events = channelEvents[midiCh];
+        if (bTaken[midiCh]) {
+            events = (MLFEvent_t*)malloc(sizeof(MLFEvent_t) * channelLengths[midiCh]);
+            if (!events) {
+                continue;
+            }
+            memcpy(events, channelEvents[midiCh], sizeof(MLFEvent_t) * channelLengths[midiCh]);
+        }
+        
+        bTaken[midiCh] = true;
+        mMLFSetup.chmap[i].sortedEvents = events;
+        mMLFSetup.chmap[i].eventsLength = channelLengths[midiCh];
+    }
+    
+    for (int ch = 0;ch < kLSGNumMIDIChannels;++ch) {
+        if (!bTaken[ch]) {
+            free(channelEvents[ch]);
+        }
+    }
+    
+    resizeRsvbufs(kRsvBufLength);
+    return true;
+}
+
+bool SongSetup::streamMidi(const MusicPreset& preset, const char* midiFilename, int sampleRate) {
+    lsg_mlf_destroy_channel_mapping(mMLFSetup.chmap, kLSGNumOutChannels);
+    lsg_mlf_init_channel_mapping(mMLFSetup.chmap, kLSGNumOutChannels);
+    lsg_mlf_stream_close(mStream);
+    
+    fprintf(stderr, "- - Opening sequence stream... - -\n");
+    mStream = lsg_mlf_stream_open(midiFilename ? midiFilename : preset.getInputName(), preset.getShouldUseAutoDrumMapping() ? 9 : -1);
+    if (!mStream) {
+        return false;
+    }
+    
+    const lsg_mlf_t& info = *lsg_mlf_stream_get_info(mStream);
+    fprintf(stderr, "Tempo=%d  Timebase=%d\n", info.tempo, info.timeBase);
+    
+    setupChannelMapping(preset, info, sampleRate);
+    resizeRsvbufs(kStreamWindowLength);
+    return true;
+}
+
+void SongSetup::setupChannelMapping(const MusicPreset& preset, const lsg_mlf_t& mlf, int sampleRate) {
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        if (preset.isChannelMapped(i)) {
+            const MappedChannelConf& chconf = preset.getChannelConf(i);
+            mMLFSetup.chmap[i].midiChannel = chconf.midiCh;
+            mMLFSetup.chmap[i].defaultADSR = chconf.adsr;
+            mMLFSetup.chmap[i].customNoteTableIndex = chconf.useCustomMapping ? 1 : 0;
+        }
+    }
+    
+    mMLFSetup.deltaScale = lsg_util_calc_delta_time_scale_for_rate(&mlf, sampleRate);
+    mSampleRate = sampleRate;
+    mMLFSetup.loopDesc = mlf.loopDesc;
+}
+
+void SongSetup::resizeRsvbufs(size_t length) {
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        if (mRsvbufs[i].length != length) {
+            lsg_rsvcmd_destroy(&mRsvbufs[i]);
+            lsg_rsvcmd_init(&mRsvbufs[i], length);
+        }
+    }
+}
+
+bool SongSetup::bind(lsg_context_t* ctx, const MusicPreset& preset, int64_t originTime) {
+    LSGStatus status;
+    if (mStream) {
+        status = lsg_ctx_rsvcmd_stream_mlf(ctx, mRsvbufs, kNumRsvBufs, &mMLFSetup, mStream, originTime);
+    } else {
+        // The fill appends, so drop what an earlier song or bind left
+        for (int i = 0;i < kNumRsvBufs;++i) {
+            lsg_rsvcmd_clear(&mRsvbufs[i]);
+        }
+        status = lsg_ctx_rsvcmd_fill_mlf(ctx, mRsvbufs, kNumRsvBufs, &mMLFSetup, originTime);
+    }
+    
+    if (status != LSG_OK) {
+        return false;
+    }
+    
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        if (mRsvbufs[i].length > 0) {
+            lsg_ctx_channel_bind_rsvcmd(ctx, i, &mRsvbufs[i]);
+        }
+    }
+    
+    if (!configureGenerators(ctx, preset)) {
+        return false;
+    }
+    
+    configureCustomNotes(ctx, preset);
+    return true;
+}
+
+int64_t SongSetup::calcEndTick(int64_t originTime, int nLoops) const {
+    MLFLoopDesc loopDesc = mMLFSetup.loopDesc;
+    if (lsg_mlf_is_loop_valid(&loopDesc)) {
+        const int64_t loopStart = (int64_t)mMLFSetup.loopDesc.startTicks * mMLFSetup.deltaScale;
+        const int64_t loopEnd   = (int64_t)mMLFSetup.loopDesc.endTicks   * mMLFSetup.deltaScale;
+        return originTime + loopStart + (loopEnd - loopStart) * nLoops;
+    }
+    
+    uint32_t lastTicks = 0;
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        const MappedMLFChannel_t& mappedCh = mMLFSetup.chmap[i];
+        if (mStream) {
+            const uint32_t t = lsg_mlf_stream_get_last_ticks(mStream, mappedCh.midiChannel);
+            if (t > lastTicks) { lastTicks = t; }
+        } else if (mappedCh.sortedEvents && mappedCh.eventsLength > 0) {
+            const uint32_t t = mappedCh.sortedEvents[mappedCh.eventsLength - 1].absoluteTicks;
+            if (t > lastTicks) { lastTicks = t; }
+        }
+    }
+    
+    return originTime + (int64_t)lastTicks * mMLFSetup.deltaScale;
+}
+
+bool SongSetup::writeCompiled(const MusicPreset& preset, const char* filename) {
+    if (mStream) {
+        return false;
+    }
+    
+    // Expand from time 0; the scratch context only takes the channel settings made by the fill
+    lsg_context_t* ctx = lsg_context_create_with_sample_rate(mSampleRate);
+    if (!ctx) {
+        return false;
+    }
+    
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        lsg_rsvcmd_clear(&mRsvbufs[i]);
+    }
+    lsg_ctx_rsvcmd_fill_mlf(ctx, mRsvbufs, kNumRsvBufs, &mMLFSetup, 0);
+    lsg_context_destroy(ctx);
+    
+    LSGSongConf_t conf;
+    lsg_song_init_conf(&conf);
+    conf.sampleRate = mSampleRate;
+    conf.voicePoolSize = calcVoicePoolSize(preset);
+    conf.endTime = calcEndTick(0, 1);
+    
+    for (int ch = 0;ch < kNumRsvBufs;++ch) {
+        if (!preset.isChannelMapped(ch)) {
+            continue;
+        }
+        
+        const MappedChannelConf& chconf = preset.getChannelConf(ch);
+        LSGSongChannelConf_t& songch = conf.channels[ch];
+        songch.bEnabled = 1;
+        switch (chconf.generatorType) {
+            case G_TRIANGLE: songch.generatorKind = kLSGSongGenerator_Triangle; break;
+            case G_NOISE:    songch.generatorKind = kLSGSongGenerator_Noise;    break;
+            case G_SQUARE13: songch.generatorKind = kLSGSongGenerator_Square13; break;
+            case G_IFT:      songch.generatorKind = kLSGSongGenerator_Sin;      break;
+            default:         songch.generatorKind = kLSGSongGenerator_Square;   break;
+        }
+        
+        if (chconf.generatorType == G_IFT && !chconf.coefficients.empty()) {
+            songch.coefficients = &chconf.coefficients[0];
+            songch.nCoefficients = (unsigned int)chconf.coefficients.size();
+        }
+        
+        songch.detune = chconf.detune;
+        songch.volume = (float)kLSGChannelVolumeMax * chconf.volume;
+        songch.polyphony = chconf.polyphony;
+    }
+    
+    const float othersFq = preset.getCustomNoteFrequency(-1);
+    for (int i = 1;i < kLSGNoteMappingLength;++i) {
+        const float fq = preset.getCustomNoteFrequency(i);
+        conf.customNoteFrequencies[i] = (fq > 0.0f) ? fq : othersFq;
+    }
+    
+    const bool bWritten = (lsg_song_write_file(filename, &conf, &mMLFSetup, mRsvbufs, kNumRsvBufs) == LSG_OK);
+    
+    // bind fills them again
+    for (int i = 0;i < kNumRsvBufs;++i) {
+        lsg_rsvcmd_clear(&mRsvbufs[i]);
+    }
+    
+    return bWritten;
+}
+
+// Each channel owns one voice; polyphonic channels need extra ones
+int SongSetup::calcVoicePoolSize(const MusicPreset& preset) {
+    int nVoices = kLSGDefaultVoicePoolSize;
+    for (int ch = 0;ch < kNumRsvBufs;++ch) {
+        if (preset.isChannelMapped(ch)) {
+            nVoices += preset.getChannelConf(ch).polyphony - 1;
+        }
+    }
+    
+    return nVoices;
+}
+
+bool SongSetup::configureGenerators(lsg_context_t* ctx, const MusicPreset& preset) {
+    if (lsg_ctx_set_voice_pool_size(ctx, calcVoicePoolSize(preset)) != LSG_OK) {
+        return false;
+    }
+    
+    for (int ch = 0;ch < kNumRsvBufs;++ch) {
+        if (!preset.isChannelMapped(ch)) {
+            continue;
+        }
+        
+        // Generator setup
+        const MappedChannelConf& chconf = preset.getChannelConf(ch);
+        LSGStatus status;
+        switch (chconf.generatorType) {
+            case G_TRIANGLE:
+                status = lsg_ctx_generate_triangle(ctx, ch);
+                break;
+
+            case G_NOISE:
+                status = lsg_ctx_generate_short_noise(ctx, ch);
+                break;
+
+            case G_SQUARE13:
+                status = lsg_ctx_generate_square_13(ctx, ch);
+                break;
+                
+            case G_IFT: {
+                const float* coefs = &chconf.coefficients[0];
+                status = lsg_ctx_generate_sin_v(ctx, ch, coefs, (unsigned int)chconf.coefficients.size());
+            } break;
+                
+            default:
+                status = lsg_ctx_generate_square(ctx, ch);
+                break;
+        }
+        
+        if (status != LSG_OK) {
+            return false;
+        }
+        lsg_ctx_set_channel_source_generator(ctx, ch, ch);
+        
+        
+        lsg_ctx_set_channel_global_detune(ctx, ch, chconf.detune);
+        lsg_ctx_set_channel_global_volume(ctx, ch, (float)kLSGChannelVolumeMax * chconf.volume);
+        lsg_ctx_set_channel_polyphony(ctx, ch, chconf.polyphony);
+    }
+    
+    return true;
+}
+
+void SongSetup::configureCustomNotes(lsg_context_t* ctx, const MusicPreset& preset) {
+    const float othersFq = preset.getCustomNoteFrequency(-1);
+
+    for (int i = 1;i < kLSGNoteMappingLength;++i) {
+        const float fq = preset.getCustomNoteFrequency(i);
+        if (fq > 0.0f) {
+            lsg_ctx_set_custom_note_frequency(ctx, i, fq);
+        } else {
+            if (othersFq >= 0.0f) {
+                lsg_ctx_set_custom_note_frequency(ctx, i, othersFq);
+            }
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef SongSetup_h_included
+#define SongSetup_h_included
+#include "MusicPreset.h"
+#include "../../LSGTest/LSGcore/LSGsong.h"
+
+// Loads the MIDI sequence described by a MusicPreset and binds it to an LSG context.
+class SongSetup
+{
+public:
+    SongSetup();
+    virtual ~SongSetup();
+
+    static const int kNumRsvBufs = 8;
+    static const int kRsvBufLength = 32768;
+    static const int kStreamWindowLength = 2048; // commands per channel within the lookahead
+
+    // midiFilename: NULL to use the input of the preset
+    bool loadMidi(const MusicPreset& preset, const char* midiFilename = NULL, int sampleRate = kLSGOutSamplingRate); // rate of the context to bind
+    // Same, but the tracks are decoded while playing (starts at once, memory does not grow with the song)
+    bool streamMidi(const MusicPreset& preset, const char* midiFilename = NULL, int sampleRate = kLSGOutSamplingRate);
+    bool bind(lsg_context_t* ctx, const MusicPreset& preset, int64_t originTime); // false when the channels could not be set up
+    // Writes the song loaded by loadMidi with the channel setup of the preset (see lsg_song_open)
+    bool writeCompiled(const MusicPreset& preset, const char* filename);
+    
+    // Tick after the last event (or after nLoops passes of the loop)
+    int64_t calcEndTick(int64_t originTime, int nLoops) const;
+    
+protected:
+    bool configureGenerators(lsg_context_t* ctx, const MusicPreset& preset);
+    void configureCustomNotes(lsg_context_t* ctx, const MusicPreset& preset);
+    static int calcVoicePoolSize(const MusicPreset& preset);
+    void setupChannelMapping(const MusicPreset& preset, const lsg_mlf_t& mlf, int sampleRate);
+    void resizeRsvbufs(size_t length);
+    
+    LSGReservedCommandBuffer_t mRsvbufs[kNumRsvBufs];
+    MLFPlaySetup_t mMLFSetup;
+    lsg_mlf_stream_t* mStream; // NULL: expanded into mRsvbufs
+    int mSampleRate;
+};
+
+#endif
@@ -2,21 +2,12 @@
 #include <SDL.h>
 #include <string>
 #include "MusicPreset.h"
+#include "SongSetup.h"
 #include "../../LSGTest/LSGcore/LSGsdl.h"
-
-#define kNRsvBufs 8
+#include "../../LSGTest/LSGcore/LSGlog.h"
 
 static bool lookupInputName(std::string& outStr, int argc, char* argv[]);
-static void configureLSG(const MusicPreset& preset);
-static void configureLSGCustomNotes(const MusicPreset& preset);
-static void loadMidi(const MusicPreset& preset);
-static void setupReserveBuffers();
-static void destroyReserveBuffers();
-static void bindReserveBuffers();
-
-LSGReservedCommandBuffer_t sRsvbufs[kNRsvBufs];
-MLFPlaySetup_t sMLFSetup;
-
+static int playCompiledSong(const std::string& filename);
 
 int main(int argc, char * argv[])
 {
@@ -26,6 +17,10 @@ int main(int argc, char * argv[])
         return 0;
     }
     
+    if (presetFilename.size() > 5 && presetFilename.compare(presetFilename.size() - 5, 5, ".lsgc") == 0) {
+        return playCompiledSong(presetFilename);
+    }
+    
     MusicPreset preset;
     if (!preset.loadFromYAMLFile(presetFilename.c_str())) {
         fputs("Failed to load mapping file.\n", stderr);
@@ -39,15 +34,13 @@ int main(int argc, char * argv[])
     fprintf(stderr, "LSG ONGEN (SDL backend) test\n");
     fprintf(stderr, "----------------------------\n");
     SDL_Init(SDL_INIT_AUDIO);
+    lsg_log_start(); // the audio callback only queues messages
     
-    lsg_mlf_init_play_setup_struct(&sMLFSetup);
-    setupReserveBuffers();
-    loadMidi(preset);
+    SongSetup song;
+    song.streamMidi(preset);
 
     lsg_sdl_start();
-    lsg_rsvcmd_fill_mlf(sRsvbufs, kNRsvBufs, &sMLFSetup, 8820);
-    bindReserveBuffers();
-    configureLSG(preset);
+    song.bind(lsg_get_default_context(), preset, 8820);
     
 /*
     const int ch = 0;
@@ -66,118 +59,38 @@ int main(int argc, char * argv[])
     
     getchar();
     SDL_Quit();
-    destroyReserveBuffers();
-    lsg_mlf_destroy_play_setup_struct(&sMLFSetup);
+    lsg_log_stop();
     return 0;
 }
 
-bool lookupInputName(std::string& outStr, int argc, char* argv[]) {
-    if (argc < 2) {
-        return false;
-    }
-    
-    outStr = argv[1];
-    return true;
-}
-
-void configureLSG(const MusicPreset& preset) {
-
-    for (int ch = 0;ch < kNRsvBufs;++ch) {
-        if (!preset.isChannelMapped(ch)) {
-            continue;
-        }
-        
-        // Generator setup
-        const MappedChannelConf& chconf = preset.getChannelConf(ch);
-        switch (chconf.generatorType) {
-            case G_TRIANGLE:
-                lsg_generate_triangle(ch);
-                break;
-
-            case G_NOISE:
-                lsg_generate_short_noise(ch);
-                break;
-
-            case G_SQUARE13:
-                lsg_generate_square_13(ch);
-                break;
-                
-            case G_IFT: {
-                const float* coefs = &chconf.coefficients[0];
-                lsg_generate_sin_v(ch, coefs, (unsigned int)chconf.coefficients.size());
-            } break;
-                
-            default:
-                lsg_generate_square(ch);
-                break;
-        }
-        lsg_set_channel_source_generator(ch, ch);
-        
-        
-        lsg_set_channel_global_detune(ch, chconf.detune);
-        lsg_set_channel_global_volume(ch, (float)kLSGChannelVolumeMax * chconf.volume);
-    }
-    
-    configureLSGCustomNotes(preset);
-}
-
-void configureLSGCustomNotes(const MusicPreset& preset) {
-    const float othersFq = preset.getCustomNoteFrequency(-1);
-
-    for (int i = 1;i < kLSGNoteMappingLength;++i) {
-        const float fq = preset.getCustomNoteFrequency(i);
-        if (fq > 0.0f) {
-            lsg_set_custom_note_frequency(i, fq);
-        } else {
-            if (othersFq >= 0.0f) {
-                lsg_set_custom_note_frequency(i, othersFq);
-            }
-        }
-    }
-
-}
-
-void setupReserveBuffers() {
-    for (int i = 0;i < kNRsvBufs;++i) {
-        lsg_rsvcmd_init(&sRsvbufs[i], 32768);
-    }
-}
-
-void bindReserveBuffers() {
-    for (int i = 0;i < kNRsvBufs;++i) {
-        if (sRsvbufs[i].length > 0) {
-            lsg_channel_bind_rsvcmd(i, &sRsvbufs[i]);
-        }
+// Compiled songs need no preset: the channel setup and the sample rate come with the song
+int playCompiledSong(const std::string& filename) {
+    lsg_song_t* pSong = lsg_song_open(filename.c_str());
+    if (!pSong) {
+        fputs("Failed to load compiled song.\n", stderr);
+        return -1;
     }
-}
-
-void loadMidi(const MusicPreset& preset) {
-    lsg_mlf_init_channel_mapping(sMLFSetup.chmap, kLSGNumOutChannels);
-    sMLFSetup.deltaScale = 150;
     
-    fprintf(stderr, "- - Loading sequence... - -\n");
-    lsg_mlf_t mlf;
-    lsg_load_mlf(&mlf, preset.getInputName(), preset.getShouldUseAutoDrumMapping() ? 9 : -1);
-    fprintf(stderr, "Tempo=%d  Timebase=%d\n", mlf.tempo, mlf.timeBase);
-    
-    for (int i = 0;i < kNRsvBufs;++i) {
-        if (preset.isChannelMapped(i)) {
-            const MappedChannelConf& chconf = preset.getChannelConf(i);
-            sMLFSetup.chmap[i].sortedEvents = lsg_mlf_create_sorted_channel_events(&mlf, chconf.midiCh);
-            sMLFSetup.chmap[i].eventsLength = lsg_mlf_count_channel_events(&mlf, chconf.midiCh);
-            sMLFSetup.chmap[i].defaultADSR = chconf.adsr;
-            sMLFSetup.chmap[i].customNoteTableIndex = chconf.useCustomMapping ? 1 : 0;
-        }
-    }
+    SDL_Init(SDL_INIT_AUDIO);
+    lsg_log_start();
     
-    sMLFSetup.deltaScale = lsg_util_calc_delta_time_scale(&mlf);
-    sMLFSetup.loopDesc = mlf.loopDesc;
+    lsg_initialize_with_sample_rate(lsg_song_get_sample_rate(pSong));
+    lsg_sdl_start();
+    lsg_song_bind(pSong, 8820);
+    lsg_sdl_set_running(1);
     
-    lsg_free_mlf(&mlf);
+    getchar();
+    SDL_Quit();
+    lsg_log_stop();
+    lsg_song_close(pSong);
+    return 0;
 }
 
-void destroyReserveBuffers() {
-    for (int i = 0;i < kNRsvBufs;++i) {
-        lsg_rsvcmd_destroy(&sRsvbufs[i]);
+bool lookupInputName(std::string& outStr, int argc, char* argv[]) {
+    if (argc < 2) {
+        return false;
     }
+    
+    outStr = argv[1];
+    return true;
 }
@@ -5,6 +5,7 @@
 #ifndef LSGTest_LSG_h
 #define LSGTest_LSG_h
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef _MSC_VER
 #define LSG_INLINE __inline
@@ -16,9 +17,8 @@ typedef short LSGSample;
 typedef int LSGStatus;
 
 typedef uint32_t ChannelCommand;
-#define kChannelCommandBufferLength 441
-#define kChannelCommandInterval 100
-#define kChannelFIRLength 9
+#define kChannelEventQueueLength 32 // power of 2
+#define kChannelCommandInterval 100 // at kLSGOutSamplingRate; contexts scale it to keep the same duration
 
 typedef struct _LSG_ADSR {
     int attack_rate;
@@ -30,35 +30,54 @@ typedef struct _LSG_ADSR {
 
 typedef void (*lsg_channel_command_executed_callback)(void* userData, int channelIndex, ChannelCommand cmd, int timeOffset);
 
+// One sounding note. Voices live in a per-context pool and are assigned to channels on key on.
+typedef struct _LSGVoice_t {
+    int channelIndex;   // owner, -1 = free
+    uint32_t phase;     // position in one generator cycle (2^32 = 1 cycle)
+    uint32_t phaseInc;  // phase step per sample, from bent_fq + the channel's global_detune
+    float fq, bent_fq;
+    int lastNote;
+    int volume;
+    int currentBaseGain4X;
+    int keyonCount;
+    int adsrPhase;
+    unsigned short noiseRegister;
+    uint32_t keyonSerial; // for stealing the oldest voice
+    uint32_t envelopeClock; // 16.16 envelope steps owed (ADSR steps run at kLSGOutSamplingRate)
+} LSGVoice_t;
+
+typedef struct _LSGChannelEvent_t {
+    int64_t tick; // sample time
+    ChannelCommand cmd;
+} LSGChannelEvent_t;
+
 typedef struct _LSGChannel_t {
     int selfIndex;
     
     int generatorIndex;
     int customNoteIndex;
+    int polyphony;      // max voices (1 = monophonic)
     LSG_ADSR adsr;
     
-    int readPos;
     float global_detune;
     int global_volume;
     int system_volume;
     int system_vol_dest;
-    float fq, bent_fq;
-    int lastNote;
-    int volume;
-    int currentBaseGain4X;
-    int keyonCount;
-    int adsrPhase;
-    unsigned short noiseRegister;
-    LSGSample fir_buf[kChannelFIRLength];
     
-    ChannelCommand commandRingBuffer[kChannelCommandBufferLength];
-    int ringHeadPos;
     lsg_channel_command_executed_callback exec_callback;
     void* userDataForCallback;
     
     struct _LSGReservedCommandBuffer_t* pReservedCommandBuffer;
+    
+    // Scheduled commands sorted by tick (ring)
+    int eventHead;
+    int nEvents;
+    unsigned int nDroppedEvents; // more than kChannelEventQueueLength due within one interval
+    LSGChannelEvent_t eventQueue[kChannelEventQueueLength];
 } LSGChannel_t;
 
+typedef void (*lsg_rsvcmd_refill_proc)(void* userData, int64_t endTick);
+
 typedef struct _LSGReservedCommand_t {
     int64_t tick;
     ChannelCommand cmd;
@@ -74,12 +93,24 @@ typedef struct _LSGReservedCommandBuffer_t {
     int64_t loopStartTime;
     int64_t loopEndTime;
     LSGReservedCommand_t* array;
+    int64_t tickOffset; // added to the ticks in array (compiled songs are stored from time 0)
+    
+    // Streaming: the array is a ring holding the next (up to) length commands,
+    // and refillProc is called on the synthesizing thread before they are read
+    int bWindow;
+    lsg_rsvcmd_refill_proc refillProc;
+    void* refillUserData;
 } LSGReservedCommandBuffer_t;
 
-#define kLSGOutSamplingRate 44100
+#define kLSGOutSamplingRate 44100 // default engine rate, and the rate ADSR values are defined at
+#define kLSGMinSamplingRate 8000
+#define kLSGMaxSamplingRate 192000
 #define kLSGNumGenerators 13
-#define kLSGNumGeneratorSamples (44100*8)
+#define kLSGWavetableLengthBits 12
+#define kLSGWavetableLength (1 << kLSGWavetableLengthBits)
+#define kLSGPhaseOneCycle 4294967296.0
 #define kLSGNumOutChannels 13
+#define kLSGDefaultVoicePoolSize kLSGNumOutChannels
 #define kLSGRawGainMax4X 131072
 #define kLSGChannelVolumeMax 127
 
@@ -98,6 +129,7 @@ typedef struct _LSGReservedCommandBuffer_t {
 
 #define kLSGCommandBit_Enable   0x80000000
 #define kLSGCommandBit_NoKey    0x40000000
+#define kLSGCommandBit_ReleaseNote 0x20000000 // key off only the voice playing the note number (polyphonic channels)
 #define kLSGCommandBit_KeyOn    0x00000080
 #define kLSGCommandMask_NoteNum 0x0000007f
 
@@ -110,6 +142,13 @@ typedef struct _LSGReservedCommandBuffer_t {
 #define kLSGCommandMask_Volume    0x007f0000
 
 #define kLSGNoteMappingLength 128
+#define kLSGNumMIDIChannels 16
+#define kLSGStreamLookaheadMS 500 // streamed commands are decoded this far ahead of the play position
+
+// Voice stealing (when the pool or the channel's polyphony is used up)
+#define kLSGVoiceSteal_Oldest   0
+#define kLSGVoiceSteal_Quietest 1
+#define kLSGVoiceSteal_None     2 // drop the new note
 
 // MLF Types
 
@@ -150,6 +189,7 @@ typedef struct _MappedMLFChannel_t {
     int bEventsArrayIsStatic; // don't free memory
     int customNoteTableIndex;
     int eventsLength;
+    int midiChannel; // source channel when streaming (-1: none)
     int userData;
     
     LSG_ADSR defaultADSR;
@@ -181,13 +221,29 @@ typedef struct _MLFPlaySetup_t {
     MappedMLFChannel_t chmap[kLSGNumOutChannels];
 } MLFPlaySetup_t;
 
-// Public APIs
-LSGStatus lsg_initialize();
+// Decodes the tracks while playing instead of expanding them (see lsg_rsvcmd_stream_mlf).
+// Same events in the same order as the expanded path, unless a track has more than 32 events
+// within 2 ticks of a note off moved back by the 0-delta fix-up.
+typedef struct _lsg_mlf_stream_t lsg_mlf_stream_t;
+
+// Synthesizer context: owns all channel, generator and timing state.
+// One context can be rendered by one thread at a time; separate contexts are independent.
+typedef struct _lsg_context_t lsg_context_t;
+
+// Public APIs (operate on the default context)
+LSGStatus lsg_initialize(); // keeps the sample rate of the last initialization (kLSGOutSamplingRate at first)
+LSGStatus lsg_initialize_with_sample_rate(int sampleRate);
+int lsg_get_sample_rate();
+int lsg_get_command_interval(); // samples per command interval
 LSGStatus lsg_set_buffer_running(char bRunning);
 LSGStatus lsg_channel_initialize_volume_params(int channelIndex);
 LSGStatus lsg_initialize_channel_keyon(int channelIndex);
 LSGStatus lsg_synthesize_BE16(unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo);
 LSGStatus lsg_synthesize_LE16(unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo);
+// Native endian 32bit output; stride counts samples per frame (float: +-1.0, int32: full scale)
+LSGStatus lsg_synthesize_f32(float* pOut, size_t nSamples, int stride, const int bStereo);
+LSGStatus lsg_synthesize_s32(int32_t* pOut, size_t nSamples, int stride, const int bStereo);
+LSGStatus lsg_synthesize_f32_planar(float* const* ppChannels, int nChannels, size_t nSamples); // NULL channels are skipped
 LSGStatus lsg_set_channel_frequency(int channelIndex, float fq);
 LSGStatus lsg_set_channel_global_detune(int channelIndex, float d);
 LSGStatus lsg_set_channel_global_volume(int channelIndex, int v);
@@ -197,18 +253,26 @@ LSGStatus lsg_get_channel_copy(int channelIndex, LSGChannel_t* pOut);
 LSGStatus lsg_set_channel_adsr(int channelIndex, LSG_ADSR* pSourceADSR);
 LSGStatus lsg_get_channel_adsr(int channelIndex, LSG_ADSR* pOutADSR);
 LSGStatus lsg_noteoff_channel_immediately(int channelIndex);
-LSGStatus lsg_apply_channel_adsr(LSGChannel_t* ch);
-LSGStatus lsg_advance_channel_state(LSGChannel_t* ch);
+LSGStatus lsg_apply_voice_adsr(LSGVoice_t* v, const LSG_ADSR* adsr);
+LSGStatus lsg_advance_voice_state(LSGVoice_t* v);
 LSGStatus lsg_set_channel_command_exec_callback(int channelIndex, lsg_channel_command_executed_callback callback, void* userData);
 LSGStatus lsg_initialize_custom_note_table();
 LSGStatus lsg_set_custom_note_frequency(int index, float fq);
 LSGStatus lsg_use_custom_notes(int channelIndex, int customNotesIndex);
 
+// voice pool
+LSGStatus lsg_set_voice_pool_size(int nVoices); // not while synthesizing
+LSGStatus lsg_set_voice_steal_policy(int policy);
+LSGStatus lsg_set_channel_polyphony(int channelIndex, int nVoices);
+
 // fade control
 LSGStatus lsg_set_channel_system_volume(int channelIndex, int vol);
 LSGStatus lsg_set_channel_auto_fade(int channelIndex, int dest_vol);
 LSGStatus lsg_set_channel_auto_fade_max(int channelIndex);
 
+// Optional smoothing FIR on the mixed output (off by default)
+LSGStatus lsg_set_post_filter_enabled(int bEnabled);
+
 int64_t lsg_get_global_tick();
 int lsg_get_semitone_flag(int noteIndex);
 
@@ -220,10 +284,13 @@ LSGStatus lsg_generate_short_noise(int generatorBufferIndex);
 LSGStatus lsg_generate_sin(int generatorBufferIndex, float a1, float a2, float a3, float a4, float a5, float a8, float a16);
 LSGStatus lsg_generate_sin_v(int generatorBufferIndex, const float* coefficients, unsigned int count);
 LSGStatus lsg_generate_mixed(int generatorBufferIndex, int sourceGeneratorIndex1, int sourceGeneratorIndex2);
-ChannelCommand lsg_consume_channel_command_buffer(LSGChannel_t* ch);
 
+// Queued and applied at the next synthesize call; safe from one control thread while another synthesizes.
+// Each context holds at least 1024 pending commands (fails with LSGERR_BUFFER_FULL beyond that).
+// A channel takes up to kChannelEventQueueLength commands per interval; more are dropped and logged.
 LSGStatus lsg_put_channel_command(int channelIndex, int offset, ChannelCommand cmd);
 LSGStatus lsg_put_channel_command_and_clear_later(int channelIndex, int offset, ChannelCommand cmd);
+LSGStatus lsg_put_channel_command_at_sample(int channelIndex, int sampleOffset, ChannelCommand cmd); // samples from now
 
  // reserved commdnd API
 LSGStatus lsg_rsvcmd_init(LSGReservedCommandBuffer_t* pRCBuf, size_t length);
@@ -233,26 +300,107 @@ LSGStatus lsg_rsvcmd_clear(LSGReservedCommandBuffer_t* pRCBuf);
 LSGStatus lsg_channel_bind_rsvcmd(int channelIndex, LSGReservedCommandBuffer_t* pRCBuf);
 LSGStatus lsg_rsvcmd_from_mml(LSGReservedCommandBuffer_t* pRCBuf, int w_duration, const char* mml, int64_t originTick);
 LSGStatus lsg_rsvcmd_fill_mlf(LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, MLFPlaySetup_t* pPlaySetup, int64_t originTime);
+// Turns the buffers into windows fed from the stream while synthesizing (chmap[].midiChannel selects the source)
+LSGStatus lsg_rsvcmd_stream_mlf(LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, MLFPlaySetup_t* pPlaySetup, lsg_mlf_stream_t* pStream, int64_t originTime);
+LSGStatus lsg_rsvcmd_add_mlf_event(LSGReservedCommandBuffer_t* pRCBuf, const MLFEvent_t* ev, int64_t tick); // note on/off and pitch; others are ignored
+size_t lsg_rsvcmd_get_free_length(const LSGReservedCommandBuffer_t* pRCBuf);
 int lsg_rsvcmd_get_channel_loop_count(int channelIndex);
 
+// Loads the pregenerated waves from a cache file, or builds them and writes the file
+// when it is missing or stale. Call once at startup, before any context is used.
+LSGStatus lsg_use_wave_cache_file(const char* path);
+
+// Context APIs
+lsg_context_t* lsg_context_create(); // returns an initialized context
+lsg_context_t* lsg_context_create_with_sample_rate(int sampleRate);
+void lsg_context_destroy(lsg_context_t* ctx);
+lsg_context_t* lsg_get_default_context();
+LSGStatus lsg_ctx_initialize(lsg_context_t* ctx);
+LSGStatus lsg_ctx_initialize_with_sample_rate(lsg_context_t* ctx, int sampleRate);
+int lsg_ctx_get_sample_rate(lsg_context_t* ctx);
+int lsg_ctx_get_command_interval(lsg_context_t* ctx);
+LSGStatus lsg_ctx_set_buffer_running(lsg_context_t* ctx, char bRunning);
+LSGStatus lsg_ctx_channel_initialize_volume_params(lsg_context_t* ctx, int channelIndex);
+LSGStatus lsg_ctx_initialize_channel_keyon(lsg_context_t* ctx, int channelIndex);
+LSGStatus lsg_ctx_synthesize_BE16(lsg_context_t* ctx, unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo);
+LSGStatus lsg_ctx_synthesize_LE16(lsg_context_t* ctx, unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo);
+LSGStatus lsg_ctx_synthesize_f32(lsg_context_t* ctx, float* pOut, size_t nSamples, int stride, const int bStereo);
+LSGStatus lsg_ctx_synthesize_s32(lsg_context_t* ctx, int32_t* pOut, size_t nSamples, int stride, const int bStereo);
+LSGStatus lsg_ctx_synthesize_f32_planar(lsg_context_t* ctx, float* const* ppChannels, int nChannels, size_t nSamples);
+LSGStatus lsg_ctx_set_channel_frequency(lsg_context_t* ctx, int channelIndex, float fq);
+LSGStatus lsg_ctx_set_channel_global_detune(lsg_context_t* ctx, int channelIndex, float d);
+LSGStatus lsg_ctx_set_channel_global_volume(lsg_context_t* ctx, int channelIndex, int v);
+LSGStatus lsg_ctx_set_channel_source_generator(lsg_context_t* ctx, int channelIndex, int generatorBufferIndex);
+LSGStatus lsg_ctx_set_channel_white_noise(lsg_context_t* ctx, int channelIndex);
+LSGStatus lsg_ctx_get_channel_copy(lsg_context_t* ctx, int channelIndex, LSGChannel_t* pOut);
+LSGStatus lsg_ctx_set_channel_adsr(lsg_context_t* ctx, int channelIndex, LSG_ADSR* pSourceADSR);
+LSGStatus lsg_ctx_get_channel_adsr(lsg_context_t* ctx, int channelIndex, LSG_ADSR* pOutADSR);
+LSGStatus lsg_ctx_noteoff_channel_immediately(lsg_context_t* ctx, int channelIndex);
+LSGStatus lsg_ctx_set_channel_command_exec_callback(lsg_context_t* ctx, int channelIndex, lsg_channel_command_executed_callback callback, void* userData);
+LSGStatus lsg_ctx_initialize_custom_note_table(lsg_context_t* ctx);
+LSGStatus lsg_ctx_set_custom_note_frequency(lsg_context_t* ctx, int index, float fq);
+LSGStatus lsg_ctx_use_custom_notes(lsg_context_t* ctx, int channelIndex, int customNotesIndex);
+LSGStatus lsg_ctx_set_voice_pool_size(lsg_context_t* ctx, int nVoices);
+LSGStatus lsg_ctx_set_voice_steal_policy(lsg_context_t* ctx, int policy);
+LSGStatus lsg_ctx_set_channel_polyphony(lsg_context_t* ctx, int channelIndex, int nVoices);
+LSGStatus lsg_ctx_set_channel_system_volume(lsg_context_t* ctx, int channelIndex, int vol);
+LSGStatus lsg_ctx_set_channel_auto_fade(lsg_context_t* ctx, int channelIndex, int dest_vol);
+LSGStatus lsg_ctx_set_channel_auto_fade_max(lsg_context_t* ctx, int channelIndex);
+LSGStatus lsg_ctx_set_post_filter_enabled(lsg_context_t* ctx, int bEnabled);
+int64_t lsg_ctx_get_global_tick(lsg_context_t* ctx);
+LSGStatus lsg_ctx_generate_triangle(lsg_context_t* ctx, int generatorBufferIndex);
+LSGStatus lsg_ctx_generate_square(lsg_context_t* ctx, int generatorBufferIndex);
+LSGStatus lsg_ctx_generate_square_13(lsg_context_t* ctx, int generatorBufferIndex);
+LSGStatus lsg_ctx_generate_square_2114(lsg_context_t* ctx, int generatorBufferIndex);
+LSGStatus lsg_ctx_generate_short_noise(lsg_context_t* ctx, int generatorBufferIndex);
+LSGStatus lsg_ctx_generate_sin(lsg_context_t* ctx, int generatorBufferIndex, float a1, float a2, float a3, float a4, float a5, float a8, float a16);
+LSGStatus lsg_ctx_generate_sin_v(lsg_context_t* ctx, int generatorBufferIndex, const float* coefficients, unsigned int count);
+LSGStatus lsg_ctx_generate_mixed(lsg_context_t* ctx, int generatorBufferIndex, int sourceGeneratorIndex1, int sourceGeneratorIndex2);
+LSGStatus lsg_ctx_put_channel_command(lsg_context_t* ctx, int channelIndex, int offset, ChannelCommand cmd);
+LSGStatus lsg_ctx_put_channel_command_and_clear_later(lsg_context_t* ctx, int channelIndex, int offset, ChannelCommand cmd);
+LSGStatus lsg_ctx_put_channel_command_at_sample(lsg_context_t* ctx, int channelIndex, int sampleOffset, ChannelCommand cmd);
+LSGStatus lsg_ctx_channel_bind_rsvcmd(lsg_context_t* ctx, int channelIndex, LSGReservedCommandBuffer_t* pRCBuf);
+LSGStatus lsg_ctx_rsvcmd_fill_mlf(lsg_context_t* ctx, LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, MLFPlaySetup_t* pPlaySetup, int64_t originTime);
+LSGStatus lsg_ctx_rsvcmd_stream_mlf(lsg_context_t* ctx, LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, MLFPlaySetup_t* pPlaySetup, lsg_mlf_stream_t* pStream, int64_t originTime);
+int lsg_ctx_rsvcmd_get_channel_loop_count(lsg_context_t* ctx, int channelIndex);
+LSGSample lsg_ctx_get_generator_buffer_sample(lsg_context_t* ctx, int generatorBufferIndex, int sampleIndex);
+void lsg_ctx_set_force_global_tick(lsg_context_t* ctx, int64_t t);
+
 // MLF APIs
 LSGStatus lsg_init_mlf(lsg_mlf_t* p_mlf_t);
 LSGStatus lsg_load_mlf(lsg_mlf_t* p_mlf_t, const char* filename, int auto_drum_mapping_ch);
+LSGStatus lsg_load_mlf_from_memory(lsg_mlf_t* p_mlf_t, const void* pData, size_t length, int auto_drum_mapping_ch);
 void lsg_free_mlf(lsg_mlf_t* p_mlf_t);
+// Caps the threads one load decodes tracks with (1: only the calling thread). Default: one per CPU, up to 16.
+void lsg_mlf_set_max_decode_threads(int nThreads);
 
 int lsg_mlf_count_channel_events(lsg_mlf_t* p_mlf_t, int channelIndex);
 int lsg_mlf_count_channel_events_in_track(MLFTrack_t* p_track, int channelIndex);
 MLFEvent_t* lsg_mlf_create_sorted_channel_events(lsg_mlf_t* p_mlf_t, int channelIndex);
+// Same for every MIDI channel in one scan of the tracks (arrays of kLSGNumMIDIChannels; NULL/0 for unused channels)
+LSGStatus lsg_mlf_create_all_sorted_channel_events(lsg_mlf_t* p_mlf_t, MLFEvent_t** outEventsArray, int* outLengthArray);
 void lsg_mlf_init_play_setup_struct(MLFPlaySetup_t* pSetup);
 void lsg_mlf_destroy_play_setup_struct(MLFPlaySetup_t* pSetup);
 void lsg_mlf_init_channel_mapping(MappedMLFChannel_t* ls, int count);
 void lsg_mlf_destroy_channel_mapping(MappedMLFChannel_t* ls, int count);
 int lsg_mlf_is_loop_valid(MLFLoopDesc* pLoop);
 
-int lsg_util_calc_delta_time_scale(const lsg_mlf_t* p_mlf);
+// Streaming MLF: opening scans the tracks once for the tempo, loop and length without storing events
+lsg_mlf_stream_t* lsg_mlf_stream_open(const char* filename, int auto_drum_mapping_ch); // NULL on failure
+lsg_mlf_stream_t* lsg_mlf_stream_open_memory(const void* pData, size_t length, int auto_drum_mapping_ch); // the bytes must outlive the stream
+void lsg_mlf_stream_close(lsg_mlf_stream_t* pStream);
+const lsg_mlf_t* lsg_mlf_stream_get_info(const lsg_mlf_stream_t* pStream); // header, tempo and loop (no tracks_arr)
+uint32_t lsg_mlf_stream_get_last_ticks(const lsg_mlf_stream_t* pStream, int midiChannel);
+LSGStatus lsg_mlf_stream_start(lsg_mlf_stream_t* pStream, LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, const MLFPlaySetup_t* pPlaySetup, int64_t originTime, int64_t lookahead);
+void lsg_mlf_stream_refill(void* pStream, int64_t endTick); // lsg_rsvcmd_refill_proc
+
+int lsg_util_calc_delta_time_scale(const lsg_mlf_t* p_mlf); // at the default context's sample rate
+int lsg_util_calc_delta_time_scale_for_rate(const lsg_mlf_t* p_mlf, int sampleRate);
 
 // Debug APIs
 LSGSample lsg_get_generator_buffer_sample(int generatorBufferIndex, int sampleIndex);
 void lsg_set_force_global_tick(int64_t t);
+void lsg_set_simd_enabled(int bEnabled); // 0: use the scalar (reference) output kernels
+void lsg_get_generator_cache_info(int* pNumTables, size_t* pHeapBytes, size_t* pMappedBytes); // tables shared by all contexts; pMappedBytes: cache file mappings in use
 
 #endif
@@ -3,6 +3,7 @@
 #include <math.h>
 #include <string.h>
 #include "LSG.h"
+#include "LSGlog.h"
 
 typedef struct _MMLNote_t {
     int note;
@@ -18,6 +19,13 @@ LSGStatus lsg_rsvcmd_init(LSGReservedCommandBuffer_t* pRCBuf, size_t length) {
     pRCBuf->readPosition = 0;
     pRCBuf->length = length;
     pRCBuf->writtenLength = 0;
+    pRCBuf->lastLoopCount = 0;
+    pRCBuf->loopFirstIndex = pRCBuf->loopLastIndex = 0;
+    pRCBuf->loopStartTime = pRCBuf->loopEndTime = 0;
+    pRCBuf->tickOffset = 0;
+    pRCBuf->bWindow = 0;
+    pRCBuf->refillProc = NULL;
+    pRCBuf->refillUserData = NULL;
     pRCBuf->array = (LSGReservedCommand_t*)malloc( sizeof(LSGReservedCommand_t) * length );
     
     return LSG_OK;
@@ -36,17 +44,24 @@ LSGStatus lsg_rsvcmd_destroy(LSGReservedCommandBuffer_t* pRCBuf) {
 LSGStatus lsg_rsvcmd_add(LSGReservedCommandBuffer_t* pRCBuf, ChannelCommand cmd, int64_t tick) {
     if (!pRCBuf) { return LSGERR_NULLPTR; }
     
-    if (pRCBuf->writtenLength >= pRCBuf->length) {
+    if (lsg_rsvcmd_get_free_length(pRCBuf) == 0) {
         return LSGERR_BUFFER_FULL;
     }
     
-    pRCBuf->array[pRCBuf->writtenLength].cmd = cmd;
-    pRCBuf->array[pRCBuf->writtenLength].tick = tick;
+    const size_t index = pRCBuf->bWindow ? (pRCBuf->writtenLength % pRCBuf->length) : pRCBuf->writtenLength;
+    pRCBuf->array[index].cmd = cmd;
+    pRCBuf->array[index].tick = tick;
     ++(pRCBuf->writtenLength);
     
     return LSG_OK;
 }
 
+// Windows get back the slots of the commands already read
+size_t lsg_rsvcmd_get_free_length(const LSGReservedCommandBuffer_t* pRCBuf) {
+    const size_t used = pRCBuf->bWindow ? (pRCBuf->writtenLength - (size_t)pRCBuf->readPosition) : pRCBuf->writtenLength;
+    return (used < pRCBuf->length) ? (pRCBuf->length - used) : 0;
+}
+
 LSGStatus lsg_rsvcmd_clear(LSGReservedCommandBuffer_t* pRCBuf) {
     if (!pRCBuf) { return LSGERR_NULLPTR; }
     pRCBuf->readPosition = 0;
@@ -73,14 +88,54 @@ static unsigned long generatePitchBits(const MLFEvent_t* ev) {
 
 
 static void lsg_rsvcmd_mark_loop_start(LSGReservedCommandBuffer_t* rb, const MLFEvent_t* ev, int loopStartTick, int* pLoopStartSet) {
-    //fprintf(stderr, "    %d  %d\n", ev->absoluteTicks, loopStartTick);
     if (!(*pLoopStartSet) &&  ev->absoluteTicks >= loopStartTick) {
         *pLoopStartSet = 1;
         rb->loopFirstIndex = rb->writtenLength - 1;
     }
 }
 
+LSGStatus lsg_rsvcmd_add_mlf_event(LSGReservedCommandBuffer_t* pRCBuf, const MLFEvent_t* ev, int64_t tick) {
+    ChannelCommand cmd = kLSGCommandBit_Enable;
+    if (ev->type == ME_NoteOn) {
+        int vol = ev->velocity;
+        if (vol > 127) { vol = 127; }
+        unsigned long pitchbits = generatePitchBits(ev);
+        
+        cmd |= kLSGCommandBit_KeyOn | ev->noteNo | kLSGCommandBit_Volume | (vol << 16) | pitchbits;
+    } else if (ev->type == ME_NoteOff) {
+        cmd |= kLSGCommandBit_ReleaseNote | ev->noteNo;
+    } else if (ev->type == ME_Pitch) {
+        unsigned long pitchbits = generatePitchBits(ev);
+        cmd |= kLSGCommandBit_NoKey | pitchbits;
+    } else {
+        return LSG_OK;
+    }
+    
+    return lsg_rsvcmd_add(pRCBuf, cmd, tick);
+}
+
+// Channel setup shared by the expanded and the streamed playback
+static void lsg_rsvcmd_setup_mlf_channel(lsg_context_t* ctx, LSGReservedCommandBuffer_t* rb, int ch, MLFPlaySetup_t* pPlaySetup, int64_t originTime) {
+    rb->loopFirstIndex = 0;
+    rb->loopLastIndex = 0;
+    rb->lastLoopCount = 0;
+    rb->tickOffset = 0;
+    rb->loopStartTime = originTime + (int64_t)pPlaySetup->loopDesc.startTicks * pPlaySetup->deltaScale;
+    rb->loopEndTime = originTime + (int64_t)pPlaySetup->loopDesc.endTicks * pPlaySetup->deltaScale;
+
+    MappedMLFChannel_t* mappedCh = &pPlaySetup->chmap[ch];
+    if (mappedCh->defaultADSR.attack_rate) {
+        lsg_ctx_set_channel_adsr(ctx, ch, &(mappedCh->defaultADSR));
+    }
+    
+    lsg_ctx_use_custom_notes(ctx, ch, mappedCh->customNoteTableIndex);
+}
+
 LSGStatus lsg_rsvcmd_fill_mlf(LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, MLFPlaySetup_t* pPlaySetup, int64_t originTime) {
+    return lsg_ctx_rsvcmd_fill_mlf(lsg_get_default_context(), pRCBufArray, nRCBufs, pPlaySetup, originTime);
+}
+
+LSGStatus lsg_ctx_rsvcmd_fill_mlf(lsg_context_t* ctx, LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, MLFPlaySetup_t* pPlaySetup, int64_t originTime) {
     int ch;
     const int use_loop = lsg_mlf_is_loop_valid(&pPlaySetup->loopDesc);
     
@@ -88,43 +143,22 @@ LSGStatus lsg_rsvcmd_fill_mlf(LSGReservedCommandBuffer_t* pRCBufArray, int nRCBu
         // refer rv buffer
         if (ch >= nRCBufs) { break; }
         LSGReservedCommandBuffer_t* rb = &pRCBufArray[ch];
-        rb->loopFirstIndex = 0;
-        rb->loopLastIndex = 0;
-        rb->lastLoopCount = 0;
-        rb->loopStartTime = originTime + pPlaySetup->loopDesc.startTicks * pPlaySetup->deltaScale;
-        rb->loopEndTime = originTime + pPlaySetup->loopDesc.endTicks * pPlaySetup->deltaScale;
+        lsg_rsvcmd_setup_mlf_channel(ctx, rb, ch, pPlaySetup, originTime);
+        rb->bWindow = 0;
+        rb->refillProc = NULL;
 
         MappedMLFChannel_t* mappedCh = &pPlaySetup->chmap[ch];
         const int len = mappedCh->eventsLength;
         
-        if (mappedCh->defaultADSR.attack_rate) {
-            lsg_set_channel_adsr(ch, &(mappedCh->defaultADSR));
-        }
-        
-        lsg_use_custom_notes(ch, mappedCh->customNoteTableIndex);
-        
         int bLoopStartSet = 0; // Start marker processed?
         for (int i = 0;i < len;++i) {
             const MLFEvent_t* ev = &(mappedCh->sortedEvents[i]);
             
-            ChannelCommand cmd = kLSGCommandBit_Enable;
             const int buft = ev->absoluteTicks * pPlaySetup->deltaScale;
-            if (ev->type == ME_NoteOn) {
-                int vol = ev->velocity;
-                if (vol > 127) { vol = 127; }
-                unsigned long pitchbits = generatePitchBits(ev);
-                
-                cmd |= kLSGCommandBit_KeyOn | ev->noteNo | kLSGCommandBit_Volume | (vol << 16) | pitchbits;
-                lsg_rsvcmd_add(rb, cmd, originTime + buft);
-                if (use_loop){ lsg_rsvcmd_mark_loop_start(rb, ev, pPlaySetup->loopDesc.startTicks, &bLoopStartSet); }
-            } else if (ev->type == ME_NoteOff) {
-                lsg_rsvcmd_add(rb, cmd, originTime + buft);
-                if (use_loop){ lsg_rsvcmd_mark_loop_start(rb, ev, pPlaySetup->loopDesc.startTicks, &bLoopStartSet); }
-            } else if (ev->type == ME_Pitch) {
-                unsigned long pitchbits = generatePitchBits(ev);
-                cmd |= kLSGCommandBit_NoKey | pitchbits;
-                lsg_rsvcmd_add(rb, cmd, originTime + buft);
-                if (use_loop){ lsg_rsvcmd_mark_loop_start(rb, ev, pPlaySetup->loopDesc.startTicks, &bLoopStartSet); }
+            const size_t nWritten = rb->writtenLength;
+            lsg_rsvcmd_add_mlf_event(rb, ev, originTime + buft);
+            if (use_loop && rb->writtenLength > nWritten) {
+                lsg_rsvcmd_mark_loop_start(rb, ev, pPlaySetup->loopDesc.startTicks, &bLoopStartSet);
             }
 
             if (use_loop) {
@@ -133,16 +167,37 @@ LSGStatus lsg_rsvcmd_fill_mlf(LSGReservedCommandBuffer_t* pRCBufArray, int nRCBu
                     rb->loopLastIndex = rb->writtenLength - 1;
                 }
             }
-//if (ev->type == ME_NoteOn)
-//            fprintf(stderr, "    @ %d %d\n", ev->absoluteTicks, buft);
         } // end one channel
-        
-//        fprintf(stderr, "Loop info: %ld  %ld  %lld\n", rb->loopFirstIndex, rb->loopLastIndex, rb->loopStartTime);
     }
     
     return LSG_OK;
 }
 
+LSGStatus lsg_rsvcmd_stream_mlf(LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, MLFPlaySetup_t* pPlaySetup, lsg_mlf_stream_t* pStream, int64_t originTime) {
+    return lsg_ctx_rsvcmd_stream_mlf(lsg_get_default_context(), pRCBufArray, nRCBufs, pPlaySetup, pStream, originTime);
+}
+
+// The buffers only hold the commands due within the lookahead; the stream loops by rewinding itself
+LSGStatus lsg_ctx_rsvcmd_stream_mlf(lsg_context_t* ctx, LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, MLFPlaySetup_t* pPlaySetup, lsg_mlf_stream_t* pStream, int64_t originTime) {
+    if (!pRCBufArray || !pPlaySetup || !pStream) {
+        return LSGERR_NULLPTR;
+    }
+    
+    if (nRCBufs > kLSGNumOutChannels) { nRCBufs = kLSGNumOutChannels; }
+    for (int ch = 0;ch < nRCBufs;++ch) {
+        LSGReservedCommandBuffer_t* rb = &pRCBufArray[ch];
+        lsg_rsvcmd_clear(rb);
+        lsg_rsvcmd_setup_mlf_channel(ctx, rb, ch, pPlaySetup, originTime);
+        
+        rb->bWindow = 1;
+        rb->refillProc = lsg_mlf_stream_refill;
+        rb->refillUserData = pStream;
+    }
+    
+    const int64_t lookahead = (int64_t)lsg_ctx_get_sample_rate(ctx) * kLSGStreamLookaheadMS / 1000;
+    return lsg_mlf_stream_start(pStream, pRCBufArray, nRCBufs, pPlaySetup, originTime, lookahead);
+}
+
 #define kMMLBadNum -1
 static int mmlReadNum(int* pOut, const char* pStr, int pos) {
     int minus = 0;
@@ -242,42 +297,42 @@ LSGStatus lsg_rsvcmd_from_mml(LSGReservedCommandBuffer_t* pRCBuf, int w_duration
             case 'k': {
                 if (mmlReadNumberedCommand(mml, &pos, &st_Detune) != LSG_OK) { return LSGERR_BAD_MML; }
                 
-                printf("k=%d\n", st_Detune);
+                LSG_LOG_DEBUG("MML k=%d", st_Detune);
                 break;
             }
                 
             case 'l': {
                 if (mmlReadNumberedCommand(mml, &pos, &st_DefaultLen) != LSG_OK) { return LSGERR_BAD_MML; }
 
-                printf("L=%d\n", st_DefaultLen);
+                LSG_LOG_DEBUG("MML L=%d", st_DefaultLen);
                 break;
             }
 
             case 'q': {
                 if (mmlReadNumberedCommand(mml, &pos, &st_Q) != LSG_OK) { return LSGERR_BAD_MML; }
                 
-                printf("Q=%d\n", st_Q);
+                LSG_LOG_DEBUG("MML Q=%d", st_Q);
                 break;
             }
 
             case 'o': {
                 if (mmlReadNumberedCommand(mml, &pos, &st_Octave) != LSG_OK) { return LSGERR_BAD_MML; }
                 
-                printf("O=%d\n", st_Octave);
+                LSG_LOG_DEBUG("MML O=%d", st_Octave);
                 break;
             }
 
             case '@': {
                 if (mmlReadNumberedCommand(mml, &pos, &st_Tim) != LSG_OK) { return LSGERR_BAD_MML; }
                 
-                printf("@=%d\n", st_Tim);
+                LSG_LOG_DEBUG("MML @=%d", st_Tim);
                 break;
             }
 
             case 'v': {
                 if (mmlReadNumberedCommand(mml, &pos, &st_Vol) != LSG_OK) { return LSGERR_BAD_MML; }
                 
-                printf("v=%d\n", st_Vol);
+                LSG_LOG_DEBUG("MML v=%d", st_Vol);
                 break;
             }
 
@@ -364,7 +419,7 @@ LSGStatus lsg_rsvcmd_from_mml(LSGReservedCommandBuffer_t* pRCBuf, int w_duration
             }
 
             default:
-                printf("Unknown statement: %c\n", k1);
+                LSG_LOG_WARN("MML: unknown statement %c", k1);
                 return LSGERR_BAD_MML;
                 break;
         }
@@ -378,7 +433,7 @@ static const int WNOTE_MAP[] = {0, 2, 4, 5, 7, 9, 11};
 LSGStatus mmlReadNote(const char* mml, int* pos, MMLNote_t* pOutNote) {
     int dots = 0;
     int noteLen = 0;
-    printf("<%c>",mml[*pos]);
+    const char noteName = mml[*pos];
     int w_noteno = mml[*pos] - 'c';
     if (w_noteno < 0) { w_noteno += 7; }
     
@@ -424,7 +479,7 @@ LSGStatus mmlReadNote(const char* mml, int* pos, MMLNote_t* pOutNote) {
         pOutNote->dots = dots;
     }
     
-    printf("[[ %d - %d - %d ]]\n", nn, noteLen, dots);
+    LSG_LOG_TRACE("MML note %c: [[ %d - %d - %d ]]", noteName, nn, noteLen, dots);
     
     return LSG_OK;
 }
@@ -1,23 +1,28 @@
 #include <stdio.h>
+#include <stdlib.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <memory.h>
 #include "LSG.h"
+#include "LSGdsp.h"
+#include "LSGlog.h"
+#include "LSGwavetable.h"
 #define generator_index_in_range(x) ((x) >= 0 && (x) < kLSGNumGenerators)
 #define generator_index_good(x) (((x) >= 0 && (x) < kLSGNumGenerators) || (x) == kLSGWhiteNoiseGeneratorSpecialIndex)
 #define channel_index_in_range(x) ((x) >= 0 && (x) < kLSGNumOutChannels)
 
-#if defined(__arm64__) || defined(__arm__)
-#define LSGDEBUG_VERBOSE_COMMAND 0
-#else
-#define LSGDEBUG_VERBOSE_COMMAND 1
-#endif
-
-#define kLSGNumInternalPregeneratedWaves 2
-#define kLSGPregeneratedIndexForSquare   0
-#define kLSGPregeneratedIndexForSquare13 1
-
-static char sLSGBufferRunning = 1;
+// Keys of the shared generator tables
+enum {
+    kLSGGeneratorKind_Silent = 1,
+    kLSGGeneratorKind_Triangle,
+    kLSGGeneratorKind_Square,
+    kLSGGeneratorKind_Square13,
+    kLSGGeneratorKind_Square2114,
+    kLSGGeneratorKind_ShortNoise,
+    kLSGGeneratorKind_Sin,
+    kLSGGeneratorKind_SinV,
+    kLSGGeneratorKind_Mixed
+};
 
 static const float sNoteTable[12] = {
     32.703196f, // 0  C
@@ -91,89 +96,311 @@ static const float sFIRTable63[63] = {0, -0, -0.000001, -0.000003, 0.000001, 0.0
     0.023033, 0.010038, 0.000115, -0.006526, -0.010083, -0.011066, -0.01017, -0.008146, -0.005679, -0.003306, -0.001373, -0.000037, 0.000708, 0.000972, 0.000916, 0.0007,
     0.000448, 0.000239, 0.0001, 0.000028, 0.000001, -0.000003, -0.000001, -0, 0};
 
-static float sCustomNoteMapping[kLSGNoteMappingLength];
+// Smoothing applied to the hard edged waves (taps were 1000 samples apart in the former 8 sec buffers)
+static const LSGWavetableFilter_t sGeneratorFilter = {
+    sFIRTable63, 63, 1000.0 / (44100.0 * 8.0)
+};
+
+// Optional smoothing of the mixed output (the former per-channel FIR, made symmetric and normalized).
+// Even length puts a zero at Nyquist: -3 dB at 0.2 fs.
+#define kLSGPostFilterTaps 8
+static const float sPostFilterTaps[kLSGPostFilterTaps] = {
+    0.0022400f, -0.0278263f, 0.0879350f, 0.4376512f, 0.4376512f, 0.0879350f, -0.0278263f, 0.0022400f
+};
 
 #define kBinNoiseFeedback 0x4000
 #define kBinNoiseTap1     0x01
 #define kBinNoiseTap2     0x02
 
-static int64_t sGlobalTick = 0;
-static LSGSample sGeneratorBuffers[kLSGNumGenerators][kLSGNumGeneratorSamples];
-static LSGSample sGeneratorTempBuf[kLSGNumGeneratorSamples];
-static LSGChannel_t sChannelStatuses[kLSGNumOutChannels];
+// Command posted by the control thread, applied by the audio thread at the next block start
+typedef struct _LSGQueuedCommand_t {
+    int channelIndex;
+    int bClearLater;
+    int64_t tick; // exact sample time
+    ChannelCommand cmd;
+} LSGQueuedCommand_t;
+
+#define kLSGCommandQueueLength 1024 // power of 2
+
+// Wait-free single producer / single consumer ring
+typedef struct _LSGCommandQueue_t {
+    uint32_t writeIndex; // written by the producer only
+    char pad1[60];
+    uint32_t readIndex;  // written by the consumer only
+    char pad2[60];
+    LSGQueuedCommand_t items[kLSGCommandQueueLength];
+} LSGCommandQueue_t;
+
+// Drained commands waiting for their interval, sorted by tick (ring; audio thread only)
+typedef struct _LSGStagedCommands_t {
+    int head;
+    int nCommands;
+    LSGQueuedCommand_t items[kLSGCommandQueueLength];
+} LSGStagedCommands_t;
+
+struct _lsg_context_t {
+    char bBufferRunning;
+    int sampleRate;
+    int commandInterval;       // samples per command interval (kChannelCommandInterval scaled to sampleRate)
+    uint32_t envelopeClockInc; // ADSR steps per sample in 16.16
+    int64_t globalTick; // also read by the producer of commandQueue
+    LSGCommandQueue_t commandQueue;
+    LSGStagedCommands_t stagedCommands;
+    float customNoteMapping[kLSGNoteMappingLength];
+    LSGChannel_t channelStatuses[kLSGNumOutChannels];
+    const LSGWavetable_t* generators[kLSGNumGenerators]; // shared, never NULL after initialized
+    unsigned short generatorNoiseRegister; // white noise source of lsg_generate_mixed
+    
+    // Voice pool
+    LSGVoice_t* voices;
+    int nVoices;
+    int voiceStealPolicy;
+    uint32_t nextKeyonSerial;
+    int* spanBuffers; // [nVoices][commandInterval]
+    
+    // Post-mix filter
+    int bPostFilter;
+    int* postFilterBus; // [kLSGPostFilterTaps - 1 (history) + commandInterval]
+    int* postFilterOut; // [commandInterval]
+};
+
+// Used by the context-less APIs (the rate is readable before lsg_initialize)
+static lsg_context_t sDefaultContext = { .sampleRate = kLSGOutSamplingRate };
 
-static LSGSample sPregeneratedBuffers[kLSGNumInternalPregeneratedWaves][kLSGNumGeneratorSamples];
 
 static LSGStatus lsg_initialize_channel(LSGChannel_t* ch);
-static LSGStatus lsg_initialize_channel_command_buffer(LSGChannel_t* ch);
-static LSGStatus lsg_initialize_channel_fir_buffer(LSGChannel_t* ch);
-static LSGStatus lsg_initialize_generators();
-static LSGStatus lsg_prepare_pregenerated_buffers();
-static LSGStatus lsg_fill_generator_buffer(LSGSample* buf, size_t len, LSGSample val);
-static LSGStatus lsg_apply_channel_command(LSGChannel_t* ch, ChannelCommand cmd, int commandOffsetPosition);
-static LSGSample lsg_calc_channel_gain(LSGChannel_t* ch);
-static LSGSample lsg_update_channel_fir(LSGChannel_t* ch, LSGSample newValue);
-static LSGStatus lsg_fill_reserved_commands(int64_t startTick, LSGChannel_t* ch);
+static LSGStatus lsg_initialize_channel_event_queue(LSGChannel_t* ch);
+static LSGStatus lsg_initialize_generators(lsg_context_t* ctx);
+static LSGStatus lsg_apply_channel_command(lsg_context_t* ctx, LSGChannel_t* ch, ChannelCommand cmd, int commandOffsetPosition);
+static LSGSample lsg_calc_voice_gain(LSGVoice_t* v, const LSGWavetableLevel_t* pLevel);
+static void lsg_initialize_voice(lsg_context_t* ctx, LSGVoice_t* v, int channelIndex);
+static LSGStatus lsg_initialize_voices(lsg_context_t* ctx);
+static LSGVoice_t* lsg_allocate_voice(lsg_context_t* ctx, LSGChannel_t* ch, int noteNo);
+static LSGStatus lsg_fill_reserved_commands(LSGChannel_t* ch, int64_t now, int64_t endTick);
+static void lsg_schedule_channel_command(LSGChannel_t* ch, int64_t tick, int64_t now, ChannelCommand cmd, int bClearLater);
+static void lsg_drain_command_queue(lsg_context_t* ctx);
+static void lsg_feed_staged_commands(lsg_context_t* ctx, int64_t now, int64_t endTick);
 static LSGStatus lsg_generate_square_intl(LSGSample* p);
 static LSGStatus lsg_generate_square13_intl(LSGSample* p);
-static LSGStatus lsg_copy_pregenerated_wave(LSGSample* pDest, int pregenIndex);
-static LSGStatus lsg_apply_generator_filter(int generatorIndex);
-static LSGStatus lsg_apply_generator_filter_intl(LSGSample* p);
+static LSGStatus lsg_ctx_assign_generator(lsg_context_t* ctx, int generatorBufferIndex, int kind, const void* params, size_t paramsSize, LSGWavetableBuilder builder, void* userData);
+static LSGStatus lsg_build_silent(LSGWavetable_t* wt, void* userData);
+static LSGSample lsg_get_generator_sample_in_cycle(lsg_context_t* ctx, int generatorBufferIndex, int position, int cycleLength);
 static LSGStatus lsg_apply_channel_system_fade(LSGChannel_t* ch);
+static void lsg_update_voice_phase_increment(const lsg_context_t* ctx, LSGVoice_t* v, const LSGChannel_t* ch);
 
-LSGStatus lsg_initialize() {
-    sGlobalTick = 0;
-    sLSGBufferRunning = 1;
+#define kLSGEnvelopeClockOne 0x10000
+
+// Recalculate when bent_fq or global_detune is changed
+void lsg_update_voice_phase_increment(const lsg_context_t* ctx, LSGVoice_t* v, const LSGChannel_t* ch) {
+    double inc = ((double)v->bent_fq + (double)ch->global_detune) * kLSGPhaseOneCycle / (double)ctx->sampleRate;
+    if (inc < 0) { inc = 0; }
+    else if (inc >= kLSGPhaseOneCycle) { inc = kLSGPhaseOneCycle - 1.0; }
+    
+    v->phaseInc = (uint32_t)inc;
+}
+
+#define foreach_channel_voice(ctx, ch, v) \
+    for (LSGVoice_t* v = (ctx)->voices;v < (ctx)->voices + (ctx)->nVoices;++v) if (v->channelIndex == (ch)->selfIndex)
+
+lsg_context_t* lsg_context_create() {
+    return lsg_context_create_with_sample_rate(kLSGOutSamplingRate);
+}
+
+lsg_context_t* lsg_context_create_with_sample_rate(int sampleRate) {
+    lsg_context_t* ctx = (lsg_context_t*)calloc(1, sizeof(lsg_context_t));
+    if (!ctx) {
+        return NULL;
+    }
+    
+    if (lsg_ctx_initialize_with_sample_rate(ctx, sampleRate) != LSG_OK) {
+        lsg_context_destroy(ctx);
+        return NULL;
+    }
+    
+    return ctx;
+}
+
+void lsg_context_destroy(lsg_context_t* ctx) {
+    if (ctx && ctx != &sDefaultContext) {
+        for (int i = 0;i < kLSGNumGenerators;++i) {
+            lsg_wavetable_cache_release(ctx->generators[i]);
+        }
+        
+        free(ctx->voices);
+        free(ctx->spanBuffers);
+        free(ctx->postFilterBus);
+        free(ctx);
+    }
+}
+
+lsg_context_t* lsg_get_default_context() {
+    return &sDefaultContext;
+}
+
+LSGStatus lsg_ctx_initialize(lsg_context_t* ctx) {
+    if (!ctx) {
+        return LSGERR_NULLPTR;
+    }
+    
+    return lsg_ctx_initialize_with_sample_rate(ctx, ctx->sampleRate ? ctx->sampleRate : kLSGOutSamplingRate);
+}
+
+// Everything time based is derived from the rate here: phase increments, the command interval
+// (same duration as kChannelCommandInterval at kLSGOutSamplingRate) and the ADSR clock.
+LSGStatus lsg_ctx_initialize_with_sample_rate(lsg_context_t* ctx, int sampleRate) {
+    if (!ctx) {
+        return LSGERR_NULLPTR;
+    }
+    
+    if (sampleRate < kLSGMinSamplingRate || sampleRate > kLSGMaxSamplingRate) {
+        return LSGERR_PARAM_OUTBOUND;
+    }
+    
+    ctx->sampleRate = sampleRate;
+    ctx->commandInterval = (int)(((int64_t)sampleRate * kChannelCommandInterval + kLSGOutSamplingRate / 2) / kLSGOutSamplingRate);
+    ctx->envelopeClockInc = (uint32_t)(((int64_t)kLSGOutSamplingRate * kLSGEnvelopeClockOne + sampleRate / 2) / sampleRate);
+    
+    const size_t nBusLength = kLSGPostFilterTaps - 1 + ctx->commandInterval;
+    int* postFilterBus = (int*)realloc(ctx->postFilterBus, sizeof(int) * (nBusLength + ctx->commandInterval));
+    if (!postFilterBus) {
+        return LSGERR_GENERIC;
+    }
+    ctx->postFilterBus = postFilterBus;
+    ctx->postFilterOut = postFilterBus + nBusLength;
+    memset(postFilterBus, 0, sizeof(int) * (kLSGPostFilterTaps - 1));
+
+    ctx->globalTick = 0;
+    ctx->bBufferRunning = 1;
 
-    if (lsg_initialize_generators() != LSG_OK) {
+    if (lsg_initialize_generators(ctx) != LSG_OK) {
+        return LSGERR_GENERIC;
+    }
+    
+    lsg_dsp_initialize();
+    lsg_ctx_initialize_custom_note_table(ctx);
+    ctx->generatorNoiseRegister = kBinNoiseFeedback;
+    ctx->commandQueue.writeIndex = 0;
+    ctx->commandQueue.readIndex = 0;
+    ctx->stagedCommands.head = 0;
+    ctx->stagedCommands.nCommands = 0;
+    
+    // (also resizes the span buffers to the command interval)
+    if (lsg_ctx_set_voice_pool_size(ctx, ctx->voices ? ctx->nVoices : kLSGDefaultVoicePoolSize) != LSG_OK) {
         return LSGERR_GENERIC;
     }
     
-    lsg_prepare_pregenerated_buffers();
-    lsg_initialize_custom_note_table();
+    for (int i = 0;i < kLSGNumOutChannels;++i) {
+        ctx->channelStatuses[i].selfIndex = i;
+        lsg_initialize_channel(&ctx->channelStatuses[i]);
+    }
     
+    lsg_initialize_voices(ctx);
     for (int i = 0;i < kLSGNumOutChannels;++i) {
-        lsg_initialize_channel(&sChannelStatuses[i]);
-        lsg_channel_initialize_volume_params(i);
-        sChannelStatuses[i].selfIndex = i;
+        lsg_ctx_channel_initialize_volume_params(ctx, i);
     }
     
     return LSG_OK;
 }
 
-LSGStatus lsg_prepare_pregenerated_buffers() {
-    // : : : : PREPARED waves
-    for (int i = 0;i < kLSGNumInternalPregeneratedWaves;++i) {
-        LSGSample* p = &sPregeneratedBuffers[i][0];
-        
-        if (i == kLSGPregeneratedIndexForSquare) {
-            lsg_generate_square_intl(p);
-            lsg_apply_generator_filter_intl(p);
-        } else if (i == kLSGPregeneratedIndexForSquare13) {
-            lsg_generate_square13_intl(p);
-            lsg_apply_generator_filter_intl(p);
-        }
+// Every channel starts with one voice of its own (as long as the pool is large enough)
+LSGStatus lsg_initialize_voices(lsg_context_t* ctx) {
+    ctx->voiceStealPolicy = kLSGVoiceSteal_Oldest;
+    ctx->nextKeyonSerial = 0;
+    
+    for (int i = 0;i < ctx->nVoices;++i) {
+        lsg_initialize_voice(ctx, &ctx->voices[i], (i < kLSGNumOutChannels) ? i : -1);
+    }
+    
+    return LSG_OK;
+}
+
+void lsg_initialize_voice(lsg_context_t* ctx, LSGVoice_t* v, int channelIndex) {
+    v->channelIndex = channelIndex;
+    v->fq = v->bent_fq = 440;
+    v->lastNote = 0;
+    v->volume = kLSGChannelVolumeMax;
+    v->currentBaseGain4X = 0;
+    v->keyonCount = -1;
+    v->adsrPhase = 0;
+    v->noiseRegister = kBinNoiseFeedback;
+    v->phase = 0;
+    v->phaseInc = 0;
+    v->keyonSerial = 0;
+    v->envelopeClock = 0;
+    
+    if (channelIndex >= 0) {
+        // Detune is 0 right after channel initialization
+        double inc = (double)v->bent_fq * kLSGPhaseOneCycle / (double)ctx->sampleRate;
+        v->phaseInc = (uint32_t)inc;
+    }
+}
+
+LSGStatus lsg_ctx_set_voice_pool_size(lsg_context_t* ctx, int nVoices) {
+    if (nVoices < 1) {
+        return LSGERR_PARAM_OUTBOUND;
+    }
+    
+    // Both arrays are allocated before either is replaced, so a failure keeps the old pool
+    LSGVoice_t* voices = (LSGVoice_t*)malloc(sizeof(LSGVoice_t) * nVoices);
+    int* spanBuffers = (int*)malloc(sizeof(int) * ctx->commandInterval * nVoices);
+    if (!voices || !spanBuffers) {
+        free(voices);
+        free(spanBuffers);
+        return LSGERR_GENERIC;
+    }
+    
+    const int nKept = ctx->voices ? ((ctx->nVoices < nVoices) ? ctx->nVoices : nVoices) : 0;
+    if (nKept) {
+        memcpy(voices, ctx->voices, sizeof(LSGVoice_t) * nKept);
+    }
+    
+    // The span buffers only hold the current span
+    free(ctx->voices);
+    free(ctx->spanBuffers);
+    ctx->voices = voices;
+    ctx->spanBuffers = spanBuffers;
+    
+    // Added voices are free
+    for (int i = nKept;i < nVoices;++i) {
+        lsg_initialize_voice(ctx, &voices[i], -1);
     }
+    
+    ctx->nVoices = nVoices;
     return LSG_OK;
 }
 
-LSGStatus lsg_copy_pregenerated_wave(LSGSample* pDest, int pregenIndex) {
-    if (pregenIndex != kLSGPregeneratedIndexForSquare &&
-        pregenIndex != kLSGPregeneratedIndexForSquare13) {
+LSGStatus lsg_ctx_set_voice_steal_policy(lsg_context_t* ctx, int policy) {
+    if (policy != kLSGVoiceSteal_Oldest && policy != kLSGVoiceSteal_Quietest && policy != kLSGVoiceSteal_None) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    LSGSample* sourcePregenBuf = &sPregeneratedBuffers[pregenIndex][0];
-    memcpy(pDest, sourcePregenBuf, sizeof(LSGSample) * kLSGNumGeneratorSamples);
+    ctx->voiceStealPolicy = policy;
     return LSG_OK;
 }
 
-int64_t lsg_get_global_tick() {
-    return sGlobalTick;
+LSGStatus lsg_ctx_set_channel_polyphony(lsg_context_t* ctx, int channelIndex, int nVoices) {
+    if (!channel_index_in_range(channelIndex) || nVoices < 1) {
+        return LSGERR_PARAM_OUTBOUND;
+    }
+    
+    ctx->channelStatuses[channelIndex].polyphony = nVoices;
+    return LSG_OK;
 }
 
-LSGStatus lsg_set_buffer_running(char bRunning) {
-    sLSGBufferRunning = bRunning;
+int lsg_ctx_get_sample_rate(lsg_context_t* ctx) {
+    return ctx->sampleRate;
+}
+
+int lsg_ctx_get_command_interval(lsg_context_t* ctx) {
+    return ctx->commandInterval;
+}
+
+int64_t lsg_ctx_get_global_tick(lsg_context_t* ctx) {
+    return ctx->globalTick;
+}
+
+LSGStatus lsg_ctx_set_buffer_running(lsg_context_t* ctx, char bRunning) {
+    ctx->bBufferRunning = bRunning;
     return LSG_OK;
 }
 
@@ -181,27 +408,31 @@ int lsg_get_semitone_flag(int noteIndex) {
     return sSemitoneFlagTable[noteIndex % 12];
 }
 
-void lsg_set_force_global_tick(int64_t t) {
-    sGlobalTick = t;
+void lsg_ctx_set_force_global_tick(lsg_context_t* ctx, int64_t t) {
+    ctx->globalTick = t;
 }
 
-LSGStatus lsg_initialize_generators() {
+LSGStatus lsg_initialize_generators(lsg_context_t* ctx) {
     int i;
     
     for (i = 0;i < kLSGNumGenerators;++i) {
-        lsg_fill_generator_buffer(sGeneratorBuffers[i], kLSGNumGeneratorSamples, 0);
+        if (lsg_ctx_assign_generator(ctx, i, kLSGGeneratorKind_Silent, NULL, 0, lsg_build_silent, NULL) != LSG_OK) {
+            return LSGERR_GENERIC;
+        }
     }
     
     return LSG_OK;
 }
 
-LSGStatus lsg_channel_initialize_volume_params(int channelIndex) {
+LSGStatus lsg_ctx_channel_initialize_volume_params(lsg_context_t* ctx, int channelIndex) {
     if (!channel_index_in_range(channelIndex)) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    LSGChannel_t* ch = &sChannelStatuses[channelIndex];
-    ch->volume = kLSGChannelVolumeMax;
+    LSGChannel_t* ch = &ctx->channelStatuses[channelIndex];
+    foreach_channel_voice(ctx, ch, v) {
+        v->volume = kLSGChannelVolumeMax;
+    }
     ch->global_volume = kLSGChannelVolumeMax;
     ch->system_volume = ch->system_vol_dest = kLSGChannelVolumeMax;
 
@@ -209,16 +440,11 @@ LSGStatus lsg_channel_initialize_volume_params(int channelIndex) {
 }
 
 LSGStatus lsg_initialize_channel(LSGChannel_t* ch) {
-    ch->fq = ch->bent_fq = 440;
-    ch->lastNote = 0;
     ch->global_detune = 0;
     
-//    ch->fq = 261.625565f;
-//    ch->fq = 293.66476f;
     ch->generatorIndex = 0;
     ch->customNoteIndex = 0;
-    ch->currentBaseGain4X = 0;
-    ch->readPos = 0;
+    ch->polyphony = 1;
     
     ch->adsr.attack_rate = kLSGRawGainMax4X >> 4;
     ch->adsr.decay_rate = 8;
@@ -226,205 +452,290 @@ LSGStatus lsg_initialize_channel(LSGChannel_t* ch) {
     ch->adsr.release_rate = 2;
     ch->adsr.fade_rate = 0;
     
-    ch->keyonCount = -1;
-    ch->adsrPhase = 0;
-    ch->noiseRegister = kBinNoiseFeedback;
-    
     ch->pReservedCommandBuffer = NULL;
     
     ch->exec_callback = NULL;
     ch->userDataForCallback = NULL;
     
-    lsg_initialize_channel_command_buffer(ch);
-    lsg_initialize_channel_fir_buffer(ch);
+    lsg_initialize_channel_event_queue(ch);
 
     return LSG_OK;
 }
 
-LSGStatus lsg_initialize_channel_keyon(int channelIndex) {
+LSGStatus lsg_ctx_initialize_channel_keyon(lsg_context_t* ctx, int channelIndex) {
     if (!channel_index_in_range(channelIndex)) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].currentBaseGain4X = 0;
-    sChannelStatuses[channelIndex].keyonCount = -1;
+    foreach_channel_voice(ctx, &ctx->channelStatuses[channelIndex], v) {
+        v->currentBaseGain4X = 0;
+        v->keyonCount = -1;
+    }
+    
     return LSG_OK;
 }
 
 
-LSGStatus lsg_initialize_custom_note_table() {
+LSGStatus lsg_ctx_initialize_custom_note_table(lsg_context_t* ctx) {
     for (int i = 0;i < kLSGNoteMappingLength;++i) {
-        sCustomNoteMapping[i] = 440.0f;
+        ctx->customNoteMapping[i] = 440.0f;
     }
     
     return LSG_OK;
 }
 
-LSGStatus lsg_set_custom_note_frequency(int index, float fq) {
+LSGStatus lsg_ctx_set_custom_note_frequency(lsg_context_t* ctx, int index, float fq) {
     if (index >= kLSGNoteMappingLength) { return LSGERR_PARAM_OUTBOUND; }
     if (index < 0) { index = 0; }
     
-    sCustomNoteMapping[index] = fq;
+    ctx->customNoteMapping[index] = fq;
         
     return LSG_OK;
 }
 
-LSGStatus lsg_use_custom_notes(int channelIndex, int customNotesIndex) {
+LSGStatus lsg_ctx_use_custom_notes(lsg_context_t* ctx, int channelIndex, int customNotesIndex) {
     if (!channel_index_in_range(channelIndex)) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].customNoteIndex = customNotesIndex;
-    return LSG_OK;
-}
-
-LSGStatus lsg_initialize_channel_command_buffer(LSGChannel_t* ch) {
-    for (int i = 0;i < kChannelCommandBufferLength;++i) {
-        ch->commandRingBuffer[i] = 0;
-    }
-    
-    ch->ringHeadPos = 0;
-    
+    ctx->channelStatuses[channelIndex].customNoteIndex = customNotesIndex;
     return LSG_OK;
 }
 
-LSGStatus lsg_initialize_channel_fir_buffer(LSGChannel_t* ch) {
-    LSGSample* buf = ch->fir_buf;
-    
-    for (int i = 0;i < kChannelFIRLength;++i) {
-        buf[i] = 0;
-    }
+LSGStatus lsg_initialize_channel_event_queue(LSGChannel_t* ch) {
+    ch->eventHead = 0;
+    ch->nEvents = 0;
+    ch->nDroppedEvents = 0;
     
     return LSG_OK;
 }
 
-ChannelCommand lsg_consume_channel_command_buffer(LSGChannel_t* ch) {
-    // read
-    const ChannelCommand cmd = ch->commandRingBuffer[ ch->ringHeadPos ];
-
-    // clear
-    ch->commandRingBuffer[ ch->ringHeadPos ] = 0;
-    
-    // advance
-    ch->ringHeadPos = (ch->ringHeadPos + 1) % kChannelCommandBufferLength;
-
-    return cmd;
-}
-
-LSGStatus lsg_set_channel_source_generator(int channelIndex, int generatorBufferIndex) {
+LSGStatus lsg_ctx_set_channel_source_generator(lsg_context_t* ctx, int channelIndex, int generatorBufferIndex) {
     if (!channel_index_in_range(channelIndex) || !generator_index_in_range( generatorBufferIndex )) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].generatorIndex = generatorBufferIndex;
+    ctx->channelStatuses[channelIndex].generatorIndex = generatorBufferIndex;
     
     return LSG_OK;
 }
 
-LSGStatus lsg_set_channel_white_noise(int channelIndex) {
+LSGStatus lsg_ctx_set_channel_white_noise(lsg_context_t* ctx, int channelIndex) {
     if (!channel_index_in_range(channelIndex)) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].generatorIndex = kLSGWhiteNoiseGeneratorSpecialIndex;
+    ctx->channelStatuses[channelIndex].generatorIndex = kLSGWhiteNoiseGeneratorSpecialIndex;
 
     return LSG_OK;
 }
 
-LSGStatus lsg_set_channel_adsr(int channelIndex, LSG_ADSR* pSourceADSR) {
+LSGStatus lsg_ctx_set_channel_adsr(lsg_context_t* ctx, int channelIndex, LSG_ADSR* pSourceADSR) {
     if (!channel_index_in_range(channelIndex) || !pSourceADSR) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].adsr = *pSourceADSR;
+    ctx->channelStatuses[channelIndex].adsr = *pSourceADSR;
     
     return LSG_OK;
 }
 
-LSGStatus lsg_get_channel_adsr(int channelIndex, LSG_ADSR* pOutADSR) {
+LSGStatus lsg_ctx_get_channel_adsr(lsg_context_t* ctx, int channelIndex, LSG_ADSR* pOutADSR) {
     if (!channel_index_in_range(channelIndex) || !pOutADSR) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    *pOutADSR = sChannelStatuses[channelIndex].adsr;
+    *pOutADSR = ctx->channelStatuses[channelIndex].adsr;
     
     return LSG_OK;
 }
 
-LSGStatus lsg_get_channel_copy(int channelIndex, LSGChannel_t* pOut) {
+LSGStatus lsg_ctx_get_channel_copy(lsg_context_t* ctx, int channelIndex, LSGChannel_t* pOut) {
     if (!channel_index_in_range(channelIndex) || !pOut) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    *pOut = sChannelStatuses[channelIndex];
+    *pOut = ctx->channelStatuses[channelIndex];
     
     return LSG_OK;
 }
 
-LSGStatus lsg_noteoff_channel_immediately(int channelIndex) {
+LSGStatus lsg_ctx_noteoff_channel_immediately(lsg_context_t* ctx, int channelIndex) {
     if (!channel_index_in_range(channelIndex)) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    LSGChannel_t* ch = &sChannelStatuses[channelIndex];
-    ch->keyonCount = -1;
-    ch->currentBaseGain4X = 0;
+    foreach_channel_voice(ctx, &ctx->channelStatuses[channelIndex], v) {
+        v->keyonCount = -1;
+        v->currentBaseGain4X = 0;
+    }
     
     return LSG_OK;
 }
 
-LSGStatus lsg_set_channel_command_exec_callback(int channelIndex, lsg_channel_command_executed_callback callback, void* userData) {
+LSGStatus lsg_ctx_set_channel_command_exec_callback(lsg_context_t* ctx, int channelIndex, lsg_channel_command_executed_callback callback, void* userData) {
     if (!channel_index_in_range(channelIndex)) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].exec_callback = callback;
-    sChannelStatuses[channelIndex].userDataForCallback = userData;
+    ctx->channelStatuses[channelIndex].exec_callback = callback;
+    ctx->channelStatuses[channelIndex].userDataForCallback = userData;
     
     return LSG_OK;
 }
 
-LSGStatus lsg_put_channel_command(int channelIndex, int offset, ChannelCommand cmd) {
-    if (channelIndex < 0 || channelIndex >= kLSGNumOutChannels) {
+// First command boundary at or after the tick (interval based put APIs count from here)
+static LSG_INLINE int64_t lsg_next_command_boundary(int64_t tick, int interval) {
+    return ((tick + interval - 1) / interval) * interval;
+}
+
+// Producer side: may be called from one control thread while another thread synthesizes.
+// Never blocks; fails with LSGERR_BUFFER_FULL if the audio thread is not draining.
+// (delay counts command intervals from the next boundary if bAligned, otherwise samples from now)
+static LSGStatus lsg_enqueue_channel_command(lsg_context_t* ctx, int channelIndex, int bAligned, int delay, ChannelCommand cmd, int bClearLater) {
+    if (channelIndex < 0 || channelIndex >= kLSGNumOutChannels || delay < 0) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    LSGChannel_t* ch = &sChannelStatuses[channelIndex];
-    ChannelCommand* buf = ch->commandRingBuffer;
+    LSGCommandQueue_t* q = &ctx->commandQueue;
+    const uint32_t w = q->writeIndex;
+    if (w - __atomic_load_n(&q->readIndex, __ATOMIC_ACQUIRE) >= kLSGCommandQueueLength) {
+        return LSGERR_BUFFER_FULL;
+    }
     
-    const int bufPos = (ch->ringHeadPos + offset) % kChannelCommandBufferLength;
-    buf[bufPos] = cmd;
+    // Stamped with an absolute time so that the delay before draining does not shift the command
+    const int64_t now = __atomic_load_n(&ctx->globalTick, __ATOMIC_RELAXED);
+    LSGQueuedCommand_t* item = &q->items[w & (kLSGCommandQueueLength - 1)];
+    item->channelIndex = channelIndex;
+    item->bClearLater = bClearLater;
+    item->tick = bAligned ? lsg_next_command_boundary(now, ctx->commandInterval) + (int64_t)delay * ctx->commandInterval : now + delay;
+    item->cmd = cmd;
     
+    __atomic_store_n(&q->writeIndex, w + 1, __ATOMIC_RELEASE);
     return LSG_OK;
 }
 
-LSGStatus lsg_put_channel_command_and_clear_later_internal(LSGChannel_t* ch, int offset, ChannelCommand cmd) {
-    ChannelCommand* buf = ch->commandRingBuffer;
-    const int filllen = kChannelCommandBufferLength - offset;
-    for (int i = 0;i < filllen;++i) {
-        const int bufPos = (ch->ringHeadPos + offset + i) % kChannelCommandBufferLength;
-        if (i == 0) {
-            buf[bufPos] = cmd;
-        } else {
-            buf[bufPos] = 0;
+#define staged_command_at(s, i) (&(s)->items[((s)->head + (i)) & (kLSGCommandQueueLength - 1)])
+
+// Keeps the staged commands sorted by tick; commands at the same tick keep their order
+static void lsg_stage_command(LSGStagedCommands_t* s, const LSGQueuedCommand_t* item) {
+    // Clear-later also drops the staged commands it would clear once fed
+    if (item->bClearLater) {
+        int n = 0;
+        for (int i = 0;i < s->nCommands;++i) {
+            const LSGQueuedCommand_t* staged = staged_command_at(s, i);
+            if (staged->channelIndex != item->channelIndex || staged->tick < item->tick) {
+                *staged_command_at(s, n++) = *staged;
+            }
         }
+        s->nCommands = n;
     }
     
-    return LSG_OK;
+    int i = s->nCommands;
+    for (;i > 0;--i) {
+        const LSGQueuedCommand_t* prev = staged_command_at(s, i - 1);
+        if (prev->tick <= item->tick) {
+            break;
+        }
+        
+        *staged_command_at(s, i) = *prev;
+    }
+    
+    *staged_command_at(s, i) = *item;
+    ++s->nCommands;
 }
 
-LSGStatus lsg_put_channel_command_and_clear_later(int channelIndex, int offset, ChannelCommand cmd) {
-    if (channelIndex < 0 || channelIndex >= kLSGNumOutChannels) {
-        return LSGERR_PARAM_OUTBOUND;
+// Consumer side: called by the audio thread at the start of every block.
+// Commands are staged until their interval, so the channel queues only hold what is due soon.
+void lsg_drain_command_queue(lsg_context_t* ctx) {
+    LSGCommandQueue_t* q = &ctx->commandQueue;
+    const uint32_t w = __atomic_load_n(&q->writeIndex, __ATOMIC_ACQUIRE);
+    uint32_t r = q->readIndex;
+    if (r == w) {
+        return;
+    }
+    
+    // When staging is full the rest stays in the queue (and the producer sees LSGERR_BUFFER_FULL)
+    for (;r != w && ctx->stagedCommands.nCommands < kLSGCommandQueueLength;++r) {
+        lsg_stage_command(&ctx->stagedCommands, &q->items[r & (kLSGCommandQueueLength - 1)]);
+    }
+    
+    __atomic_store_n(&q->readIndex, r, __ATOMIC_RELEASE);
+}
+
+// Hands the channels the staged commands due before endTick
+void lsg_feed_staged_commands(lsg_context_t* ctx, int64_t now, int64_t endTick) {
+    LSGStagedCommands_t* s = &ctx->stagedCommands;
+    while (s->nCommands > 0) {
+        const LSGQueuedCommand_t* item = staged_command_at(s, 0);
+        if (item->tick >= endTick) {
+            break;
+        }
+        
+        lsg_schedule_channel_command(&ctx->channelStatuses[item->channelIndex], item->tick, now, item->cmd, item->bClearLater);
+        s->head = (s->head + 1) & (kLSGCommandQueueLength - 1);
+        --s->nCommands;
+    }
+}
+
+#define channel_event_at(ch, i) (&(ch)->eventQueue[((ch)->eventHead + (i)) & (kChannelEventQueueLength - 1)])
+
+// Places a command at an exact sample time (audio thread only); late ticks are applied right away.
+// Commands at the same tick keep their order. bClearLater drops everything scheduled at or after the tick.
+void lsg_schedule_channel_command(LSGChannel_t* ch, int64_t tick, int64_t now, ChannelCommand cmd, int bClearLater) {
+    if (tick < now) {
+        tick = now;
     }
     
-    LSGChannel_t* ch = &sChannelStatuses[channelIndex];
-    return lsg_put_channel_command_and_clear_later_internal(ch, offset, cmd);
+    if (bClearLater) {
+        while (ch->nEvents > 0 && channel_event_at(ch, ch->nEvents - 1)->tick >= tick) {
+            --ch->nEvents;
+        }
+    }
+    
+    // Full (more than kChannelEventQueueLength events due within an interval): the latest event is dropped
+    if (ch->nEvents == kChannelEventQueueLength) {
+        ++ch->nDroppedEvents;
+        LSG_LOG_WARN("Ch %d: event queue full, %u commands dropped", ch->selfIndex, ch->nDroppedEvents);
+        if (channel_event_at(ch, ch->nEvents - 1)->tick <= tick) {
+            return;
+        }
+        
+        --ch->nEvents;
+    }
+    
+    // Insert from the back (usually appends)
+    int i = ch->nEvents;
+    for (;i > 0;--i) {
+        const LSGChannelEvent_t* prev = channel_event_at(ch, i - 1);
+        if (prev->tick <= tick) {
+            break;
+        }
+        
+        *channel_event_at(ch, i) = *prev;
+    }
+    
+    LSGChannelEvent_t* ev = channel_event_at(ch, i);
+    ev->tick = tick;
+    ev->cmd = cmd;
+    ++ch->nEvents;
+}
+
+LSGStatus lsg_ctx_put_channel_command(lsg_context_t* ctx, int channelIndex, int offset, ChannelCommand cmd) {
+    return lsg_enqueue_channel_command(ctx, channelIndex, 1, offset, cmd, 0);
+}
+
+LSGStatus lsg_ctx_put_channel_command_at_sample(lsg_context_t* ctx, int channelIndex, int sampleOffset, ChannelCommand cmd) {
+    return lsg_enqueue_channel_command(ctx, channelIndex, 0, sampleOffset, cmd, 0);
 }
 
-static LSG_INLINE float calcNoteFreq(int noteNo, int custom) {
+LSGStatus lsg_ctx_put_channel_command_and_clear_later(lsg_context_t* ctx, int channelIndex, int offset, ChannelCommand cmd) {
+    return lsg_enqueue_channel_command(ctx, channelIndex, 1, offset, cmd, 1);
+}
+
+static LSG_INLINE float calcNoteFreq(lsg_context_t* ctx, int noteNo, int custom) {
     if (custom) {
-        return sCustomNoteMapping[noteNo];
+        return ctx->customNoteMapping[noteNo];
     }
 
     const float mul = (noteNo == 1) ? 0.025f : 0.25f;
@@ -434,41 +745,63 @@ static LSG_INLINE float calcNoteFreq(int noteNo, int custom) {
     return sNoteTable[nidx] * powf(2, oct) * mul;
 }
 
-LSGStatus lsg_apply_channel_command(LSGChannel_t* ch, ChannelCommand cmd, int commandOffsetPosition) {
-    if ((cmd & kLSGCommandBit_Enable) == 0) {
-        return LSG_OK;
-    }
-    
-    if ((cmd & kLSGCommandBit_NoKey) == 0) {
-        const int keyon = cmd & kLSGCommandBit_KeyOn;
-        if (!keyon) {
-            ch->keyonCount = -1;
-        } else {
-            ch->keyonCount = 0;
-            ch->adsrPhase = 0;
-        }
-    }
-    // else modify params only
-    
-    
+// Applies volume, note and pitch bits of the command to one voice
+static void lsg_apply_voice_params(lsg_context_t* ctx, LSGChannel_t* ch, LSGVoice_t* v, ChannelCommand cmd) {
     if (cmd & kLSGCommandBit_Volume) {
-        ch->volume = (cmd & kLSGCommandMask_Volume) >> 16;
+        v->volume = (cmd & kLSGCommandMask_Volume) >> 16;
     }
     
-    const int noteNo = cmd & kLSGCommandMask_NoteNum;
+    // With ReleaseNote the note number only selects the voice
+    const int noteNo = (cmd & kLSGCommandBit_ReleaseNote) ? 0 : (cmd & kLSGCommandMask_NoteNum);
     if (noteNo) {
-        float base_fq = calcNoteFreq(noteNo, ch->customNoteIndex);
+        float base_fq = calcNoteFreq(ctx, noteNo, ch->customNoteIndex);
         
-        ch->fq = ch->bent_fq = base_fq;
-        ch->lastNote = noteNo;
+        v->fq = v->bent_fq = base_fq;
+        v->lastNote = noteNo;
     }
 
     const uint32_t pitchbits = cmd & (kLSGCommandMask_Pitch | kLSGCommandMask_PitchParam);
     if (pitchbits) {
         const int is_up = pitchbits & kLSGCommandBit_PitchUp;
         const int pitch_amount = (pitchbits >> 8) & 0x3f;
-        const float pfq = calcNoteFreq(ch->lastNote + (is_up ? 2 : -2), ch->customNoteIndex);
-        ch->bent_fq = ch->fq + (pfq - ch->fq) * (float)pitch_amount / 63.0f;
+        const float pfq = calcNoteFreq(ctx, v->lastNote + (is_up ? 2 : -2), ch->customNoteIndex);
+        v->bent_fq = v->fq + (pfq - v->fq) * (float)pitch_amount / 63.0f;
+    }
+
+    if (noteNo || pitchbits) {
+        lsg_update_voice_phase_increment(ctx, v, ch);
+    }
+}
+
+// Key on takes one voice; key off releases the channel's voices (or the one playing the note
+// with ReleaseNote on a polyphonic channel); NoKey commands modify all voices of the channel.
+LSGStatus lsg_apply_channel_command(lsg_context_t* ctx, LSGChannel_t* ch, ChannelCommand cmd, int commandOffsetPosition) {
+    if ((cmd & kLSGCommandBit_Enable) == 0) {
+        return LSG_OK;
+    }
+    
+    const int noteNo = cmd & kLSGCommandMask_NoteNum;
+    if ((cmd & kLSGCommandBit_NoKey) == 0 && (cmd & kLSGCommandBit_KeyOn)) {
+        LSGVoice_t* v = lsg_allocate_voice(ctx, ch, noteNo);
+        if (v) {
+            v->keyonCount = 0;
+            v->adsrPhase = 0;
+            v->keyonSerial = ctx->nextKeyonSerial++;
+            lsg_apply_voice_params(ctx, ch, v, cmd);
+        }
+    } else if ((cmd & kLSGCommandBit_NoKey) == 0) {
+        const int bSelectNote = (cmd & kLSGCommandBit_ReleaseNote) && ch->polyphony > 1;
+        foreach_channel_voice(ctx, ch, v) {
+            if (!bSelectNote || v->lastNote == noteNo) {
+                v->keyonCount = -1;
+                lsg_apply_voice_params(ctx, ch, v, cmd);
+            }
+        }
+    } else {
+        // modify params only
+        foreach_channel_voice(ctx, ch, v) {
+            lsg_apply_voice_params(ctx, ch, v, cmd);
+        }
     }
 
     if (ch->exec_callback) {
@@ -478,54 +811,142 @@ LSGStatus lsg_apply_channel_command(LSGChannel_t* ch, ChannelCommand cmd, int co
     return LSG_OK;
 }
 
-LSGStatus lsg_apply_channel_adsr(LSGChannel_t* ch) {
-    switch(ch->adsrPhase) {
+// Released and fully decayed: renders zeros until the next key on
+static LSG_INLINE int lsg_voice_is_dormant(const LSGVoice_t* v) {
+    return v->adsrPhase >= 2 && v->keyonCount < 0 && v->currentBaseGain4X <= 0;
+}
+
+// Which voice to give up first: released before held, then by the steal policy
+static LSG_INLINE int lsg_voice_steal_better(const lsg_context_t* ctx, const LSGVoice_t* a, const LSGVoice_t* b) {
+    if (!b) {
+        return 1;
+    }
+    
+    const int aReleased = (a->keyonCount < 0);
+    const int bReleased = (b->keyonCount < 0);
+    if (aReleased != bReleased) {
+        return aReleased;
+    }
+    
+    if (ctx->voiceStealPolicy == kLSGVoiceSteal_Quietest) {
+        return (int64_t)a->currentBaseGain4X * a->volume < (int64_t)b->currentBaseGain4X * b->volume;
+    }
+    
+    return (int32_t)(a->keyonSerial - b->keyonSerial) < 0; // oldest (wraps)
+}
+
+// Monophonic channels keep reusing their voice, like a single oscillator.
+// Otherwise: same note retriggers, then a free or dormant voice, then stealing (own voices first when the channel is full).
+LSGVoice_t* lsg_allocate_voice(lsg_context_t* ctx, LSGChannel_t* ch, int noteNo) {
+    LSGVoice_t* sameNote = NULL;
+    LSGVoice_t* ownDormant = NULL;
+    LSGVoice_t* ownSteal = NULL;
+    LSGVoice_t* freeVoice = NULL;
+    LSGVoice_t* otherDormant = NULL;
+    LSGVoice_t* otherSteal = NULL;
+    int nOwned = 0;
+    
+    for (int i = 0;i < ctx->nVoices;++i) {
+        LSGVoice_t* v = &ctx->voices[i];
+        if (v->channelIndex == ch->selfIndex) {
+            if (ch->polyphony == 1) {
+                return v;
+            }
+            
+            ++nOwned;
+            if (lsg_voice_is_dormant(v)) {
+                if (!ownDormant) { ownDormant = v; }
+            } else {
+                if (!sameNote && v->lastNote == noteNo) { sameNote = v; }
+                if (lsg_voice_steal_better(ctx, v, ownSteal)) { ownSteal = v; }
+            }
+        } else if (v->channelIndex < 0) {
+            if (!freeVoice) { freeVoice = v; }
+        } else if (lsg_voice_is_dormant(v)) {
+            if (!otherDormant) { otherDormant = v; }
+        } else if (lsg_voice_steal_better(ctx, v, otherSteal)) {
+            otherSteal = v;
+        }
+    }
+    
+    if (sameNote) {
+        return sameNote;
+    }
+    
+    if (nOwned >= ch->polyphony || !(freeVoice || otherDormant || ownDormant)) {
+        if (ownDormant) {
+            return ownDormant;
+        }
+        
+        if (nOwned >= ch->polyphony) {
+            return (ctx->voiceStealPolicy == kLSGVoiceSteal_None) ? NULL : ownSteal;
+        }
+    }
+    
+    LSGVoice_t* v = ownDormant ? ownDormant : freeVoice ? freeVoice : otherDormant;
+    if (!v) {
+        if (ctx->voiceStealPolicy == kLSGVoiceSteal_None || !otherSteal) {
+            return NULL;
+        }
+        
+        v = otherSteal;
+    }
+    
+    if (v->channelIndex != ch->selfIndex) {
+        lsg_initialize_voice(ctx, v, ch->selfIndex);
+    }
+    
+    return v;
+}
+
+LSGStatus lsg_apply_voice_adsr(LSGVoice_t* v, const LSG_ADSR* adsr) {
+    switch(v->adsrPhase) {
         // Attack
         case 0:
-        if (ch->keyonCount < 0) {
-            ch->adsrPhase = 2;
+        if (v->keyonCount < 0) {
+            v->adsrPhase = 2;
             break;
         }
         
-        ch->currentBaseGain4X += ch->adsr.attack_rate;
-        if (ch->currentBaseGain4X > kLSGRawGainMax4X) {
-            ch->currentBaseGain4X = kLSGRawGainMax4X;
-            ++ch->adsrPhase;
+        v->currentBaseGain4X += adsr->attack_rate;
+        if (v->currentBaseGain4X > kLSGRawGainMax4X) {
+            v->currentBaseGain4X = kLSGRawGainMax4X;
+            ++v->adsrPhase;
         }
         break;
         
         // Decay
         case 1:
-        if (ch->keyonCount < 0) {
-            ch->adsrPhase = 2;
+        if (v->keyonCount < 0) {
+            v->adsrPhase = 2;
             break;
         }
         
-        ch->currentBaseGain4X -= ch->adsr.decay_rate;
-        if (ch->currentBaseGain4X < ch->adsr.sustain_level) {
-            ch->currentBaseGain4X = ch->adsr.sustain_level;
-            ++ch->adsrPhase;
-            ch->keyonCount = 1;
+        v->currentBaseGain4X -= adsr->decay_rate;
+        if (v->currentBaseGain4X < adsr->sustain_level) {
+            v->currentBaseGain4X = adsr->sustain_level;
+            ++v->adsrPhase;
+            v->keyonCount = 1;
         }
         break;
         
         // Sustain and Release
         default:
-        if (ch->keyonCount >= 0) {
-            ch->currentBaseGain4X = ch->adsr.sustain_level - ch->keyonCount * ch->adsr.fade_rate;
-            if (ch->currentBaseGain4X < 0) {
-                ch->currentBaseGain4X = 4;
-                ch->keyonCount = -1;
+        if (v->keyonCount >= 0) {
+            v->currentBaseGain4X = adsr->sustain_level - v->keyonCount * adsr->fade_rate;
+            if (v->currentBaseGain4X < 0) {
+                v->currentBaseGain4X = 4;
+                v->keyonCount = -1;
             }
-        } else if (ch->currentBaseGain4X > 0) {
-            if (ch->currentBaseGain4X > ch->adsr.sustain_level) {
-                ch->currentBaseGain4X -= ch->adsr.decay_rate;
+        } else if (v->currentBaseGain4X > 0) {
+            if (v->currentBaseGain4X > adsr->sustain_level) {
+                v->currentBaseGain4X -= adsr->decay_rate;
             } else {
-                ch->currentBaseGain4X -= ch->adsr.release_rate;
+                v->currentBaseGain4X -= adsr->release_rate;
             }
             
-            if (ch->currentBaseGain4X < 0) {
-                ch->currentBaseGain4X = 0;
+            if (v->currentBaseGain4X < 0) {
+                v->currentBaseGain4X = 0;
             }
         }
         break;
@@ -534,23 +955,23 @@ LSGStatus lsg_apply_channel_adsr(LSGChannel_t* ch) {
     return LSG_OK;
 }
 
-LSGStatus lsg_advance_channel_state(LSGChannel_t* ch) {
+LSGStatus lsg_advance_voice_state(LSGVoice_t* v) {
     
-    if (ch->keyonCount >= 0) {
-        ++ch->keyonCount;
+    if (v->keyonCount >= 0) {
+        ++v->keyonCount;
     }
     
     return LSG_OK;
 }
 
-static LSG_INLINE int lsg_channel_noise_next(LSGChannel_t* ch) {
-    if (((ch->noiseRegister & kBinNoiseTap1) != 0) != ((ch->noiseRegister & kBinNoiseTap2) != 0)) {
-        ch->noiseRegister = (ch->noiseRegister >> 1) | kBinNoiseFeedback;
+static LSG_INLINE int lsg_noise_next(unsigned short* pRegister) {
+    if (((*pRegister & kBinNoiseTap1) != 0) != ((*pRegister & kBinNoiseTap2) != 0)) {
+        *pRegister = (*pRegister >> 1) | kBinNoiseFeedback;
     } else {
-        ch->noiseRegister >>= 1;
+        *pRegister >>= 1;
     }
     
-    return ((ch->noiseRegister & 1) << 15) - 16384;
+    return ((*pRegister & 1) << 15) - 16384;
 }
 
 /*
@@ -564,40 +985,47 @@ static inline int lsg_channel_short_noise_next(LSGChannel_t* ch) {
     return ((ch->noiseRegister & 1) << 15) - 16384;
 }*/
 
-LSGSample lsg_calc_channel_gain(LSGChannel_t* ch) {
+// pLevel is NULL for the white noise generator
+LSGSample lsg_calc_voice_gain(LSGVoice_t* v, const LSGWavetableLevel_t* pLevel) {
     int generatorValue = 0;
-    if (ch->generatorIndex == kLSGWhiteNoiseGeneratorSpecialIndex) {
-        generatorValue = lsg_channel_noise_next(ch);
+    if (!pLevel) {
+        generatorValue = lsg_noise_next(&v->noiseRegister);
     } else {
-        generatorValue = sGeneratorBuffers[ch->generatorIndex][ch->readPos];
+        generatorValue = lsg_wavetable_level_read(pLevel, v->phase);
     }
     
-    const int beforeVolume = ((ch->currentBaseGain4X >> 2) * generatorValue) / (kLSGRawGainMax4X >> 2);
+    const int beforeVolume = ((v->currentBaseGain4X >> 2) * generatorValue) / (kLSGRawGainMax4X >> 2);
     
     return beforeVolume;
 }
 
-LSGStatus lsg_set_channel_frequency(int channelIndex, float fq) {
+LSGStatus lsg_ctx_set_channel_frequency(lsg_context_t* ctx, int channelIndex, float fq) {
     if (channelIndex < 0 || channelIndex >= kLSGNumOutChannels) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].fq = fq;
+    foreach_channel_voice(ctx, &ctx->channelStatuses[channelIndex], v) {
+        v->fq = fq;
+    }
     
     return LSG_OK;
 }
 
-LSGStatus lsg_set_channel_global_detune(int channelIndex, float d) {
+LSGStatus lsg_ctx_set_channel_global_detune(lsg_context_t* ctx, int channelIndex, float d) {
     if (channelIndex < 0 || channelIndex >= kLSGNumOutChannels) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].global_detune = d;
-    fprintf(stderr, "DETUNE: %f\n", sChannelStatuses[channelIndex].global_detune);
+    LSGChannel_t* ch = &ctx->channelStatuses[channelIndex];
+    ch->global_detune = d;
+    foreach_channel_voice(ctx, ch, v) {
+        lsg_update_voice_phase_increment(ctx, v, ch);
+    }
+    LSG_LOG_DEBUG("DETUNE: %f", ch->global_detune);
     return LSG_OK;
 }
 
-LSGStatus lsg_set_channel_global_volume(int channelIndex, int v) {
+LSGStatus lsg_ctx_set_channel_global_volume(lsg_context_t* ctx, int channelIndex, int v) {
     if (channelIndex < 0 || channelIndex >= kLSGNumOutChannels) {
         return LSGERR_PARAM_OUTBOUND;
     }
@@ -605,12 +1033,12 @@ LSGStatus lsg_set_channel_global_volume(int channelIndex, int v) {
     if (v < 0) {v = 0;}
     else if (v > kLSGChannelVolumeMax) { v = kLSGChannelVolumeMax; }
     
-    sChannelStatuses[channelIndex].global_volume = v;
+    ctx->channelStatuses[channelIndex].global_volume = v;
     
     return LSG_OK;
 }
 
-LSGStatus lsg_set_channel_system_volume(int channelIndex, int vol) {
+LSGStatus lsg_ctx_set_channel_system_volume(lsg_context_t* ctx, int channelIndex, int vol) {
     if (channelIndex < 0 || channelIndex >= kLSGNumOutChannels) {
         return LSGERR_PARAM_OUTBOUND;
     }
@@ -618,62 +1046,33 @@ LSGStatus lsg_set_channel_system_volume(int channelIndex, int vol) {
     if (vol < 0) {vol = 0;}
     else if (vol > kLSGChannelVolumeMax) { vol = kLSGChannelVolumeMax; }
     
-    sChannelStatuses[channelIndex].system_volume = vol;
+    ctx->channelStatuses[channelIndex].system_volume = vol;
     
     return LSG_OK;
 }
 
-LSGStatus lsg_set_channel_auto_fade(int channelIndex, int dest_vol) {
+LSGStatus lsg_ctx_set_channel_auto_fade(lsg_context_t* ctx, int channelIndex, int dest_vol) {
     if (channelIndex < 0 || channelIndex >= kLSGNumOutChannels) {
         return LSGERR_PARAM_OUTBOUND;
     }
 
-    sChannelStatuses[channelIndex].system_vol_dest = dest_vol;
+    ctx->channelStatuses[channelIndex].system_vol_dest = dest_vol;
     return LSG_OK;
 }
 
-LSGStatus lsg_set_channel_auto_fade_max(int channelIndex) {
-    return lsg_set_channel_auto_fade(channelIndex, kLSGChannelVolumeMax);
+LSGStatus lsg_ctx_set_channel_auto_fade_max(lsg_context_t* ctx, int channelIndex) {
+    return lsg_ctx_set_channel_auto_fade(ctx, channelIndex, kLSGChannelVolumeMax);
 }
 
-LSGStatus lsg_fill_generator_buffer(LSGSample* buf, size_t len, LSGSample val) {
-    size_t i;
-    
-    for (i = 0;i < len;++i) {
-        buf[i] = val;
+LSGStatus lsg_ctx_set_post_filter_enabled(lsg_context_t* ctx, int bEnabled) {
+    if (bEnabled && !ctx->bPostFilter) {
+        memset(ctx->postFilterBus, 0, sizeof(int) * (kLSGPostFilterTaps - 1));
     }
     
+    ctx->bPostFilter = bEnabled ? 1 : 0;
     return LSG_OK;
 }
 
-LSGSample lsg_update_channel_fir(LSGChannel_t* ch, LSGSample newValue) {
-    LSGSample* buf = ch->fir_buf;
-    buf[8] = buf[7];
-    buf[7] = buf[6];
-    buf[6] = buf[5];
-    buf[5] = buf[4];
-    buf[4] = buf[3];
-    buf[3] = buf[2];
-    buf[2] = buf[1];
-    buf[1] = buf[0];
-    buf[0] = newValue;
-
-    return (float)buf[1] * 0.0039866f +
-           (float)buf[2] *-0.0495225f +
-           (float)buf[3] * 0.1564982f +
-           (float)buf[4] * 0.7788888f +
-           (float)buf[5] * 0.7788888f +
-           (float)buf[6] *-0.0495225f +
-           (float)buf[7] * 0.0039866f;
-
-/*
-    return (float)buf[1] * 0.0078283f +
-           (float)buf[2] * 0.1932567f +
-           (float)buf[3] * 0.4328571f +
-           (float)buf[4] * 0.1932567f +
-           (float)buf[5] * 0.0078283f;*/
-}
-
 LSGStatus lsg_apply_channel_system_fade(LSGChannel_t* ch) {
     if (ch->system_vol_dest == ch->system_volume) {
         return LSG_OK;
@@ -691,76 +1090,244 @@ LSGStatus lsg_apply_channel_system_fade(LSGChannel_t* ch) {
 }
 
 // ==== OUTPUT API ====
-static LSG_INLINE LSGStatus lsg_synthesize_internal(unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo, int bLE) {
-    const float baseFQ = (float)kLSGOutSamplingRate / (float)kLSGNumGeneratorSamples;
-    int writePos = 0;
-    int ci;
-    
-    const int Hi = bLE ? 1 : 0;
-    const int Lo = bLE ? 0 : 1;
-    
-    // Fill (if reserved)
-    for (ci = 0;ci < kLSGNumOutChannels;++ci) {
-        LSGChannel_t* ch = &sChannelStatuses[ci];
-        lsg_fill_reserved_commands(sGlobalTick, ch);
-    }
-    
+static LSG_INLINE void lsg_render_voice_span(lsg_context_t* ctx, const LSGChannel_t* ch, LSGVoice_t* v, int* pDest, int nSpan) {
     const int vmax2 = kLSGChannelVolumeMax * kLSGChannelVolumeMax;
-    for (int i = 0;i < nSamples;++i) {
-        int val = 0;
-        if (sLSGBufferRunning) {
-
-            int should_fetch_command = ((sGlobalTick % (uint64_t)kChannelCommandInterval) == 0);
-            for (ci = 0;ci < kLSGNumOutChannels;++ci) {
-                LSGChannel_t* ch = &sChannelStatuses[ci];
-                if (should_fetch_command) {
-                    const ChannelCommand cmd = lsg_consume_channel_command_buffer(ch);
-    if ((cmd & kLSGCommandBit_Enable) && LSGDEBUG_VERBOSE_COMMAND)
-    fprintf(stderr, "Ch: %2d   CMD: %x   t:%8lld\n", ci, cmd, sGlobalTick);
-                    lsg_apply_channel_command(ch, cmd, i);
-                    lsg_apply_channel_system_fade(ch);
-                }
-                
-                lsg_apply_channel_adsr(ch);
-                lsg_advance_channel_state(ch);
-
-                const int fstep = (ch->bent_fq + ch->global_detune) / baseFQ;
-                ch->readPos = (ch->readPos + fstep) % kLSGNumGeneratorSamples;
-                const int channelVal = (lsg_calc_channel_gain(ch) * ch->volume * ch->global_volume) / vmax2;
-    //            val += lsg_update_channel_fir(ch, channelVal);
-                val += (channelVal * ch->system_volume) / kLSGChannelVolumeMax;
-            }
-
-            if (val > 32767) { val = 32767; }
-            else if (val < -32767) { val = -32767; }
-            
-            ++sGlobalTick;
+    const uint32_t phaseInc = v->phaseInc;
+    const int volume = v->volume;
+    const int global_volume = ch->global_volume;
+    const int system_volume = ch->system_volume;
+    const uint32_t envelopeClockInc = ctx->envelopeClockInc;
+
+    // Pitch and generator only change at command boundaries, so one level serves the whole span
+    LSGWavetableLevel_t level;
+    const LSGWavetableLevel_t* pLevel = NULL;
+    if (ch->generatorIndex != kLSGWhiteNoiseGeneratorSpecialIndex) {
+        lsg_wavetable_select_level(ctx->generators[ch->generatorIndex], phaseInc, &level);
+        pLevel = &level;
+    }
+
+    for (int i = 0;i < nSpan;++i) {
+        // Exactly one envelope step per sample at kLSGOutSamplingRate
+        v->envelopeClock += envelopeClockInc;
+        while (v->envelopeClock >= kLSGEnvelopeClockOne) {
+            v->envelopeClock -= kLSGEnvelopeClockOne;
+            lsg_apply_voice_adsr(v, &ch->adsr);
+            lsg_advance_voice_state(v);
         }
 
-        // Write   - - - - - - - - - - - - - - -
-        pOut[writePos+Hi] = (val & 0xff00) >> 8;
-        pOut[writePos+Lo] =  val & 0xff;
-        if (bStereo) {
-            pOut[writePos+2+Hi] = (val & 0xff00) >> 8;
-            pOut[writePos+2+Lo] =  val & 0xff;
+        v->phase += phaseInc; // wraps at one cycle
+        const int channelVal = (lsg_calc_voice_gain(v, pLevel) * volume * global_volume) / vmax2;
+        pDest[i] = (channelVal * system_volume) / kLSGChannelVolumeMax;
+    }
+}
+
+// Same state changes as rendering a dormant span, without producing samples
+static LSG_INLINE void lsg_skip_voice_span(const LSGChannel_t* ch, LSGVoice_t* v, int nSpan) {
+    v->phase += v->phaseInc * (uint32_t)nSpan; // wraps at one cycle
+    if (ch->generatorIndex == kLSGWhiteNoiseGeneratorSpecialIndex) {
+        for (int i = 0;i < nSpan;++i) {
+            lsg_noise_next(&v->noiseRegister);
         }
-        
-        writePos += strideBytes;
     }
-    
-    return LSG_OK;
 }
 
-LSGStatus lsg_synthesize_BE16(unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo) {
-    return lsg_synthesize_internal(pOut, nSamples, strideBytes, bStereo, 0);
+// Output formats of lsg_synthesize_internal
+#define kLSGOutFormat_BE16 0
+#define kLSGOutFormat_LE16 1
+#define kLSGOutFormat_F32  2
+#define kLSGOutFormat_S32  3
+#define kLSGOutFormat_F32Planar 4
+
+typedef struct _LSGOutput_t {
+    int format;
+    void* pOut;
+    int stride; // bytes per frame for 16bit formats, samples per frame for 32bit formats
+    int bStereo;
+    float* const* ppPlanes; // F32Planar: every non-NULL plane gets the same signal
+    int nPlanes;
+} LSGOutput_t;
+
+static LSG_INLINE void lsg_write_output_span(const LSGOutput_t* out, size_t pos, const int* pRows, int nRows, int rowStride, int nSpan) {
+    switch (out->format) {
+        case kLSGOutFormat_BE16:
+        case kLSGOutFormat_LE16:
+            lsg_dsp_mix_pack16((unsigned char*)out->pOut + pos * out->stride, pRows, nRows, rowStride, nSpan,
+                               out->stride, out->bStereo, out->format == kLSGOutFormat_LE16);
+            break;
+            
+        case kLSGOutFormat_F32:
+            lsg_dsp_mix_f32((float*)out->pOut + pos * out->stride, pRows, nRows, rowStride, nSpan, out->stride, out->bStereo);
+            break;
+            
+        case kLSGOutFormat_S32:
+            lsg_dsp_mix_s32((int32_t*)out->pOut + pos * out->stride, pRows, nRows, rowStride, nSpan, out->stride, out->bStereo);
+            break;
+            
+        case kLSGOutFormat_F32Planar: {
+            // Mix once, copy to the other planes
+            const float* first = NULL;
+            for (int i = 0;i < out->nPlanes;++i) {
+                float* plane = out->ppPlanes[i];
+                if (!plane) {
+                    continue;
+                }
+                
+                if (first) {
+                    memcpy(plane + pos, first, sizeof(float) * nSpan);
+                } else {
+                    lsg_dsp_mix_f32(plane + pos, pRows, nRows, rowStride, nSpan, 1, 0);
+                    first = plane + pos;
+                }
+            }
+        } break;
+    }
 }
 
-LSGStatus lsg_synthesize_LE16(unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo) {
-    return lsg_synthesize_internal(pOut, nSamples, strideBytes, bStereo, 1);
+// Sums the rows into one bus behind the filter history, then filters it into postFilterOut.
+// One FIR on the mix instead of one per channel: the filter is linear, so the result is the same.
+static LSG_INLINE void lsg_post_filter_span(lsg_context_t* ctx, int nRows, int nSpan) {
+    const int interval = ctx->commandInterval;
+    int* bus = ctx->postFilterBus + (kLSGPostFilterTaps - 1);
+    
+    memset(bus, 0, sizeof(int) * nSpan);
+    for (int r = 0;r < nRows;++r) {
+        const int* row = ctx->spanBuffers + r * interval;
+        for (int i = 0;i < nSpan;++i) {
+            bus[i] += row[i];
+        }
+    }
+    
+    lsg_dsp_fir_i32(ctx->postFilterOut, bus, nSpan, sPostFilterTaps, kLSGPostFilterTaps);
+    memmove(ctx->postFilterBus, ctx->postFilterBus + nSpan, sizeof(int) * (kLSGPostFilterTaps - 1));
 }
 
-LSGStatus lsg_fill_reserved_commands(int64_t startTick, LSGChannel_t* ch) {
-    const int peek_max = 441;
+// Renders in spans which never cross a command boundary (every ctx->commandInterval ticks)
+// nor a scheduled event of any channel.
+// Each voice renders its whole span at once, then the spans are mixed and packed by the DSP kernel.
+// Free and dormant voices are skipped and get no row, so silent spans are written as plain zeros.
+static LSG_INLINE LSGStatus lsg_synthesize_internal(lsg_context_t* ctx, const LSGOutput_t* out, size_t nSamples) {
+    int ci;
+    
+    lsg_drain_command_queue(ctx);
+    
+    const int interval = ctx->commandInterval;
+    size_t done = 0;
+    while (done < nSamples) {
+        int nSpan = interval;
+        if ((size_t)nSpan > nSamples - done) {
+            nSpan = (int)(nSamples - done);
+        }
+
+        int nRows = 0;
+        if (ctx->bBufferRunning) {
+            const int phaseInInterval = (int)(ctx->globalTick % interval);
+            if (nSpan > interval - phaseInInterval) {
+                nSpan = interval - phaseInInterval;
+            }
+
+            const int64_t now = ctx->globalTick;
+            const int64_t intervalEnd = now - phaseInInterval + interval;
+            lsg_feed_staged_commands(ctx, now, intervalEnd);
+            for (ci = 0;ci < kLSGNumOutChannels;++ci) {
+                LSGChannel_t* ch = &ctx->channelStatuses[ci];
+                lsg_fill_reserved_commands(ch, now, intervalEnd);
+                if (phaseInInterval == 0) {
+                    lsg_apply_channel_system_fade(ch);
+                }
+                
+                // Apply due events, then split the span at the next one
+                while (ch->nEvents > 0) {
+                    const LSGChannelEvent_t* ev = &ch->eventQueue[ch->eventHead];
+                    if (ev->tick > now) {
+                        if (nSpan > ev->tick - now) {
+                            nSpan = (int)(ev->tick - now);
+                        }
+                        break;
+                    }
+                    
+                    const ChannelCommand cmd = ev->cmd;
+                    ch->eventHead = (ch->eventHead + 1) & (kChannelEventQueueLength - 1);
+                    --ch->nEvents;
+                    if (cmd & kLSGCommandBit_Enable) {
+                        LSG_LOG_TRACE("Ch: %2d   CMD: %x   t:%8lld", ci, cmd, (long long)now);
+                    }
+                    lsg_apply_channel_command(ctx, ch, cmd, (int)done);
+                }
+            }
+            
+            for (int vi = 0;vi < ctx->nVoices;++vi) {
+                LSGVoice_t* v = &ctx->voices[vi];
+                if (v->channelIndex < 0) {
+                    continue;
+                }
+                
+                const LSGChannel_t* ch = &ctx->channelStatuses[v->channelIndex];
+                if (lsg_voice_is_dormant(v)) {
+                    lsg_skip_voice_span(ch, v, nSpan);
+                } else {
+                    // Rows are packed (mixing order does not matter)
+                    lsg_render_voice_span(ctx, ch, v, ctx->spanBuffers + (nRows++) * interval, nSpan);
+                }
+            }
+
+            __atomic_store_n(&ctx->globalTick, ctx->globalTick + nSpan, __ATOMIC_RELAXED);
+        }
+
+        // Mix and write   - - - - - - - - - - - - - - -
+        // (no rows while stopped: writes silence)
+        if (ctx->bPostFilter) {
+            lsg_post_filter_span(ctx, nRows, nSpan);
+            lsg_write_output_span(out, done, ctx->postFilterOut, 1, interval, nSpan);
+        } else {
+            lsg_write_output_span(out, done, ctx->spanBuffers, nRows, interval, nSpan);
+        }
+        done += nSpan;
+    }
+    
+    return LSG_OK;
+}
+
+LSGStatus lsg_ctx_synthesize_BE16(lsg_context_t* ctx, unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo) {
+    const LSGOutput_t out = {kLSGOutFormat_BE16, pOut, strideBytes, bStereo, NULL, 0};
+    return lsg_synthesize_internal(ctx, &out, nSamples);
+}
+
+LSGStatus lsg_ctx_synthesize_LE16(lsg_context_t* ctx, unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo) {
+    const LSGOutput_t out = {kLSGOutFormat_LE16, pOut, strideBytes, bStereo, NULL, 0};
+    return lsg_synthesize_internal(ctx, &out, nSamples);
+}
+
+LSGStatus lsg_ctx_synthesize_f32(lsg_context_t* ctx, float* pOut, size_t nSamples, int stride, const int bStereo) {
+    if (!pOut) {
+        return LSGERR_NULLPTR;
+    }
+    
+    const LSGOutput_t out = {kLSGOutFormat_F32, pOut, stride, bStereo, NULL, 0};
+    return lsg_synthesize_internal(ctx, &out, nSamples);
+}
+
+LSGStatus lsg_ctx_synthesize_s32(lsg_context_t* ctx, int32_t* pOut, size_t nSamples, int stride, const int bStereo) {
+    if (!pOut) {
+        return LSGERR_NULLPTR;
+    }
+    
+    const LSGOutput_t out = {kLSGOutFormat_S32, pOut, stride, bStereo, NULL, 0};
+    return lsg_synthesize_internal(ctx, &out, nSamples);
+}
+
+LSGStatus lsg_ctx_synthesize_f32_planar(lsg_context_t* ctx, float* const* ppChannels, int nChannels, size_t nSamples) {
+    if (!ppChannels) {
+        return LSGERR_NULLPTR;
+    }
+    
+    const LSGOutput_t out = {kLSGOutFormat_F32Planar, NULL, 1, 0, ppChannels, nChannels};
+    return lsg_synthesize_internal(ctx, &out, nSamples);
+}
+
+// Hands the channel the reserved commands due before endTick.
+// rb->readPosition is the cursor, so each call costs O(1) plus the commands it schedules
+// (and, for streamed buffers, the refill of the window).
+LSGStatus lsg_fill_reserved_commands(LSGChannel_t* ch, int64_t now, int64_t endTick) {
     if (!ch) {
         return LSGERR_NULLPTR;
     }
@@ -770,15 +1337,17 @@ LSGStatus lsg_fill_reserved_commands(int64_t startTick, LSGChannel_t* ch) {
     }
     
     LSGReservedCommandBuffer_t* rb = ch->pReservedCommandBuffer;
-    const int64_t endTick = startTick + (kChannelCommandBufferLength * kChannelCommandInterval);
-    int64_t tOffset = 0;
-    int64_t tSpanInLoop = rb->loopEndTime - rb->loopStartTime;
+    if (rb->refillProc) {
+        rb->refillProc(rb->refillUserData, endTick);
+    }
+    
+    const int64_t tSpanInLoop = rb->loopEndTime - rb->loopStartTime;
     
     const int use_loop = (rb->loopLastIndex > rb->loopFirstIndex);
     const int n_in_loop = (int)(rb->loopLastIndex - rb->loopFirstIndex) + 1;
     
-    for (int i = 0;i < peek_max;++i) {
-        tOffset = 0;
+    for (;;) {
+        int64_t tOffset = 0;
         int rv_index = rb->readPosition;
         
         // Make looped index and time offset
@@ -800,17 +1369,20 @@ LSGStatus lsg_fill_reserved_commands(int64_t startTick, LSGChannel_t* ch) {
             break;
         }
 
-        const LSGReservedCommand_t* rcmd = &rb->array[rv_index];
-        const int64_t rt = rcmd->tick + tOffset;
-
-        if (rt >= startTick && rt < endTick) {
-            const int64_t dt = rt - startTick;
-            const int buf_offset = (int)(dt / kChannelCommandInterval);
-            lsg_put_channel_command_and_clear_later_internal(ch, buf_offset, rcmd->cmd);
-            ++rb->readPosition;
-        } else if (rt > endTick) {
+        const LSGReservedCommand_t* rcmd = &rb->array[rb->bWindow ? (rv_index % rb->length) : rv_index];
+        const int64_t rt = rcmd->tick + rb->tickOffset + tOffset;
+        if (rt >= endTick) {
             break;
         }
+        
+        // Streamed loops are unrolled by the writer; count the passes from the time
+        if (rb->bWindow && tSpanInLoop > 0 && rt >= rb->loopStartTime) {
+            rb->lastLoopCount = (int)((rt - rb->loopStartTime) / tSpanInLoop);
+        }
+        
+        // (late commands are applied right away)
+        lsg_schedule_channel_command(ch, rt, now, rcmd->cmd, 0);
+        ++rb->readPosition;
     }
     
     return LSG_OK;
@@ -819,53 +1391,99 @@ LSGStatus lsg_fill_reserved_commands(int64_t startTick, LSGChannel_t* ch) {
 // Stocked waves and generators - - - - - - - - - - - -
 
 #define kGoodMaxVolume (2205 * 6)
-
-LSGStatus lsg_generate_triangle(int generatorBufferIndex) {
-    if (!(generator_index_in_range( generatorBufferIndex ))) {
-        return LSGERR_PARAM_OUTBOUND;
+#define kShortNoiseLengthBits 13
+
+// Waves without params, kept for the process lifetime once lsg_use_wave_cache_file is called
+static const int sPregeneratedKinds[] = {
+    kLSGGeneratorKind_Triangle,
+    kLSGGeneratorKind_Square,
+    kLSGGeneratorKind_Square13,
+    kLSGGeneratorKind_Square2114,
+    kLSGGeneratorKind_ShortNoise
+};
+#define kLSGNumPregeneratedKinds ((int)(sizeof(sPregeneratedKinds) / sizeof(sPregeneratedKinds[0])))
+static const LSGWavetable_t* sPregeneratedWaves[kLSGNumPregeneratedKinds];
+
+typedef struct _LSGSinVParams_t {
+    const float* coefficients;
+    unsigned int count;
+} LSGSinVParams_t;
+
+typedef struct _LSGMixedParams_t {
+    lsg_context_t* ctx;
+    int sourceGeneratorIndex1;
+    int sourceGeneratorIndex2;
+} LSGMixedParams_t;
+
+// Points the slot at a shared table (the previous one is released)
+LSGStatus lsg_ctx_assign_generator(lsg_context_t* ctx, int generatorBufferIndex, int kind, const void* params, size_t paramsSize, LSGWavetableBuilder builder, void* userData) {
+    const LSGWavetableKey_t key = {kind, params, paramsSize};
+    const LSGWavetable_t* wt = lsg_wavetable_cache_acquire(&key, builder, userData);
+    if (!wt) {
+        return LSGERR_GENERIC;
     }
     
+    lsg_wavetable_cache_release(ctx->generators[generatorBufferIndex]);
+    ctx->generators[generatorBufferIndex] = wt;
+    return LSG_OK;
+}
+
+LSGStatus lsg_build_silent(LSGWavetable_t* wt, void* userData) {
+    lsg_wavetable_clear(wt);
+    return LSG_OK;
+}
+
+static LSGStatus lsg_build_triangle(LSGWavetable_t* wt, void* userData) {
     int i, pos;
-    const int seglen = kLSGNumGeneratorSamples / 4;
+    const int seglen = kLSGWavetableLength / 4;
     const int step = (kGoodMaxVolume * 24) / seglen;
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
-
+    LSGSample p[kLSGWavetableLength];
+    
     pos = 0;
     
     //  1/4
     for (i = 0;i < seglen;++i) {
         p[pos++] = (i * step) >> 4;
     }
-
+    
     const int maxvol = p[pos-1];
     // 2/4
     for (i = 0;i < seglen;++i) {
         p[pos++] = maxvol - p[i];
     }
-
+    
     // 3/4, 4/4
     for (i = 0;i < (seglen << 1);++i) {
         p[pos++] = -p[i];
     }
-
-    return LSG_OK;
+    
+    return lsg_wavetable_build(wt, p, kLSGWavetableLengthBits, 0, NULL);
 }
 
-LSGStatus lsg_generate_square(int generatorBufferIndex) {
+LSGStatus lsg_ctx_generate_triangle(lsg_context_t* ctx, int generatorBufferIndex) {
     if (!(generator_index_in_range( generatorBufferIndex ))) {
         return LSGERR_PARAM_OUTBOUND;
     }
+    
+    return lsg_ctx_assign_generator(ctx, generatorBufferIndex, kLSGGeneratorKind_Triangle, NULL, 0, lsg_build_triangle, NULL);
+}
+
+static LSGStatus lsg_build_square(LSGWavetable_t* wt, void* userData) {
+    LSGSample p[kLSGWavetableLength];
+    lsg_generate_square_intl(p);
+    return lsg_wavetable_build(wt, p, kLSGWavetableLengthBits, 0, &sGeneratorFilter);
+}
 
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
-    lsg_copy_pregenerated_wave(p, kLSGPregeneratedIndexForSquare);
+LSGStatus lsg_ctx_generate_square(lsg_context_t* ctx, int generatorBufferIndex) {
+    if (!(generator_index_in_range( generatorBufferIndex ))) {
+        return LSGERR_PARAM_OUTBOUND;
+    }
     
-    //lsg_generate_square_intl(p);
-    //lsg_apply_generator_filter(generatorBufferIndex);
-    return LSG_OK;
+    return lsg_ctx_assign_generator(ctx, generatorBufferIndex, kLSGGeneratorKind_Square, NULL, 0, lsg_build_square, NULL);
 }
 
 LSGStatus lsg_generate_square_intl(LSGSample* p) {
-    const int seglen = kLSGNumGeneratorSamples / 2;
+    const int seglen = kLSGWavetableLength / 2;
     int pos1 = 0;
     int pos2 = seglen;
     for (int i = 0;i < seglen;++i) {
@@ -876,23 +1494,23 @@ LSGStatus lsg_generate_square_intl(LSGSample* p) {
     return LSG_OK;
 }
 
+static LSGStatus lsg_build_square13(LSGWavetable_t* wt, void* userData) {
+    LSGSample p[kLSGWavetableLength];
+    lsg_generate_square13_intl(p);
+    return lsg_wavetable_build(wt, p, kLSGWavetableLengthBits, 0, &sGeneratorFilter);
+}
 
-LSGStatus lsg_generate_square_13(int generatorBufferIndex) {
+LSGStatus lsg_ctx_generate_square_13(lsg_context_t* ctx, int generatorBufferIndex) {
     if (!(generator_index_in_range( generatorBufferIndex ))) {
         return LSGERR_PARAM_OUTBOUND;
     }
-
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
-    lsg_copy_pregenerated_wave(p, kLSGPregeneratedIndexForSquare13);
-
-    //lsg_generate_square13_intl(p);
-    //lsg_apply_generator_filter(generatorBufferIndex);
-    return LSG_OK;
+    
+    return lsg_ctx_assign_generator(ctx, generatorBufferIndex, kLSGGeneratorKind_Square13, NULL, 0, lsg_build_square13, NULL);
 }
 
 
 LSGStatus lsg_generate_square13_intl(LSGSample* p) {
-    const int seglen = kLSGNumGeneratorSamples / 4;
+    const int seglen = kLSGWavetableLength / 4;
     int pos1 = 0;
     int pos2 = seglen;
     int pos3 = seglen*2;
@@ -908,33 +1526,33 @@ LSGStatus lsg_generate_square13_intl(LSGSample* p) {
     return LSG_OK;
 }
 
-LSGStatus lsg_generate_square_2114(int generatorBufferIndex) {
-    if (!(generator_index_in_range( generatorBufferIndex ))) {
-        return LSGERR_PARAM_OUTBOUND;
-    }
-
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
-    for (int i = 0;i < kLSGNumGeneratorSamples;++i) {
-        const int ph = (i << 3) / kLSGNumGeneratorSamples;
+static LSGStatus lsg_build_square_2114(LSGWavetable_t* wt, void* userData) {
+    LSGSample p[kLSGWavetableLength];
+    for (int i = 0;i < kLSGWavetableLength;++i) {
+        const int ph = (i << 3) / kLSGWavetableLength;
         if (ph == 0 || ph == 1 || ph == 3) {
-            *p++ = kGoodMaxVolume;
+            p[i] = kGoodMaxVolume;
         } else {
-            *p++ = -kGoodMaxVolume;
+            p[i] = -kGoodMaxVolume;
         }
     }
     
-    lsg_apply_generator_filter(generatorBufferIndex);
-    return LSG_OK;
+    return lsg_wavetable_build(wt, p, kLSGWavetableLengthBits, 0, &sGeneratorFilter);
 }
 
-LSGStatus lsg_generate_short_noise(int generatorBufferIndex) {
+LSGStatus lsg_ctx_generate_square_2114(lsg_context_t* ctx, int generatorBufferIndex) {
     if (!(generator_index_in_range( generatorBufferIndex ))) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
+    return lsg_ctx_assign_generator(ctx, generatorBufferIndex, kLSGGeneratorKind_Square2114, NULL, 0, lsg_build_square_2114, NULL);
+}
+
+// One random level per table entry, read without interpolation
+static LSGStatus lsg_build_short_noise(LSGWavetable_t* wt, void* userData) {
+    LSGSample p[1 << kShortNoiseLengthBits];
     
-    const int seglen = kLSGNumGeneratorSamples / 40;
+    const int seglen = 1 << kShortNoiseLengthBits;
     unsigned short reg = kBinNoiseFeedback;
     for (int i = 0;i < seglen;++i) {
         if (((reg & kBinNoiseTap1) != 0) != ((reg & kBinNoiseTap2) != 0)) {
@@ -942,143 +1560,382 @@ LSGStatus lsg_generate_short_noise(int generatorBufferIndex) {
         } else {
             reg >>= 1;
         }
-
-        int val = ((reg % 5) - 2) * kGoodMaxVolume / 2;
-        for (int j = 0;j < 40;++j) {
-            *p++ = val;
-        }
+    
+        p[i] = ((reg % 5) - 2) * kGoodMaxVolume / 2;
     }
     
-    return LSG_OK;
+    return lsg_wavetable_build(wt, p, kShortNoiseLengthBits, kLSGWavetableFlag_Nearest, NULL);
 }
 
-LSGStatus lsg_generate_sin(int generatorBufferIndex, float a1, float a2, float a3, float a4, float a5, float a8, float a16) {
+LSGStatus lsg_ctx_generate_short_noise(lsg_context_t* ctx, int generatorBufferIndex) {
     if (!(generator_index_in_range( generatorBufferIndex ))) {
         return LSGERR_PARAM_OUTBOUND;
     }
+    
+    return lsg_ctx_assign_generator(ctx, generatorBufferIndex, kLSGGeneratorKind_ShortNoise, NULL, 0, lsg_build_short_noise, NULL);
+}
 
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
+// userData: float[7] (a1, a2, a3, a4, a5, a8, a16)
+static LSGStatus lsg_build_sin(LSGWavetable_t* wt, void* userData) {
+    const float* a = (const float*)userData;
+    LSGSample p[kLSGWavetableLength];
     const float DPI = M_PI * 2.0f;
     
-    const int seglen = kLSGNumGeneratorSamples;
+    const int seglen = kLSGWavetableLength;
     for (int i = 0;i < seglen;++i) {
         const float t = (float)i / (float)seglen;
-        *p++ = (int)((
-         sinf(DPI * t       ) * a1 +
-         sinf(DPI * t * 2.0f) * a2 +
-         sinf(DPI * t * 3.0f) * a3 +
-         sinf(DPI * t * 4.0f) * a4 +
-         sinf(DPI * t * 5.0f) * a5 +
-         sinf(DPI * t * 8.0f) * a8 +
-         sinf(DPI * t *16.0f) * a16) * (double)kGoodMaxVolume);
+        p[i] = (int)((
+         sinf(DPI * t       ) * a[0] +
+         sinf(DPI * t * 2.0f) * a[1] +
+         sinf(DPI * t * 3.0f) * a[2] +
+         sinf(DPI * t * 4.0f) * a[3] +
+         sinf(DPI * t * 5.0f) * a[4] +
+         sinf(DPI * t * 8.0f) * a[5] +
+         sinf(DPI * t *16.0f) * a[6]) * (double)kGoodMaxVolume);
     }
-
-    return LSG_OK;
+    
+    return lsg_wavetable_build(wt, p, kLSGWavetableLengthBits, 0, NULL);
 }
 
-LSGStatus lsg_generate_sin_v(int generatorBufferIndex, const float* coefficients, unsigned int count) {
+LSGStatus lsg_ctx_generate_sin(lsg_context_t* ctx, int generatorBufferIndex, float a1, float a2, float a3, float a4, float a5, float a8, float a16) {
     if (!(generator_index_in_range( generatorBufferIndex ))) {
         return LSGERR_PARAM_OUTBOUND;
     }
+    
+    float a[7] = {a1, a2, a3, a4, a5, a8, a16};
+    return lsg_ctx_assign_generator(ctx, generatorBufferIndex, kLSGGeneratorKind_Sin, a, sizeof(a), lsg_build_sin, a);
+}
 
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
+static LSGStatus lsg_build_sin_v(LSGWavetable_t* wt, void* userData) {
+    const LSGSinVParams_t* params = (const LSGSinVParams_t*)userData;
+    LSGSample p[kLSGWavetableLength];
     const float DPI = M_PI * 2.0f;
     
-    const int seglen = kLSGNumGeneratorSamples;
+    const int seglen = kLSGWavetableLength;
     for (int i = 0;i < seglen;++i) {
         const float t = (float)i / (float)seglen;
-        
+    
         float y = 0;
-        for (int k = 0;k < count;++k) {
-            y += sinf(DPI * t * (float)(k+1)) * coefficients[k];
+        for (int k = 0;k < params->count;++k) {
+            y += sinf(DPI * t * (float)(k+1)) * params->coefficients[k];
         }
-        
+    
         y *= kGoodMaxVolume;
         if (y > 32767) {y = 32767;}
         else if (y < -32767) {y = -32767;}
-        
-        *p++ = y;
+    
+        p[i] = y;
     }
     
-    return LSG_OK;
+    return lsg_wavetable_build(wt, p, kLSGWavetableLengthBits, 0, NULL);
 }
 
-LSGStatus lsg_generate_mixed(int generatorBufferIndex, int sourceGeneratorIndex1, int sourceGeneratorIndex2) {
-    if (!(generator_index_good( generatorBufferIndex )) ||
-        !(generator_index_good( sourceGeneratorIndex1 )) ||
-        !(generator_index_good( sourceGeneratorIndex2 )) ) {
+LSGStatus lsg_ctx_generate_sin_v(lsg_context_t* ctx, int generatorBufferIndex, const float* coefficients, unsigned int count) {
+    if (!(generator_index_in_range( generatorBufferIndex ))) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
-    const int len = kLSGNumGeneratorSamples;
+    LSGSinVParams_t params = {coefficients, count};
+    return lsg_ctx_assign_generator(ctx, generatorBufferIndex, kLSGGeneratorKind_SinV, coefficients, sizeof(float) * count, lsg_build_sin_v, &params);
+}
+
+static LSGStatus lsg_build_mixed(LSGWavetable_t* wt, void* userData) {
+    const LSGMixedParams_t* params = (const LSGMixedParams_t*)userData;
+    LSGSample p[kLSGWavetableLength];
+    const int len = kLSGWavetableLength;
     for (int i = 0;i < len;++i) {
-        *p++ = (lsg_get_generator_buffer_sample(sourceGeneratorIndex1, i) + lsg_get_generator_buffer_sample(sourceGeneratorIndex2, i)) >> 1;
+        p[i] = (lsg_get_generator_sample_in_cycle(params->ctx, params->sourceGeneratorIndex1, i, len) + lsg_get_generator_sample_in_cycle(params->ctx, params->sourceGeneratorIndex2, i, len)) >> 1;
     }
-
-    return LSG_OK;
+    
+    return lsg_wavetable_build(wt, p, kLSGWavetableLengthBits, 0, NULL);
 }
 
-LSGSample lsg_get_generator_buffer_sample(int generatorBufferIndex, int sampleIndex) {
-    if (generatorBufferIndex == kLSGWhiteNoiseGeneratorSpecialIndex) {
-        return lsg_channel_noise_next(&sChannelStatuses[0]);
+LSGStatus lsg_ctx_generate_mixed(lsg_context_t* ctx, int generatorBufferIndex, int sourceGeneratorIndex1, int sourceGeneratorIndex2) {
+    if (!(generator_index_in_range( generatorBufferIndex )) ||
+        !(generator_index_good( sourceGeneratorIndex1 )) ||
+        !(generator_index_good( sourceGeneratorIndex2 )) ) {
+        return LSGERR_PARAM_OUTBOUND;
     }
+    
+    // Sources are identified by their table serials. White noise is never the same twice, so it is not shared.
+    int kind = kLSGGeneratorKind_Mixed;
+    unsigned int sourceSerials[2] = {0, 0};
+    if (sourceGeneratorIndex1 == kLSGWhiteNoiseGeneratorSpecialIndex || sourceGeneratorIndex2 == kLSGWhiteNoiseGeneratorSpecialIndex) {
+        kind = 0;
+    } else {
+        sourceSerials[0] = lsg_wavetable_cache_serial(ctx->generators[sourceGeneratorIndex1]);
+        sourceSerials[1] = lsg_wavetable_cache_serial(ctx->generators[sourceGeneratorIndex2]);
+    }
+    
+    LSGMixedParams_t params = {ctx, sourceGeneratorIndex1, sourceGeneratorIndex2};
+    return lsg_ctx_assign_generator(ctx, generatorBufferIndex, kind, sourceSerials, sizeof(sourceSerials), lsg_build_mixed, &params);
+}
 
-    if (generatorBufferIndex < 0 || generatorBufferIndex >= kLSGNumGenerators || sampleIndex < 0 || sampleIndex >= kLSGNumGeneratorSamples) {
-        return 0;
+LSGStatus lsg_use_wave_cache_file(const char* path) {
+    if (!path) {
+        return LSGERR_NULLPTR;
+    }
+    
+    const LSGStatus loadStatus = lsg_wavetable_cache_load_file(path, sPregeneratedKinds, kLSGNumPregeneratedKinds);
+    
+    // Loaded tables are found in the cache; the rest are built here
+    LSGWavetableBuilder builders[kLSGNumPregeneratedKinds] = {
+        lsg_build_triangle, lsg_build_square, lsg_build_square13, lsg_build_square_2114, lsg_build_short_noise
+    };
+    
+    for (int i = 0;i < kLSGNumPregeneratedKinds;++i) {
+        if (sPregeneratedWaves[i]) {
+            continue;
+        }
+        
+        const LSGWavetableKey_t key = {sPregeneratedKinds[i], NULL, 0};
+        sPregeneratedWaves[i] = lsg_wavetable_cache_acquire(&key, builders[i], NULL);
+        if (!sPregeneratedWaves[i]) {
+            return LSGERR_GENERIC;
+        }
+    }
+    
+    if (loadStatus == LSG_OK) {
+        return LSG_OK;
     }
     
-    LSGSample* p = sGeneratorBuffers[generatorBufferIndex];
-    return p[sampleIndex];
+    return lsg_wavetable_cache_save_file(path, sPregeneratedKinds, kLSGNumPregeneratedKinds);
 }
 
-LSGStatus lsg_apply_generator_filter(int generatorIndex) {
-    if (!generator_index_good( generatorIndex )) {
-        return LSGERR_PARAM_OUTBOUND;
+// Sample at (position / cycleLength) of the generator's full resolution cycle
+LSGSample lsg_get_generator_sample_in_cycle(lsg_context_t* ctx, int generatorBufferIndex, int position, int cycleLength) {
+    if (generatorBufferIndex == kLSGWhiteNoiseGeneratorSpecialIndex) {
+        return lsg_noise_next(&ctx->generatorNoiseRegister);
     }
     
-    LSGSample* p = sGeneratorBuffers[generatorIndex];
-    return lsg_apply_generator_filter_intl(p);
+    const LSGWavetable_t* wt = ctx->generators[generatorBufferIndex];
+    const int sampleIndex = (int)(((int64_t)position * lsg_wavetable_get_length(wt)) / cycleLength);
+    return lsg_wavetable_get_sample(wt, sampleIndex);
 }
 
-LSGStatus lsg_apply_generator_filter_intl(LSGSample* p) {
-    const int flen = 63;
-    const int buflen = kLSGNumGeneratorSamples;
-    LSGSample* tmp = sGeneratorTempBuf;
-    memcpy(tmp, p, sizeof(LSGSample) * buflen);
+LSGSample lsg_ctx_get_generator_buffer_sample(lsg_context_t* ctx, int generatorBufferIndex, int sampleIndex) {
+    if (generatorBufferIndex == kLSGWhiteNoiseGeneratorSpecialIndex) {
+        return lsg_noise_next(&ctx->generatorNoiseRegister);
+    }
     
-    for (int i = 0;i < buflen;++i) {
-        float sum = 0;
-        for (int j = 0;j < flen;++j) {
-            const int pos = (i + buflen - j*1000) % buflen;
-            sum += (float)tmp[pos] * sFIRTable63[j];
-        }
-        
-        //fprintf(stdout, "%d, %d\n", p[i], (int)sum);
-        p[i] = sum;
+    if (generatorBufferIndex < 0 || generatorBufferIndex >= kLSGNumGenerators) {
+        return 0;
     }
     
-    return LSG_OK;
+    return lsg_wavetable_get_sample(ctx->generators[generatorBufferIndex], sampleIndex);
 }
 
-LSGStatus lsg_channel_bind_rsvcmd(int channelIndex, LSGReservedCommandBuffer_t* pRCBuf) {
+LSGStatus lsg_ctx_channel_bind_rsvcmd(lsg_context_t* ctx, int channelIndex, LSGReservedCommandBuffer_t* pRCBuf) {
     if (!channel_index_in_range(channelIndex)) {
         return LSGERR_PARAM_OUTBOUND;
     }
     
-    sChannelStatuses[channelIndex].pReservedCommandBuffer = pRCBuf;
+    ctx->channelStatuses[channelIndex].pReservedCommandBuffer = pRCBuf;
 
     return LSG_OK;
 }
 
-int lsg_rsvcmd_get_channel_loop_count(int channelIndex) {
+int lsg_ctx_rsvcmd_get_channel_loop_count(lsg_context_t* ctx, int channelIndex) {
     if (!channel_index_in_range(channelIndex)) {
         return 0;
     }
     
-    if (sChannelStatuses[channelIndex].pReservedCommandBuffer) {
-        return sChannelStatuses[channelIndex].pReservedCommandBuffer->lastLoopCount;
+    if (ctx->channelStatuses[channelIndex].pReservedCommandBuffer) {
+        return ctx->channelStatuses[channelIndex].pReservedCommandBuffer->lastLoopCount;
     }
     
     return 0;
 }
+
+// ==== Default context ====
+LSGStatus lsg_initialize() {
+    return lsg_ctx_initialize(&sDefaultContext);
+}
+
+LSGStatus lsg_initialize_with_sample_rate(int sampleRate) {
+    return lsg_ctx_initialize_with_sample_rate(&sDefaultContext, sampleRate);
+}
+
+int lsg_get_sample_rate() {
+    return lsg_ctx_get_sample_rate(&sDefaultContext);
+}
+
+int lsg_get_command_interval() {
+    return lsg_ctx_get_command_interval(&sDefaultContext);
+}
+
+LSGStatus lsg_set_buffer_running(char bRunning) {
+    return lsg_ctx_set_buffer_running(&sDefaultContext, bRunning);
+}
+
+LSGStatus lsg_channel_initialize_volume_params(int channelIndex) {
+    return lsg_ctx_channel_initialize_volume_params(&sDefaultContext, channelIndex);
+}
+
+LSGStatus lsg_initialize_channel_keyon(int channelIndex) {
+    return lsg_ctx_initialize_channel_keyon(&sDefaultContext, channelIndex);
+}
+
+LSGStatus lsg_synthesize_BE16(unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo) {
+    return lsg_ctx_synthesize_BE16(&sDefaultContext, pOut, nSamples, strideBytes, bStereo);
+}
+
+LSGStatus lsg_synthesize_LE16(unsigned char* pOut, size_t nSamples, int strideBytes, const int bStereo) {
+    return lsg_ctx_synthesize_LE16(&sDefaultContext, pOut, nSamples, strideBytes, bStereo);
+}
+
+LSGStatus lsg_synthesize_f32(float* pOut, size_t nSamples, int stride, const int bStereo) {
+    return lsg_ctx_synthesize_f32(&sDefaultContext, pOut, nSamples, stride, bStereo);
+}
+
+LSGStatus lsg_synthesize_s32(int32_t* pOut, size_t nSamples, int stride, const int bStereo) {
+    return lsg_ctx_synthesize_s32(&sDefaultContext, pOut, nSamples, stride, bStereo);
+}
+
+LSGStatus lsg_synthesize_f32_planar(float* const* ppChannels, int nChannels, size_t nSamples) {
+    return lsg_ctx_synthesize_f32_planar(&sDefaultContext, ppChannels, nChannels, nSamples);
+}
+
+LSGStatus lsg_set_channel_frequency(int channelIndex, float fq) {
+    return lsg_ctx_set_channel_frequency(&sDefaultContext, channelIndex, fq);
+}
+
+LSGStatus lsg_set_channel_global_detune(int channelIndex, float d) {
+    return lsg_ctx_set_channel_global_detune(&sDefaultContext, channelIndex, d);
+}
+
+LSGStatus lsg_set_channel_global_volume(int channelIndex, int v) {
+    return lsg_ctx_set_channel_global_volume(&sDefaultContext, channelIndex, v);
+}
+
+LSGStatus lsg_set_channel_source_generator(int channelIndex, int generatorBufferIndex) {
+    return lsg_ctx_set_channel_source_generator(&sDefaultContext, channelIndex, generatorBufferIndex);
+}
+
+LSGStatus lsg_set_channel_white_noise(int channelIndex) {
+    return lsg_ctx_set_channel_white_noise(&sDefaultContext, channelIndex);
+}
+
+LSGStatus lsg_get_channel_copy(int channelIndex, LSGChannel_t* pOut) {
+    return lsg_ctx_get_channel_copy(&sDefaultContext, channelIndex, pOut);
+}
+
+LSGStatus lsg_set_channel_adsr(int channelIndex, LSG_ADSR* pSourceADSR) {
+    return lsg_ctx_set_channel_adsr(&sDefaultContext, channelIndex, pSourceADSR);
+}
+
+LSGStatus lsg_get_channel_adsr(int channelIndex, LSG_ADSR* pOutADSR) {
+    return lsg_ctx_get_channel_adsr(&sDefaultContext, channelIndex, pOutADSR);
+}
+
+LSGStatus lsg_noteoff_channel_immediately(int channelIndex) {
+    return lsg_ctx_noteoff_channel_immediately(&sDefaultContext, channelIndex);
+}
+
+LSGStatus lsg_set_channel_command_exec_callback(int channelIndex, lsg_channel_command_executed_callback callback, void* userData) {
+    return lsg_ctx_set_channel_command_exec_callback(&sDefaultContext, channelIndex, callback, userData);
+}
+
+LSGStatus lsg_initialize_custom_note_table() {
+    return lsg_ctx_initialize_custom_note_table(&sDefaultContext);
+}
+
+LSGStatus lsg_set_custom_note_frequency(int index, float fq) {
+    return lsg_ctx_set_custom_note_frequency(&sDefaultContext, index, fq);
+}
+
+LSGStatus lsg_use_custom_notes(int channelIndex, int customNotesIndex) {
+    return lsg_ctx_use_custom_notes(&sDefaultContext, channelIndex, customNotesIndex);
+}
+
+LSGStatus lsg_set_voice_pool_size(int nVoices) {
+    return lsg_ctx_set_voice_pool_size(&sDefaultContext, nVoices);
+}
+
+LSGStatus lsg_set_voice_steal_policy(int policy) {
+    return lsg_ctx_set_voice_steal_policy(&sDefaultContext, policy);
+}
+
+LSGStatus lsg_set_channel_polyphony(int channelIndex, int nVoices) {
+    return lsg_ctx_set_channel_polyphony(&sDefaultContext, channelIndex, nVoices);
+}
+
+LSGStatus lsg_set_channel_system_volume(int channelIndex, int vol) {
+    return lsg_ctx_set_channel_system_volume(&sDefaultContext, channelIndex, vol);
+}
+
+LSGStatus lsg_set_channel_auto_fade(int channelIndex, int dest_vol) {
+    return lsg_ctx_set_channel_auto_fade(&sDefaultContext, channelIndex, dest_vol);
+}
+
+LSGStatus lsg_set_channel_auto_fade_max(int channelIndex) {
+    return lsg_ctx_set_channel_auto_fade_max(&sDefaultContext, channelIndex);
+}
+
+LSGStatus lsg_set_post_filter_enabled(int bEnabled) {
+    return lsg_ctx_set_post_filter_enabled(&sDefaultContext, bEnabled);
+}
+
+int64_t lsg_get_global_tick() {
+    return lsg_ctx_get_global_tick(&sDefaultContext);
+}
+
+LSGStatus lsg_generate_triangle(int generatorBufferIndex) {
+    return lsg_ctx_generate_triangle(&sDefaultContext, generatorBufferIndex);
+}
+
+LSGStatus lsg_generate_square(int generatorBufferIndex) {
+    return lsg_ctx_generate_square(&sDefaultContext, generatorBufferIndex);
+}
+
+LSGStatus lsg_generate_square_13(int generatorBufferIndex) {
+    return lsg_ctx_generate_square_13(&sDefaultContext, generatorBufferIndex);
+}
+
+LSGStatus lsg_generate_square_2114(int generatorBufferIndex) {
+    return lsg_ctx_generate_square_2114(&sDefaultContext, generatorBufferIndex);
+}
+
+LSGStatus lsg_generate_short_noise(int generatorBufferIndex) {
+    return lsg_ctx_generate_short_noise(&sDefaultContext, generatorBufferIndex);
+}
+
+LSGStatus lsg_generate_sin(int generatorBufferIndex, float a1, float a2, float a3, float a4, float a5, float a8, float a16) {
+    return lsg_ctx_generate_sin(&sDefaultContext, generatorBufferIndex, a1, a2, a3, a4, a5, a8, a16);
+}
+
+LSGStatus lsg_generate_sin_v(int generatorBufferIndex, const float* coefficients, unsigned int count) {
+    return lsg_ctx_generate_sin_v(&sDefaultContext, generatorBufferIndex, coefficients, count);
+}
+
+LSGStatus lsg_generate_mixed(int generatorBufferIndex, int sourceGeneratorIndex1, int sourceGeneratorIndex2) {
+    return lsg_ctx_generate_mixed(&sDefaultContext, generatorBufferIndex, sourceGeneratorIndex1, sourceGeneratorIndex2);
+}
+
+LSGStatus lsg_put_channel_command(int channelIndex, int offset, ChannelCommand cmd) {
+    return lsg_ctx_put_channel_command(&sDefaultContext, channelIndex, offset, cmd);
+}
+
+LSGStatus lsg_put_channel_command_and_clear_later(int channelIndex, int offset, ChannelCommand cmd) {
+    return lsg_ctx_put_channel_command_and_clear_later(&sDefaultContext, channelIndex, offset, cmd);
+}
+
+LSGStatus lsg_put_channel_command_at_sample(int channelIndex, int sampleOffset, ChannelCommand cmd) {
+    return lsg_ctx_put_channel_command_at_sample(&sDefaultContext, channelIndex, sampleOffset, cmd);
+}
+
+LSGStatus lsg_channel_bind_rsvcmd(int channelIndex, LSGReservedCommandBuffer_t* pRCBuf) {
+    return lsg_ctx_channel_bind_rsvcmd(&sDefaultContext, channelIndex, pRCBuf);
+}
+
+int lsg_rsvcmd_get_channel_loop_count(int channelIndex) {
+    return lsg_ctx_rsvcmd_get_channel_loop_count(&sDefaultContext, channelIndex);
+}
+
+LSGSample lsg_get_generator_buffer_sample(int generatorBufferIndex, int sampleIndex) {
+    return lsg_ctx_get_generator_buffer_sample(&sDefaultContext, generatorBufferIndex, sampleIndex);
+}
+
+void lsg_set_force_global_tick(int64_t t) {
+    lsg_ctx_set_force_global_tick(&sDefaultContext, t);
+}
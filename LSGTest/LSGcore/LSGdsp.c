@@ -0,0 +1,482 @@
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "LSGdsp.h"
+
+// SIMD kernels store native 16bit words, so they are used on little endian hosts only.
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#if defined(__x86_64__) || defined(__i386__)
+#define LSG_DSP_USE_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LSG_DSP_USE_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+static lsg_dsp_mix_pack16_proc sMixPack16Proc = NULL;
+static lsg_dsp_mix_f32_proc sMixF32Proc = NULL;
+static lsg_dsp_dot_f32_proc sDotF32Proc = NULL;
+static lsg_dsp_fir_i32_proc sFirI32Proc = NULL;
+static int sSIMDEnabled = 1;
+static pthread_once_t sInitOnce = PTHREAD_ONCE_INIT;
+
+static void lsg_dsp_select_procs();
+
+// Contexts are created and rendered on any thread; the pointers are only swapped by lsg_set_simd_enabled
+#define lsg_dsp_get_proc(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+// Packed layouts are the only ones vectorized: mono with 2 byte stride or stereo with 4 byte stride.
+static LSG_INLINE int lsg_dsp_is_packed_layout(int strideBytes, int bStereo) {
+    return bStereo ? (strideBytes == 4) : (strideBytes == 2);
+}
+
+#define kLSGDSPFloatScale (1.0f / 32768.0f)
+
+static LSG_INLINE int lsg_dsp_mix_clamped(const int* pRows, int nRows, int rowStride, int i) {
+    int val = 0;
+    for (int r = 0;r < nRows;++r) {
+        val += pRows[r * rowStride + i];
+    }
+
+    if (val > 32767) { val = 32767; }
+    else if (val < -32767) { val = -32767; }
+    
+    return val;
+}
+
+void lsg_dsp_mix_f32_scalar(float* pOut, const int* pRows, int nRows, int rowStride, int nSpan, int stride, int bStereo) {
+    for (int i = 0;i < nSpan;++i) {
+        const float val = (float)lsg_dsp_mix_clamped(pRows, nRows, rowStride, i) * kLSGDSPFloatScale;
+        pOut[0] = val;
+        if (bStereo) {
+            pOut[1] = val;
+        }
+
+        pOut += stride;
+    }
+}
+
+float lsg_dsp_dot_f32_scalar(const float* a, const float* b, int n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int i = 0;i < n;i += 4) {
+        s0 += a[i    ] * b[i    ];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+
+    return (s0 + s2) + (s1 + s3);
+}
+
+void lsg_dsp_fir_i32_scalar(int* pOut, const int* pIn, int n, const float* pTaps, int nTaps) {
+    for (int i = 0;i < n;++i) {
+        float acc = 0;
+        for (int k = 0;k < nTaps;++k) {
+            acc += pTaps[k] * (float)pIn[i - k];
+        }
+
+        pOut[i] = (int)lrintf(acc); // nearest even, like the vector conversions
+    }
+}
+
+void lsg_dsp_mix_s32(int32_t* pOut, const int* pRows, int nRows, int rowStride, int nSpan, int stride, int bStereo) {
+    for (int i = 0;i < nSpan;++i) {
+        const int32_t val = (int32_t)((uint32_t)lsg_dsp_mix_clamped(pRows, nRows, rowStride, i) << 16);
+        pOut[0] = val;
+        if (bStereo) {
+            pOut[1] = val;
+        }
+
+        pOut += stride;
+    }
+}
+
+void lsg_dsp_mix_pack16_scalar(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                               int strideBytes, int bStereo, int bLE) {
+    const int Hi = bLE ? 1 : 0;
+    const int Lo = bLE ? 0 : 1;
+    int writePos = 0;
+
+    for (int i = 0;i < nSpan;++i) {
+        int val = 0;
+        for (int r = 0;r < nRows;++r) {
+            val += pRows[r * rowStride + i];
+        }
+
+        if (val > 32767) { val = 32767; }
+        else if (val < -32767) { val = -32767; }
+
+        pOut[writePos+Hi] = (val & 0xff00) >> 8;
+        pOut[writePos+Lo] =  val & 0xff;
+        if (bStereo) {
+            pOut[writePos+2+Hi] = (val & 0xff00) >> 8;
+            pOut[writePos+2+Lo] =  val & 0xff;
+        }
+
+        writePos += strideBytes;
+    }
+}
+
+#if LSG_DSP_USE_X86
+static void lsg_dsp_mix_pack16_sse2(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                                    int strideBytes, int bStereo, int bLE) __attribute__((target("sse2")));
+static void lsg_dsp_mix_pack16_avx2(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                                    int strideBytes, int bStereo, int bLE) __attribute__((target("avx2")));
+
+void lsg_dsp_mix_pack16_sse2(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                             int strideBytes, int bStereo, int bLE) {
+    if (!lsg_dsp_is_packed_layout(strideBytes, bStereo)) {
+        lsg_dsp_mix_pack16_scalar(pOut, pRows, nRows, rowStride, nSpan, strideBytes, bStereo, bLE);
+        return;
+    }
+
+    const __m128i vmin = _mm_set1_epi16(-32767);
+    int i = 0;
+    for (;i + 8 <= nSpan;i += 8) {
+        __m128i acc0 = _mm_setzero_si128();
+        __m128i acc1 = _mm_setzero_si128();
+        for (int r = 0;r < nRows;++r) {
+            const int* row = pRows + r * rowStride + i;
+            acc0 = _mm_add_epi32(acc0, _mm_loadu_si128((const __m128i*)row));
+            acc1 = _mm_add_epi32(acc1, _mm_loadu_si128((const __m128i*)(row + 4)));
+        }
+
+        __m128i v = _mm_max_epi16(_mm_packs_epi32(acc0, acc1), vmin);
+        if (!bLE) {
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        }
+
+        if (bStereo) {
+            _mm_storeu_si128((__m128i*)(pOut + i * 4     ), _mm_unpacklo_epi16(v, v));
+            _mm_storeu_si128((__m128i*)(pOut + i * 4 + 16), _mm_unpackhi_epi16(v, v));
+        } else {
+            _mm_storeu_si128((__m128i*)(pOut + i * 2), v);
+        }
+    }
+
+    // Remainder
+    if (i < nSpan) {
+        lsg_dsp_mix_pack16_scalar(pOut + i * strideBytes, pRows + i, nRows, rowStride, nSpan - i, strideBytes, bStereo, bLE);
+    }
+}
+
+void lsg_dsp_mix_pack16_avx2(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                             int strideBytes, int bStereo, int bLE) {
+    if (!lsg_dsp_is_packed_layout(strideBytes, bStereo)) {
+        lsg_dsp_mix_pack16_scalar(pOut, pRows, nRows, rowStride, nSpan, strideBytes, bStereo, bLE);
+        return;
+    }
+
+    const __m256i vmin = _mm256_set1_epi16(-32767);
+    int i = 0;
+    for (;i + 16 <= nSpan;i += 16) {
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        for (int r = 0;r < nRows;++r) {
+            const int* row = pRows + r * rowStride + i;
+            acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256((const __m256i*)row));
+            acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256((const __m256i*)(row + 8)));
+        }
+
+        // packs works per 128bit lane; restore sample order
+        __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(acc0, acc1), 0xD8);
+        v = _mm256_max_epi16(v, vmin);
+        if (!bLE) {
+            v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        }
+
+        if (bStereo) {
+            const __m256i lo = _mm256_unpacklo_epi16(v, v);
+            const __m256i hi = _mm256_unpackhi_epi16(v, v);
+            _mm256_storeu_si256((__m256i*)(pOut + i * 4     ), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i*)(pOut + i * 4 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+        } else {
+            _mm256_storeu_si256((__m256i*)(pOut + i * 2), v);
+        }
+    }
+
+    // Remainder
+    if (i < nSpan) {
+        lsg_dsp_mix_pack16_sse2(pOut + i * strideBytes, pRows + i, nRows, rowStride, nSpan - i, strideBytes, bStereo, bLE);
+    }
+}
+#endif
+
+#if LSG_DSP_USE_X86
+static float lsg_dsp_dot_f32_sse(const float* a, const float* b, int n) __attribute__((target("sse")));
+
+// Same summation order as the scalar version
+float lsg_dsp_dot_f32_sse(const float* a, const float* b, int n) {
+    __m128 acc = _mm_setzero_ps();
+    for (int i = 0;i < n;i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+    return _mm_cvtss_f32(acc);
+}
+
+static void lsg_dsp_fir_i32_sse2(int* pOut, const int* pIn, int n, const float* pTaps, int nTaps) __attribute__((target("sse2")));
+
+// Four outputs at a time
+void lsg_dsp_fir_i32_sse2(int* pOut, const int* pIn, int n, const float* pTaps, int nTaps) {
+    int i = 0;
+    for (;i + 4 <= n;i += 4) {
+        __m128 acc = _mm_setzero_ps();
+        for (int k = 0;k < nTaps;++k) {
+            const __m128 x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(pIn + i - k)));
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(pTaps[k]), x));
+        }
+
+        _mm_storeu_si128((__m128i*)(pOut + i), _mm_cvtps_epi32(acc));
+    }
+
+    if (i < n) {
+        lsg_dsp_fir_i32_scalar(pOut + i, pIn + i, n - i, pTaps, nTaps);
+    }
+}
+
+static void lsg_dsp_mix_f32_sse2(float* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                                 int stride, int bStereo) __attribute__((target("sse2")));
+
+void lsg_dsp_mix_f32_sse2(float* pOut, const int* pRows, int nRows, int rowStride, int nSpan, int stride, int bStereo) {
+    if (stride != (bStereo ? 2 : 1)) {
+        lsg_dsp_mix_f32_scalar(pOut, pRows, nRows, rowStride, nSpan, stride, bStereo);
+        return;
+    }
+
+    const __m128i vmax = _mm_set1_epi32(32767);
+    const __m128i vmin = _mm_set1_epi32(-32767);
+    const __m128 vscale = _mm_set1_ps(kLSGDSPFloatScale);
+    int i = 0;
+    for (;i + 4 <= nSpan;i += 4) {
+        __m128i acc = _mm_setzero_si128();
+        for (int r = 0;r < nRows;++r) {
+            acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i*)(pRows + r * rowStride + i)));
+        }
+
+        // (no 32bit min/max in SSE2: clamp with compares)
+        acc = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi32(acc, vmax), vmax), _mm_andnot_si128(_mm_cmpgt_epi32(acc, vmax), acc));
+        acc = _mm_or_si128(_mm_and_si128(_mm_cmplt_epi32(acc, vmin), vmin), _mm_andnot_si128(_mm_cmplt_epi32(acc, vmin), acc));
+        const __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(acc), vscale);
+        if (bStereo) {
+            _mm_storeu_ps(pOut + i * 2    , _mm_unpacklo_ps(v, v));
+            _mm_storeu_ps(pOut + i * 2 + 4, _mm_unpackhi_ps(v, v));
+        } else {
+            _mm_storeu_ps(pOut + i, v);
+        }
+    }
+
+    // Remainder
+    if (i < nSpan) {
+        lsg_dsp_mix_f32_scalar(pOut + i * stride, pRows + i, nRows, rowStride, nSpan - i, stride, bStereo);
+    }
+}
+#endif
+
+#if LSG_DSP_USE_NEON
+static float lsg_dsp_dot_f32_neon(const float* a, const float* b, int n) {
+    float32x4_t acc = vdupq_n_f32(0);
+    for (int i = 0;i < n;i += 4) {
+        acc = vaddq_f32(acc, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+    }
+
+    const float32x2_t h = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(h, 0) + vget_lane_f32(h, 1);
+}
+
+#if defined(__aarch64__)
+// (round to nearest conversion is AArch64 only)
+static void lsg_dsp_fir_i32_neon(int* pOut, const int* pIn, int n, const float* pTaps, int nTaps) {
+    int i = 0;
+    for (;i + 4 <= n;i += 4) {
+        float32x4_t acc = vdupq_n_f32(0);
+        for (int k = 0;k < nTaps;++k) {
+            acc = vaddq_f32(acc, vmulq_f32(vdupq_n_f32(pTaps[k]), vcvtq_f32_s32(vld1q_s32(pIn + i - k))));
+        }
+
+        vst1q_s32(pOut + i, vcvtnq_s32_f32(acc));
+    }
+
+    if (i < n) {
+        lsg_dsp_fir_i32_scalar(pOut + i, pIn + i, n - i, pTaps, nTaps);
+    }
+}
+#endif
+
+static void lsg_dsp_mix_f32_neon(float* pOut, const int* pRows, int nRows, int rowStride, int nSpan, int stride, int bStereo) {
+    if (stride != (bStereo ? 2 : 1)) {
+        lsg_dsp_mix_f32_scalar(pOut, pRows, nRows, rowStride, nSpan, stride, bStereo);
+        return;
+    }
+
+    const int32x4_t vmax = vdupq_n_s32(32767);
+    const int32x4_t vmin = vdupq_n_s32(-32767);
+    int i = 0;
+    for (;i + 4 <= nSpan;i += 4) {
+        int32x4_t acc = vdupq_n_s32(0);
+        for (int r = 0;r < nRows;++r) {
+            acc = vaddq_s32(acc, vld1q_s32(pRows + r * rowStride + i));
+        }
+
+        const float32x4_t v = vmulq_n_f32(vcvtq_f32_s32(vmaxq_s32(vminq_s32(acc, vmax), vmin)), kLSGDSPFloatScale);
+        if (bStereo) {
+            float32x4x2_t lr;
+            lr.val[0] = v;
+            lr.val[1] = v;
+            vst2q_f32(pOut + i * 2, lr);
+        } else {
+            vst1q_f32(pOut + i, v);
+        }
+    }
+
+    // Remainder
+    if (i < nSpan) {
+        lsg_dsp_mix_f32_scalar(pOut + i * stride, pRows + i, nRows, rowStride, nSpan - i, stride, bStereo);
+    }
+}
+
+static void lsg_dsp_mix_pack16_neon(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                                    int strideBytes, int bStereo, int bLE) {
+    if (!lsg_dsp_is_packed_layout(strideBytes, bStereo)) {
+        lsg_dsp_mix_pack16_scalar(pOut, pRows, nRows, rowStride, nSpan, strideBytes, bStereo, bLE);
+        return;
+    }
+
+    const int16x8_t vmin = vdupq_n_s16(-32767);
+    int i = 0;
+    for (;i + 8 <= nSpan;i += 8) {
+        int32x4_t acc0 = vdupq_n_s32(0);
+        int32x4_t acc1 = vdupq_n_s32(0);
+        for (int r = 0;r < nRows;++r) {
+            const int* row = pRows + r * rowStride + i;
+            acc0 = vaddq_s32(acc0, vld1q_s32(row));
+            acc1 = vaddq_s32(acc1, vld1q_s32(row + 4));
+        }
+
+        int16x8_t v = vmaxq_s16(vcombine_s16(vqmovn_s32(acc0), vqmovn_s32(acc1)), vmin);
+        if (!bLE) {
+            v = vreinterpretq_s16_u8(vrev16q_u8(vreinterpretq_u8_s16(v)));
+        }
+
+        if (bStereo) {
+            int16x8x2_t lr;
+            lr.val[0] = v;
+            lr.val[1] = v;
+            vst2q_s16((int16_t*)(pOut + i * 4), lr);
+        } else {
+            vst1q_s16((int16_t*)(pOut + i * 2), v);
+        }
+    }
+
+    // Remainder
+    if (i < nSpan) {
+        lsg_dsp_mix_pack16_scalar(pOut + i * strideBytes, pRows + i, nRows, rowStride, nSpan - i, strideBytes, bStereo, bLE);
+    }
+}
+#endif
+
+// Safe to call from any thread, any number of times
+void lsg_dsp_initialize() {
+    pthread_once(&sInitOnce, lsg_dsp_select_procs);
+}
+
+void lsg_dsp_select_procs() {
+    lsg_dsp_mix_pack16_proc proc = lsg_dsp_mix_pack16_scalar;
+    lsg_dsp_mix_f32_proc procF32 = lsg_dsp_mix_f32_scalar;
+    lsg_dsp_dot_f32_proc procDot = lsg_dsp_dot_f32_scalar;
+    lsg_dsp_fir_i32_proc procFir = lsg_dsp_fir_i32_scalar;
+
+    if (__atomic_load_n(&sSIMDEnabled, __ATOMIC_RELAXED)) {
+#if LSG_DSP_USE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            proc = lsg_dsp_mix_pack16_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            proc = lsg_dsp_mix_pack16_sse2;
+        }
+        
+        if (__builtin_cpu_supports("sse2")) {
+            procF32 = lsg_dsp_mix_f32_sse2;
+            procFir = lsg_dsp_fir_i32_sse2;
+        }
+        
+        if (__builtin_cpu_supports("sse")) {
+            procDot = lsg_dsp_dot_f32_sse;
+        }
+#elif LSG_DSP_USE_NEON
+        proc = lsg_dsp_mix_pack16_neon;
+        procF32 = lsg_dsp_mix_f32_neon;
+        procDot = lsg_dsp_dot_f32_neon;
+#if defined(__aarch64__)
+        procFir = lsg_dsp_fir_i32_neon;
+#endif
+#endif
+    }
+
+    __atomic_store_n(&sMixPack16Proc, proc, __ATOMIC_RELEASE);
+    __atomic_store_n(&sMixF32Proc, procF32, __ATOMIC_RELEASE);
+    __atomic_store_n(&sDotF32Proc, procDot, __ATOMIC_RELEASE);
+    __atomic_store_n(&sFirI32Proc, procFir, __ATOMIC_RELEASE);
+}
+
+void lsg_dsp_mix_pack16(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                        int strideBytes, int bStereo, int bLE) {
+    // Nothing to mix: plain zeros (other layouts keep the bytes between samples)
+    if (nRows == 0 && lsg_dsp_is_packed_layout(strideBytes, bStereo)) {
+        memset(pOut, 0, (size_t)nSpan * strideBytes);
+        return;
+    }
+
+    lsg_dsp_mix_pack16_proc proc = lsg_dsp_get_proc(sMixPack16Proc);
+    if (!proc) {
+        lsg_dsp_initialize();
+        proc = lsg_dsp_get_proc(sMixPack16Proc);
+    }
+
+    proc(pOut, pRows, nRows, rowStride, nSpan, strideBytes, bStereo, bLE);
+}
+
+void lsg_dsp_mix_f32(float* pOut, const int* pRows, int nRows, int rowStride, int nSpan, int stride, int bStereo) {
+    // Nothing to mix: plain zeros (all bits zero is 0.0f)
+    if (nRows == 0 && stride == (bStereo ? 2 : 1)) {
+        memset(pOut, 0, (size_t)nSpan * stride * sizeof(float));
+        return;
+    }
+
+    lsg_dsp_mix_f32_proc proc = lsg_dsp_get_proc(sMixF32Proc);
+    if (!proc) {
+        lsg_dsp_initialize();
+        proc = lsg_dsp_get_proc(sMixF32Proc);
+    }
+
+    proc(pOut, pRows, nRows, rowStride, nSpan, stride, bStereo);
+}
+
+float lsg_dsp_dot_f32(const float* a, const float* b, int n) {
+    lsg_dsp_dot_f32_proc proc = lsg_dsp_get_proc(sDotF32Proc);
+    if (!proc) {
+        lsg_dsp_initialize();
+        proc = lsg_dsp_get_proc(sDotF32Proc);
+    }
+
+    return proc(a, b, n);
+}
+
+void lsg_dsp_fir_i32(int* pOut, const int* pIn, int n, const float* pTaps, int nTaps) {
+    lsg_dsp_fir_i32_proc proc = lsg_dsp_get_proc(sFirI32Proc);
+    if (!proc) {
+        lsg_dsp_initialize();
+        proc = lsg_dsp_get_proc(sFirI32Proc);
+    }
+
+    proc(pOut, pIn, n, pTaps, nTaps);
+}
+
+void lsg_set_simd_enabled(int bEnabled) {
+    lsg_dsp_initialize();
+    __atomic_store_n(&sSIMDEnabled, bEnabled, __ATOMIC_RELAXED);
+    lsg_dsp_select_procs();
+}
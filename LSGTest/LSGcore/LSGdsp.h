@@ -0,0 +1,38 @@
+// LSG ONGEN - - - DSP kernels (internal)
+
+#ifndef LSGTest_LSGdsp_h
+#define LSGTest_LSGdsp_h
+#include "LSG.h"
+
+// Sums nRows channel spans (each rowStride ints apart), clamps to +-32767 and
+// writes 16bit samples. bLE selects little endian output, bStereo duplicates
+// each sample into the next 2 bytes.
+typedef void (*lsg_dsp_mix_pack16_proc)(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                                        int strideBytes, int bStereo, int bLE);
+
+// Same mix and clamp, written as native float (+-1.0 full scale) or int32 (16bit value << 16).
+// stride counts samples between frames.
+typedef void (*lsg_dsp_mix_f32_proc)(float* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                                     int stride, int bStereo);
+
+// Sum of a[i] * b[i] (n is a multiple of 4; used by the resampler)
+typedef float (*lsg_dsp_dot_f32_proc)(const float* a, const float* b, int n);
+
+// pOut[i] = round(sum of pTaps[k] * pIn[i - k]); pIn is preceded by nTaps - 1 samples of history.
+// Every version accumulates in the same order, so results do not depend on the SIMD path.
+typedef void (*lsg_dsp_fir_i32_proc)(int* pOut, const int* pIn, int n, const float* pTaps, int nTaps);
+
+void lsg_dsp_initialize();
+void lsg_dsp_mix_pack16(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                        int strideBytes, int bStereo, int bLE);
+void lsg_dsp_mix_pack16_scalar(unsigned char* pOut, const int* pRows, int nRows, int rowStride, int nSpan,
+                               int strideBytes, int bStereo, int bLE);
+void lsg_dsp_mix_f32(float* pOut, const int* pRows, int nRows, int rowStride, int nSpan, int stride, int bStereo);
+void lsg_dsp_mix_f32_scalar(float* pOut, const int* pRows, int nRows, int rowStride, int nSpan, int stride, int bStereo);
+float lsg_dsp_dot_f32(const float* a, const float* b, int n);
+float lsg_dsp_dot_f32_scalar(const float* a, const float* b, int n);
+void lsg_dsp_fir_i32(int* pOut, const int* pIn, int n, const float* pTaps, int nTaps);
+void lsg_dsp_fir_i32_scalar(int* pOut, const int* pIn, int n, const float* pTaps, int nTaps);
+void lsg_dsp_mix_s32(int32_t* pOut, const int* pRows, int nRows, int rowStride, int nSpan, int stride, int bStereo);
+
+#endif
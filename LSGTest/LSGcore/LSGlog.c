@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "LSGlog.h"
+
+#define kLSGLogRingLength 1024 // power of 2
+#define kLSGLogDrainIntervalNS 5000000
+
+// ticket + (slot index) is the sequence number of the slot, so the zero initialized ring is ready:
+// a producer may fill the slot when it equals the write position, the consumer may read it when it is one ahead.
+typedef struct _LSGLogRecord_t {
+    uint32_t ticket;
+    int level;
+    char text[kLSGLogMessageLength];
+} LSGLogRecord_t;
+
+static struct {
+    uint32_t writePos; // claimed by producers (CAS)
+    char pad1[60];
+    uint32_t readPos;  // consumer only
+    uint32_t nDropped;
+    char pad2[56];
+    LSGLogRecord_t records[kLSGLogRingLength];
+} sLogRing;
+
+void lsg_log_write(int level, const char* format, ...) {
+    uint32_t pos = __atomic_load_n(&sLogRing.writePos, __ATOMIC_RELAXED);
+    LSGLogRecord_t* rec;
+    for (;;) {
+        const uint32_t index = pos & (kLSGLogRingLength - 1);
+        rec = &sLogRing.records[index];
+        const int32_t dif = (int32_t)(__atomic_load_n(&rec->ticket, __ATOMIC_ACQUIRE) + index - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&sLogRing.writePos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            // Full: the drain thread is behind
+            __atomic_add_fetch(&sLogRing.nDropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&sLogRing.writePos, __ATOMIC_RELAXED);
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(rec->text, kLSGLogMessageLength, format, args);
+    va_end(args);
+    rec->level = level;
+
+    const uint32_t index = pos & (kLSGLogRingLength - 1);
+    __atomic_store_n(&rec->ticket, pos + 1 - index, __ATOMIC_RELEASE);
+}
+
+#if LSG_LOG_LEVEL > kLSGLogLevel_None
+static pthread_mutex_t sConsumerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t sDrainThread;
+static int sDrainRunning = 0;
+static int sDrainStopRequested = 0;
+
+static const char* const sLevelNames[] = {"E", "W", "I", "D", "T"};
+
+// Consumer side (serialized by sConsumerMutex)
+static void lsg_log_drain(FILE* fp) {
+    uint32_t pos = sLogRing.readPos;
+    for (;;) {
+        const uint32_t index = pos & (kLSGLogRingLength - 1);
+        LSGLogRecord_t* rec = &sLogRing.records[index];
+        if (__atomic_load_n(&rec->ticket, __ATOMIC_ACQUIRE) + index != pos + 1) {
+            break;
+        }
+
+        const int level = (rec->level >= kLSGLogLevel_Error && rec->level <= kLSGLogLevel_Trace) ? rec->level : kLSGLogLevel_Info;
+        fprintf(fp, "[%s] %s\n", sLevelNames[level], rec->text);
+
+        __atomic_store_n(&rec->ticket, pos + kLSGLogRingLength - index, __ATOMIC_RELEASE);
+        ++pos;
+    }
+    sLogRing.readPos = pos;
+
+    const uint32_t nDropped = __atomic_exchange_n(&sLogRing.nDropped, 0, __ATOMIC_RELAXED);
+    if (nDropped) {
+        fprintf(fp, "[W] %u log messages dropped\n", nDropped);
+    }
+}
+
+void lsg_log_flush() {
+    pthread_mutex_lock(&sConsumerMutex);
+    lsg_log_drain(stderr);
+    pthread_mutex_unlock(&sConsumerMutex);
+}
+
+static void* lsg_log_drain_thread_proc(void* userData) {
+    const struct timespec interval = {0, kLSGLogDrainIntervalNS};
+    while (!__atomic_load_n(&sDrainStopRequested, __ATOMIC_ACQUIRE)) {
+        lsg_log_flush();
+        nanosleep(&interval, NULL);
+    }
+
+    lsg_log_flush();
+    return NULL;
+}
+
+LSGStatus lsg_log_start() {
+    if (sDrainRunning) {
+        return LSG_OK;
+    }
+
+    sDrainStopRequested = 0;
+    if (pthread_create(&sDrainThread, NULL, lsg_log_drain_thread_proc, NULL) != 0) {
+        return LSGERR_GENERIC;
+    }
+
+    sDrainRunning = 1;
+    return LSG_OK;
+}
+
+void lsg_log_stop() {
+    if (!sDrainRunning) {
+        lsg_log_flush();
+        return;
+    }
+
+    __atomic_store_n(&sDrainStopRequested, 1, __ATOMIC_RELEASE);
+    pthread_join(sDrainThread, NULL);
+    sDrainRunning = 0;
+}
+#else
+// Release builds: nothing is ever written
+LSGStatus lsg_log_start() {
+    return LSG_OK;
+}
+
+void lsg_log_stop() {
+}
+
+void lsg_log_flush() {
+}
+#endif
@@ -0,0 +1,51 @@
+// LSG ONGEN - - - Logging
+
+#ifndef LSGTest_LSGlog_h
+#define LSGTest_LSGlog_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "LSG.h"
+
+#define kLSGLogLevel_None  (-1)
+#define kLSGLogLevel_Error 0
+#define kLSGLogLevel_Warn  1
+#define kLSGLogLevel_Info  2
+#define kLSGLogLevel_Debug 3
+#define kLSGLogLevel_Trace 4 // per command / per event
+
+// Messages above this level are compiled out. Release builds (NDEBUG) log nothing.
+#ifndef LSG_LOG_LEVEL
+#ifdef NDEBUG
+#define LSG_LOG_LEVEL kLSGLogLevel_None
+#else
+#define LSG_LOG_LEVEL kLSGLogLevel_Info
+#endif
+#endif
+
+#define kLSGLogMessageLength 120 // longer messages are truncated
+
+// Formats into a lock-free ring and returns; never blocks (drops the message when the ring is full).
+// Safe from any thread, including the audio thread.
+#define LSG_LOG(level, ...) do { if ((level) <= LSG_LOG_LEVEL) { lsg_log_write((level), __VA_ARGS__); } } while (0)
+#define LSG_LOG_ERROR(...) LSG_LOG(kLSGLogLevel_Error, __VA_ARGS__)
+#define LSG_LOG_WARN(...)  LSG_LOG(kLSGLogLevel_Warn, __VA_ARGS__)
+#define LSG_LOG_INFO(...)  LSG_LOG(kLSGLogLevel_Info, __VA_ARGS__)
+#define LSG_LOG_DEBUG(...) LSG_LOG(kLSGLogLevel_Debug, __VA_ARGS__)
+#define LSG_LOG_TRACE(...) LSG_LOG(kLSGLogLevel_Trace, __VA_ARGS__)
+
+void lsg_log_write(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// Background thread writing the ring to stderr (one line per message)
+LSGStatus lsg_log_start();
+void lsg_log_stop(); // joins the thread and writes what is left
+
+// Writes pending messages on the calling thread (not from the audio thread)
+void lsg_log_flush();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,31 +1,138 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "LSG.h"
+#include "LSGlog.h"
 
 #define kInitialTrackCapacity 64
-static const int s_mevents_verbose = 0;
-
-static int check_smf_header(FILE* fp);
-static size_t check_smf_track_header_and_size(FILE* fp);
-static LSGStatus read_smf_header_chunk(FILE* fp, lsg_mlf_t* p_mlf_t);
+#define kMLFMaxDecodeThreads 16
+#define kMLFParallelMinBytes (64 * 1024) // smaller files are decoded on the calling thread
+
+static int sMaxDecodeThreads = kMLFMaxDecodeThreads;
+
+// Bounds checked cursor over the SMF bytes. Reading past the end yields zeros and sets bOverrun.
+typedef struct _MLFReader_t {
+    const unsigned char* p;
+    const unsigned char* end;
+    int bOverrun;
+} MLFReader_t;
+
+// Decoding state of one track. Plain data: a copy is a snapshot that can be resumed.
+typedef struct _MLFTrackCursor_t {
+    MLFReader_t r; // spans the rest of the track chunk
+    int index;
+    int runningStatus;
+    int pitchBend;
+    int drumMappingChannel;
+    uint32_t absoluteTicks;
+} MLFTrackCursor_t;
+
+// One MTrk chunk. Tracks are decoded independently; tempo and markers are merged in track order afterwards.
+typedef struct _MLFTrackJob_t {
+    MLFReader_t r;
+    int lastTempo; // -1: no tempo event
+    LSGStatus status;
+} MLFTrackJob_t;
+
+typedef struct _MLFDecodePool_t {
+    lsg_mlf_t* p_mlf_t;
+    MLFTrackJob_t* jobs;
+    int nJobs;
+    int nextIndex;
+} MLFDecodePool_t;
+
+// One track's part of a channel while merging
+typedef struct _MLFMergeRun_t {
+    const MLFEvent_t* p;
+    const MLFEvent_t* end;
+    int runIndex;
+} MLFMergeRun_t;
+
+// Incremental form of the loop marker search (the first marker and the event after it give the start)
+typedef struct _MLFMarkerScan_t {
+    int foundCount;
+    int bPrevIsLoopStart;
+    MLFLoopDesc loopDesc;
+} MLFMarkerScan_t;
+
+static LSGStatus smf_map_file(const char* filename, void** ppOutMapped, size_t* pOutLength);
+static LSGStatus smf_begin(MLFReader_t* r, const void* pData, size_t length, lsg_mlf_t* p_mlf_t);
+static int smf_next_track_chunk(MLFReader_t* r, MLFReader_t* pOutTrack);
+static void mlf_init_track_cursor(MLFTrackCursor_t* cur, const MLFReader_t* trackReader, int trackIndex, int drumMappingChannel);
+static int mlf_cursor_next_event(MLFTrackCursor_t* cur, MLFEvent_t* pOutEv);
+static void mlf_marker_scan_init(MLFMarkerScan_t* scan);
+static void mlf_marker_scan_step(MLFMarkerScan_t* scan, const MLFEvent_t* ev);
+static LSGStatus read_smf_header_chunk(MLFReader_t* r, lsg_mlf_t* p_mlf_t);
 static LSGStatus read_smf_allocate_tracks(lsg_mlf_t* p_mlf_t);
-static LSGStatus read_smf_all_tracks(FILE* fp, lsg_mlf_t* p_mlf_t);
-static LSGStatus read_smf_track(FILE* fp, lsg_mlf_t* p_mlf_t, int trackIndex);
+static LSGStatus read_smf_all_tracks(MLFReader_t* r, lsg_mlf_t* p_mlf_t);
+static LSGStatus read_smf_track(const MLFReader_t* r, lsg_mlf_t* p_mlf_t, int trackIndex, int* pOutLastTempo);
+static void* read_smf_track_worker_proc(void* userData);
+static int mlf_count_decode_threads(int nTracks, size_t nBytes);
 static LSGStatus init_mlf_track_struct(MLFTrack_t* tr, int trackIndex);
 static LSGStatus mlf_push_event(MLFTrack_t* tr, MLFEvent_t* ev);
-static uint32_t read_smf_delta(FILE* fp, int* pOutReadBytes);
-static LSGStatus read_smf_event(FILE* fp, int* pOutReadBytes, MLFEvent_t* pOutEv);
-static LSGStatus read_smf_meta_event(FILE* fp, int metaEventType, int* pOutReadBytes, MLFEvent_t* pOutEv);
-static LSGStatus calc_smf_absolute_time(MLFTrack_t* tr);
+static LSGStatus read_smf_event(MLFReader_t* r, int* pRunningStatus, MLFEvent_t* pOutEv);
+static LSGStatus read_smf_meta_event(MLFReader_t* r, int metaEventType, MLFEvent_t* pOutEv);
 static LSGStatus pick_smf_markers(MLFTrack_t* tr, MLFLoopDesc* outLoopDesc);
-static void smf_event_apply_running_state(MLFEvent_t* newEvent, const MLFEvent_t* prevEvent);
 static void smf_event_apply_drum_mapping(MLFEvent_t* ev);
-static int read_1blen_message(FILE* fp);
-static int read_1blen_message_get_first(FILE* fp, int* outByte);
 
-static size_t read_smf_u32(FILE* fp);
-static size_t read_smf_u16(FILE* fp);
-static size_t read_smf_be(FILE* fp, int nBytes);
+static LSG_INLINE size_t smf_remaining(const MLFReader_t* r) {
+    return (size_t)(r->end - r->p);
+}
+
+static LSG_INLINE int smf_read_u8(MLFReader_t* r) {
+    if (r->p >= r->end) {
+        r->bOverrun = 1;
+        return 0;
+    }
+
+    return *(r->p)++;
+}
+
+static LSG_INLINE void smf_skip(MLFReader_t* r, size_t n) {
+    if (n > smf_remaining(r)) {
+        r->bOverrun = 1;
+        n = smf_remaining(r);
+    }
+
+    r->p += n;
+}
+
+static uint32_t smf_read_be(MLFReader_t* r, int nBytes) {
+    uint32_t s = 0;
+    for (int i = 0;i < nBytes;++i) {
+        s = (s << 8) | (uint32_t)smf_read_u8(r);
+    }
+
+    return s;
+}
+
+// Variable length quantity (at most 4 bytes)
+static uint32_t smf_read_vlq(MLFReader_t* r) {
+    uint32_t v = 0;
+    for (int i = 0;i < 4;++i) {
+        const int k = smf_read_u8(r);
+        v = (v << 7) | (uint32_t)(k & 0x7f);
+        if ((k & 0x80) == 0) {
+            break;
+        }
+    }
+
+    return v;
+}
+
+static int smf_match_fourcc(MLFReader_t* r, const char* cc) {
+    if (smf_remaining(r) < 4 || memcmp(r->p, cc, 4) != 0) {
+        return 0;
+    }
+
+    r->p += 4;
+    return 1;
+}
 
 LSGStatus lsg_init_mlf_loop(lsg_mlf_t* p_mlf_t) {
     p_mlf_t->loopDesc.startTicks = 0;
@@ -40,45 +147,144 @@ LSGStatus lsg_init_mlf(lsg_mlf_t* p_mlf_t) {
     return LSG_OK;
 }
 
+// Maps the file and parses it in place
 LSGStatus lsg_load_mlf(lsg_mlf_t* p_mlf_t, const char* filename, int auto_drum_mapping_ch) {
-	FILE* fp;
-	lsg_init_mlf(p_mlf_t);
-    
+    lsg_init_mlf(p_mlf_t);
+
+    void* mapped;
+    size_t fileSize;
+    const LSGStatus mrv = smf_map_file(filename, &mapped, &fileSize);
+    if (mrv != LSG_OK) {
+        return mrv;
+    }
+
+    const LSGStatus rv = lsg_load_mlf_from_memory(p_mlf_t, mapped, fileSize, auto_drum_mapping_ch);
+    munmap(mapped, fileSize);
+    return rv;
+}
+
+// The events are copied out, so the bytes are not needed after this returns
+LSGStatus lsg_load_mlf_from_memory(lsg_mlf_t* p_mlf_t, const void* pData, size_t length, int auto_drum_mapping_ch) {
+    lsg_init_mlf(p_mlf_t);
+    if (!pData) {
+        return LSGERR_NULLPTR;
+    }
+
     p_mlf_t->drum_mapping_channel = auto_drum_mapping_ch;
-	p_mlf_t->tempo = 120;
-	
-	fp = fopen(filename, "rb");
-	if (!fp) {
-		return LSGERR_GENERIC;
-	}
+    p_mlf_t->tempo = 120;
 
-	// Check header
-	const int is_smf = check_smf_header(fp);
-	if (is_smf) {
-		const size_t hsize = read_smf_u32(fp);
-		if (hsize == 6) {
-			read_smf_header_chunk(fp, p_mlf_t);
-			read_smf_allocate_tracks(p_mlf_t);
-			
-			read_smf_all_tracks(fp, p_mlf_t);
-		}
-	}
+    MLFReader_t r;
+    const LSGStatus hrv = smf_begin(&r, pData, length, p_mlf_t);
+    if (hrv != LSG_OK) {
+        return hrv;
+    }
 
-	fclose(fp);
+    if (read_smf_allocate_tracks(p_mlf_t) != LSG_OK) {
+        return LSGERR_GENERIC;
+    }
+
+    // The caller has nothing to free when loading fails
+    const LSGStatus rv = read_smf_all_tracks(&r, p_mlf_t);
+    if (rv != LSG_OK) {
+        lsg_free_mlf(p_mlf_t);
+        lsg_init_mlf(p_mlf_t);
+    }
+
+    return rv;
+}
+
+LSGStatus smf_map_file(const char* filename, void** ppOutMapped, size_t* pOutLength) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return LSGERR_GENERIC;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return LSGERR_BAD_FILE;
+    }
+
+    const size_t fileSize = (size_t)st.st_size;
+    void* mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return LSGERR_GENERIC;
+    }
+
+    *ppOutMapped = mapped;
+    *pOutLength = fileSize;
     return LSG_OK;
 }
 
+// Checks the MThd chunk and leaves r at the first chunk after it
+LSGStatus smf_begin(MLFReader_t* r, const void* pData, size_t length, lsg_mlf_t* p_mlf_t) {
+    r->p = (const unsigned char*)pData;
+    r->end = r->p + length;
+    r->bOverrun = 0;
+
+    if (!smf_match_fourcc(r, "MThd")) {
+        return LSGERR_BAD_FILE;
+    }
+
+    const uint32_t hsize = smf_read_be(r, 4);
+    if (hsize < 6 || hsize > smf_remaining(r)) {
+        return LSGERR_BAD_FILE;
+    }
+
+    MLFReader_t hr = *r;
+    hr.end = r->p + hsize;
+    read_smf_header_chunk(&hr, p_mlf_t);
+    smf_skip(r, hsize);
+
+    return LSG_OK;
+}
+
+// Chunks other than MTrk are skipped. A truncated chunk is cut at the end of the data.
+int smf_next_track_chunk(MLFReader_t* r, MLFReader_t* pOutTrack) {
+    while (smf_remaining(r) >= 8) {
+        const int bTrack = smf_match_fourcc(r, "MTrk");
+        if (!bTrack) {
+            smf_skip(r, 4);
+        }
+
+        const uint32_t chunkSize = smf_read_be(r, 4);
+        *pOutTrack = *r;
+        if (chunkSize < smf_remaining(r)) {
+            pOutTrack->end = r->p + chunkSize;
+        }
+        smf_skip(r, chunkSize);
+
+        if (bTrack) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 int lsg_util_calc_delta_time_scale(const lsg_mlf_t* p_mlf) {
+    return lsg_util_calc_delta_time_scale_for_rate(p_mlf, lsg_get_sample_rate());
+}
+
+int lsg_util_calc_delta_time_scale_for_rate(const lsg_mlf_t* p_mlf, int sampleRate) {
     const float miditick_duration = (float)p_mlf->tempo / (float)p_mlf->timeBase;
-    const float sample_duration = 1000000.0f / (float)kLSGOutSamplingRate;
+    const float sample_duration = 1000000.0f / (float)sampleRate;
     
     return miditick_duration / sample_duration;
 }
 
 LSGStatus read_smf_allocate_tracks(lsg_mlf_t* p_mlf_t) {
 	const int n = p_mlf_t->nTracks;
-	p_mlf_t->tracks_arr = (MLFTrack_t*) malloc( sizeof(MLFTrack_t) * n );
-	fprintf(stderr, "%d tracks allocated\n", n);
+	p_mlf_t->tracks_arr = (MLFTrack_t*) calloc(n ? n : 1, sizeof(MLFTrack_t));
+	if (!p_mlf_t->tracks_arr) {
+		return LSGERR_GENERIC;
+	}
+
+	for (int i = 0;i < n;++i) {
+		init_mlf_track_struct(&p_mlf_t->tracks_arr[i], i);
+	}
+	LSG_LOG_INFO("%d tracks allocated", n);
 
 	return LSG_OK;
 }
@@ -98,56 +304,112 @@ void lsg_free_mlf(lsg_mlf_t* p_mlf_t) {
 	free(p_mlf_t->tracks_arr);
 }
 
-LSGStatus read_smf_header_chunk(FILE* fp, lsg_mlf_t* p_mlf_t) {
-	p_mlf_t->format   = (int)read_smf_u16(fp);
-	p_mlf_t->nTracks  = (int)read_smf_u16(fp);
-	p_mlf_t->timeBase = (int)read_smf_u16(fp);
+LSGStatus read_smf_header_chunk(MLFReader_t* r, lsg_mlf_t* p_mlf_t) {
+	p_mlf_t->format   = (int)smf_read_be(r, 2);
+	p_mlf_t->nTracks  = (int)smf_read_be(r, 2);
+	p_mlf_t->timeBase = (int)smf_read_be(r, 2);
 	
-	printf("%d  %d  %d\n", p_mlf_t->format, p_mlf_t->nTracks, p_mlf_t->timeBase);
+	LSG_LOG_INFO("SMF format=%d  tracks=%d  timebase=%d", p_mlf_t->format, p_mlf_t->nTracks, p_mlf_t->timeBase);
 	
 	return LSG_OK;
 }
 
-static int check_smf_fourcc(FILE* fp, const int* cc) {
-	for (int i = 0;i < 4;++i) {
-		if (fgetc(fp) != cc[i]) {
-			return 0;
+// A truncated file keeps the tracks read so far; a failed allocation in any track fails the load
+LSGStatus read_smf_all_tracks(MLFReader_t* r, lsg_mlf_t* p_mlf_t) {
+	MLFTrackJob_t* jobs = (MLFTrackJob_t*)calloc(p_mlf_t->nTracks ? p_mlf_t->nTracks : 1, sizeof(MLFTrackJob_t));
+	if (!jobs) {
+		return LSGERR_GENERIC;
+	}
+
+	// Chunks are length prefixed, so all of them can be located before decoding any
+	int ti = 0;
+	size_t nBytes = 0;
+	while (ti < p_mlf_t->nTracks && smf_next_track_chunk(r, &jobs[ti].r)) {
+		nBytes += smf_remaining(&jobs[ti].r);
+		jobs[ti++].lastTempo = -1;
+	}
+
+	if (ti < p_mlf_t->nTracks) {
+		LSG_LOG_WARN("SMF: %d of %d tracks found", ti, p_mlf_t->nTracks);
+	}
+
+	// The calling thread works as one of the decoders
+	MLFDecodePool_t pool = {p_mlf_t, jobs, ti, 0};
+	const int nThreads = mlf_count_decode_threads(ti, nBytes);
+	pthread_t threads[kMLFMaxDecodeThreads];
+	int nStarted = 0;
+	while (nStarted < nThreads - 1 && pthread_create(&threads[nStarted], NULL, read_smf_track_worker_proc, &pool) == 0) {
+		++nStarted;
+	}
+
+	read_smf_track_worker_proc(&pool);
+	for (int i = 0;i < nStarted;++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	// Same result as reading the tracks one after another: the last tempo wins, the first loop found is kept
+	LSGStatus status = LSG_OK;
+	for (int i = 0;i < ti;++i) {
+		if (status == LSG_OK && jobs[i].status != LSG_OK) {
+			status = jobs[i].status;
+		}
+
+
+		if (jobs[i].lastTempo >= 0) {
+			p_mlf_t->tempo = jobs[i].lastTempo;
+		}
+
+		if (!lsg_mlf_is_loop_valid(&p_mlf_t->loopDesc)) {
+			pick_smf_markers(&p_mlf_t->tracks_arr[i], &p_mlf_t->loopDesc);
 		}
 	}
-	
-	return 1;
-}
 
-int check_smf_header(FILE* fp) {
-	const int cc[] = {'M','T','h','d'};
-	return check_smf_fourcc(fp, cc);
+	free(jobs);
+	return status;
 }
 
+void* read_smf_track_worker_proc(void* userData) {
+	MLFDecodePool_t* pool = (MLFDecodePool_t*)userData;
+	for (;;) {
+		const int i = __atomic_fetch_add(&pool->nextIndex, 1, __ATOMIC_RELAXED);
+		if (i >= pool->nJobs) {
+			break;
+		}
 
-size_t check_smf_track_header_and_size(FILE* fp) {
-	const int cc[] = {'M','T','r','k'};
-	if (!check_smf_fourcc(fp, cc)) {
-		return 0;
+		LSG_LOG_DEBUG("== Track %d", i);
+		pool->jobs[i].status = read_smf_track(&pool->jobs[i].r, pool->p_mlf_t, i, &pool->jobs[i].lastTempo);
 	}
-	
-	const int sz = (int)read_smf_u32(fp);
-	return (size_t)sz;
-}
 
+	return NULL;
+}
 
-LSGStatus read_smf_all_tracks(FILE* fp, lsg_mlf_t* p_mlf_t) {
-	int ti;
-	for (ti = 0;ti < p_mlf_t->nTracks;++ti) {
-		printf("\n\n== Track %d\n", ti);
-		read_smf_track(fp, p_mlf_t, ti);
+int mlf_count_decode_threads(int nTracks, size_t nBytes) {
+	const int nMax = __atomic_load_n(&sMaxDecodeThreads, __ATOMIC_RELAXED);
+	if (nMax < 2 || nTracks < 2 || nBytes < kMLFParallelMinBytes) {
+		return 1;
 	}
-	
-	return LSG_OK;
+
+	const long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	int n = (nCPUs > 1) ? (int)nCPUs : 1;
+	if (n > nTracks) { n = nTracks; }
+	if (n > nMax) { n = nMax; }
+	return n;
+}
+
+void lsg_mlf_set_max_decode_threads(int nThreads) {
+	if (nThreads < 1) { nThreads = 1; }
+	if (nThreads > kMLFMaxDecodeThreads) { nThreads = kMLFMaxDecodeThreads; }
+	__atomic_store_n(&sMaxDecodeThreads, nThreads, __ATOMIC_RELAXED);
 }
 
 static LSGStatus allocate_mlf_track_events(MLFTrack_t* tr) {
 	const size_t newSize = (tr->nCurrentCapacity == 0) ? kInitialTrackCapacity : (tr->nCurrentCapacity * 2);
-	tr->events_arr = (MLFEvent_t*)realloc(tr->events_arr, sizeof(MLFEvent_t) * newSize);
+	MLFEvent_t* events = (MLFEvent_t*)realloc(tr->events_arr, sizeof(MLFEvent_t) * newSize);
+	if (!events) {
+		return LSGERR_GENERIC;
+	}
+
+	tr->events_arr = events;
 	tr->nCurrentCapacity = (int)newSize;
 	return LSG_OK;
 }
@@ -162,129 +424,120 @@ LSGStatus init_mlf_track_struct(MLFTrack_t* tr, int trackIndex) {
 	return LSG_OK;
 }
 
-LSGStatus read_smf_track(FILE* fp, lsg_mlf_t* p_mlf_t, int trackIndex) {
-	size_t tlen = check_smf_track_header_and_size(fp);
-	if (tlen < 3) {
-		return LSGERR_BAD_FILE;
-	}
-	
+// Reads events until the end of the track chunk (r spans the chunk body).
+// Writes only its own track, so tracks can be read concurrently.
+LSGStatus read_smf_track(const MLFReader_t* r, lsg_mlf_t* p_mlf_t, int trackIndex, int* pOutLastTempo) {
 	if (trackIndex >= p_mlf_t->nTracks) {
-		fprintf(stderr, "Bad track index\n");
+		LSG_LOG_ERROR("Bad track index");
 		return LSGERR_GENERIC;
 	}
 
 	MLFTrack_t* track_data = &p_mlf_t->tracks_arr[trackIndex];
-	init_mlf_track_struct(track_data, trackIndex);
-	allocate_mlf_track_events(track_data);
+	MLFTrackCursor_t cur;
+	mlf_init_track_cursor(&cur, r, trackIndex, p_mlf_t->drum_mapping_channel);
 
-	MLFEvent_t prevEv;
-	
-	int total_read_bytes = 0;
-    int pitchBend = 0;
-	for (int i = 0;i < 99999;++i) {
-		int dt_bytes = 0;
-		const uint32_t dt = read_smf_delta(fp, &dt_bytes);
-		if (s_mevents_verbose) {
-			fprintf(stderr, "D: %u @%d\n", dt, dt_bytes);
-		}
-		total_read_bytes += dt_bytes;
-		
-		MLFEvent_t tempEv;
-		tempEv.waitDelta = dt;
-		tempEv.type = ME_Unknown;
-        tempEv.currentPitchBend = pitchBend;
-		
-		int ev_bytes = 0;
-		read_smf_event(fp, &ev_bytes, &tempEv);
-		smf_event_apply_running_state(&tempEv, &prevEv);
-        if (tempEv.channel == p_mlf_t->drum_mapping_channel) {
-            smf_event_apply_drum_mapping(&tempEv);
-        }
-        
+	MLFEvent_t tempEv;
+	while (mlf_cursor_next_event(&cur, &tempEv)) {
         if (tempEv.type == ME_Tempo) {
-            p_mlf_t->tempo = tempEv.otherValue;
-        } else if (tempEv.type == ME_Pitch) {
-            pitchBend = tempEv.currentPitchBend;
+            *pOutLastTempo = tempEv.otherValue;
         }
 
-        //printf("%d bytes advance\n", ev_bytes);
-		total_read_bytes += ev_bytes;
-		mlf_push_event(track_data, &tempEv);
-
-		if (total_read_bytes >= tlen) {
-			break;
+		if (mlf_push_event(track_data, &tempEv) != LSG_OK) {
+			return LSGERR_GENERIC;
 		}
-		
-		prevEv = tempEv;
 	}
 
 	track_data->nEvents = track_data->nWritten;
-	calc_smf_absolute_time(track_data);
-    
-    if (!lsg_mlf_is_loop_valid(&p_mlf_t->loopDesc)) {
-        pick_smf_markers(track_data, &p_mlf_t->loopDesc);
-    }
-    //printf(":::::::::::::::::::: %d %d\n",trackIndex, track_data->nEvents);
-
 	return LSG_OK;
 }
 
-LSGStatus calc_smf_absolute_time(MLFTrack_t* tr) {
-	int sum = 0;
-	const int n = (int)tr->nEvents;
-	for (int i = 0;i < n;++i) {
-		MLFEvent_t* ev = &tr->events_arr[i];
-		sum += ev->waitDelta;
-		
-		ev->absoluteTicks = sum;
+void mlf_init_track_cursor(MLFTrackCursor_t* cur, const MLFReader_t* trackReader, int trackIndex, int drumMappingChannel) {
+    cur->r = *trackReader;
+    cur->index = trackIndex;
+    cur->runningStatus = 0;
+    cur->pitchBend = 0;
+    cur->drumMappingChannel = drumMappingChannel;
+    cur->absoluteTicks = 0;
+}
+
+// Returns 0 at the end of the track (a truncated or malformed event ends it)
+int mlf_cursor_next_event(MLFTrackCursor_t* cur, MLFEvent_t* pOutEv) {
+	MLFReader_t* r = &cur->r;
+	if (smf_remaining(r) == 0) {
+		return 0;
 	}
-    
-	return LSG_OK;
+
+	memset(pOutEv, 0, sizeof(MLFEvent_t));
+	pOutEv->waitDelta = smf_read_vlq(r);
+	LSG_LOG_TRACE("D: %u", pOutEv->waitDelta);
+	pOutEv->type = ME_Unknown;
+	pOutEv->channel = -1;
+	pOutEv->currentPitchBend = cur->pitchBend;
+
+	// The bytes after a bad event cannot be told apart from data, so the track ends there
+	const LSGStatus status = read_smf_event(r, &cur->runningStatus, pOutEv);
+	if (r->bOverrun || status != LSG_OK) {
+		LSG_LOG_WARN("SMF: track %d is %s", cur->index, r->bOverrun ? "truncated" : "malformed");
+		r->p = r->end;
+		return 0;
+	}
+
+    if (pOutEv->channel == cur->drumMappingChannel) {
+        smf_event_apply_drum_mapping(pOutEv);
+    }
+
+    if (pOutEv->type == ME_Pitch) {
+        cur->pitchBend = pOutEv->currentPitchBend;
+    }
+
+	cur->absoluteTicks += pOutEv->waitDelta;
+	pOutEv->absoluteTicks = cur->absoluteTicks;
+	return 1;
+}
+
+void mlf_marker_scan_init(MLFMarkerScan_t* scan) {
+    scan->foundCount = 0;
+    scan->bPrevIsLoopStart = 0;
+    scan->loopDesc.startTicks = 0;
+    scan->loopDesc.endTicks = 0;
+}
+
+void mlf_marker_scan_step(MLFMarkerScan_t* scan, const MLFEvent_t* ev) {
+    if (ev->type == ME_LoopMarker) {
+        ++scan->foundCount;
+        
+        if (scan->foundCount == 1) {
+            // Found first
+            scan->bPrevIsLoopStart = 1;
+        } else if (scan->foundCount == 2) {
+            // Found second
+            scan->loopDesc.endTicks = ev->absoluteTicks;
+        }
+    } else if (scan->bPrevIsLoopStart) {
+        scan->bPrevIsLoopStart = 0;
+        scan->loopDesc.startTicks = ev->absoluteTicks;
+    }
 }
 
 LSGStatus pick_smf_markers(MLFTrack_t* tr, MLFLoopDesc* outLoopDesc) {
-    int foundCount = 0;
 	const int n = (int)tr->nEvents;
-    int bPrevIsLoopStart = 0;
+    MLFMarkerScan_t scan;
+    mlf_marker_scan_init(&scan);
     
-    // Initialize
-    if (outLoopDesc) {
-        outLoopDesc->startTicks = 0;
-        outLoopDesc->endTicks = 0;
+	for (int i = 0;i < n;++i) {
+        mlf_marker_scan_step(&scan, &tr->events_arr[i]);
     }
     
-	for (int i = 0;i < n;++i) {
-		MLFEvent_t* ev = &tr->events_arr[i];
-        if (ev->type == ME_LoopMarker) {
-            ++foundCount;
-            
-            if (foundCount == 1) {
-                // Found first
-                bPrevIsLoopStart = 1;
-            } else if (foundCount == 2) {
-                // Found second
-                if (outLoopDesc) {
-                    // Write
-                    outLoopDesc->endTicks = ev->absoluteTicks;
-                }
-            }
-        } else {
-            if (bPrevIsLoopStart) {
-                bPrevIsLoopStart = 0;
-                if (outLoopDesc) {
-                    // Write
-                    outLoopDesc->startTicks = ev->absoluteTicks;
-                }
-            }
-        }
+    if (outLoopDesc) {
+        *outLoopDesc = scan.loopDesc;
     }
     
-    if (foundCount < 2) {
+    if (scan.foundCount < 2) {
         return LSGERR_GENERIC;
     }
     
     if (outLoopDesc) {
-        fprintf(stderr, " :Loop found: %d <-> %d\n", outLoopDesc->startTicks, outLoopDesc->endTicks);
+        LSG_LOG_INFO(" :Loop found: %d <-> %d", outLoopDesc->startTicks, outLoopDesc->endTicks);
     }
     
 	return LSG_OK;
@@ -296,7 +549,9 @@ int lsg_mlf_is_loop_valid(MLFLoopDesc* pLoop) {
 
 LSGStatus mlf_push_event(MLFTrack_t* tr, MLFEvent_t* ev) {
 	if (tr->nWritten >= tr->nCurrentCapacity) {
-		allocate_mlf_track_events(tr);
+		if (allocate_mlf_track_events(tr) != LSG_OK) {
+			return LSGERR_GENERIC;
+		}
 	}
 
 	MLFEvent_t* ls = tr->events_arr;
@@ -306,145 +561,98 @@ LSGStatus mlf_push_event(MLFTrack_t* tr, MLFEvent_t* ev) {
 	return LSG_OK;
 }
 
-uint32_t read_smf_delta(FILE* fp, int* pOutReadBytes) {
-	uint32_t dt = 0;
-	*pOutReadBytes = 0;
-
-	for (int i = 0;i < 4;++i) {
-		dt <<= 7;
-		const int k = fgetc(fp);
-		dt |= (k & 0x7f);
-		if (pOutReadBytes) {
-			++(*pOutReadBytes);
-		}
-		
-		if ((k & 0x80) == 0) {
-			break;
-		}
-	}
-
-	return dt;
-}
-
-LSGStatus read_smf_event(FILE* fp, int* pOutReadBytes, MLFEvent_t* pOutEv) {
-	const int st = fgetc(fp);
-	*pOutReadBytes = 1;
-	
-	// printf("<%02X>\n", st);
+// Channel messages honor running status (kept across meta and sysex events, as most writers expect)
+LSGStatus read_smf_event(MLFReader_t* r, int* pRunningStatus, MLFEvent_t* pOutEv) {
+	int st = smf_read_u8(r);
 	
 	if (st == 0xff) {
 		// meta events
-		const int mt = fgetc(fp);
-		++(*pOutReadBytes);
-		
-		int m_bytes = 0;
+		const int mt = smf_read_u8(r);
 		pOutEv->type    = ME_MetaEventUnknown;
 		pOutEv->channel = -1;
-		read_smf_meta_event(fp, mt, &m_bytes, pOutEv);
-		
-		*pOutReadBytes += m_bytes;
-	} else if (st & 0x80) {
-		// new status
-		int st_type = (st & 0xf0);
-		int ch = st & 0x0f;
-		
-		const int nn = fgetc(fp);
-		++(*pOutReadBytes);
-
-		int found_2b = 1;
-		switch(st_type) {
-			case 0xc0:
-			pOutEv->type    = ME_ProgramChange;
-			pOutEv->channel = ch;
+		return read_smf_meta_event(r, mt, pOutEv);
+	}
 
-			printf("%02X%02X: PROGRAM CHANGE %d to %d\n", st, nn, ch, nn);
-			break;
+	if (st == 0xf0 || st == 0xf7) {
+		// sysex
+		smf_skip(r, smf_read_vlq(r));
+		return LSG_OK;
+	}
 
-            case 0xd0:
-                // pressure
-                break;
+	int nn;
+	if (st & 0x80) {
+		*pRunningStatus = st;
+		nn = smf_read_u8(r);
+	} else if (*pRunningStatus) {
+		// running status: this byte is the first data byte
+		nn = st;
+		st = *pRunningStatus;
+	} else {
+		LSG_LOG_WARN("SMF: data byte without status");
+		return LSGERR_BAD_FILE;
+	}
 
-			default:
-			found_2b = 0;
-			break;
-		}
+	const int st_type = (st & 0xf0);
+	const int ch = st & 0x0f;
+	switch(st_type) {
+		case 0xc0:
+		pOutEv->type    = ME_ProgramChange;
+		pOutEv->channel = ch;
 
-		if (!found_2b) {
-			// 3B messages
-			const int param = fgetc(fp);
-			++(*pOutReadBytes);
-		
-			//printf("%02X%02X%02X: ", st, nn, param);
-			switch(st_type) {
-				case 0x80:
-				
-				pOutEv->type    = ME_NoteOff;
-				pOutEv->channel = ch;
-				pOutEv->noteNo  = nn;
-				pOutEv->velocity= param;
-				
-				if (s_mevents_verbose) {
-					fprintf(stderr, "NOTE OFF (ch:%d)  %d  %d\n", ch, nn, param);
-				}
-				break;
+		LSG_LOG_DEBUG("%02X%02X: PROGRAM CHANGE %d to %d", st, nn, ch, nn);
+		return LSG_OK;
 
-				case 0x90:
-				
-				pOutEv->type    = ME_NoteOn;
-				pOutEv->channel = ch;
-				pOutEv->noteNo  = nn;
-				pOutEv->velocity= param;
+		case 0xd0:
+		// pressure
+		return LSG_OK;
 
-				if (s_mevents_verbose) {
-					fprintf(stderr, "NOTE ON   %d  %d\n", nn, param);
-				}
-				break;
-
-				case 0xB0:
-				pOutEv->type    = ME_ControlChange;
-				pOutEv->channel = ch;
-				printf("CTRLCHG   %d  %d\n", nn, param);
-				break;
-
-                case 0xE0: {
-                    uint16_t raw_word = (nn&0x7f) | ((param&0x7f) << 7);
-                    
-                    pOutEv->type    = ME_Pitch;
-                    pOutEv->channel = ch;
-                    pOutEv->currentPitchBend = (int)raw_word - 0x2000;
-                    // printf("  PitchBend: %d \n", pOutEv->otherValue);
-                } break;
-
-				default:
-				printf("Unknown status! %02X ******************************\n", st_type);
-				break;
-			}
-		}
-	} else {
-		// running status
-		const int nn = st; // first byte is note no.
+		default:
+		break;
+	}
 
-		const int param = fgetc(fp);
-		++(*pOutReadBytes);
+	// 3B messages
+	const int param = smf_read_u8(r);
+	switch(st_type) {
+		case 0x80:
+		pOutEv->type    = ME_NoteOff;
+		pOutEv->channel = ch;
+		pOutEv->noteNo  = nn;
+		pOutEv->velocity= param;
 		
-		//printf("r %02X%02X: ", nn, param);
-		//puts("\n\n<<< RUNNING STATUS! >>>\n");
+		LSG_LOG_TRACE("NOTE OFF (ch:%d)  %d  %d", ch, nn, param);
+		break;
 
-		pOutEv->type    = ME_RunningStatus;
+		case 0x90:
+		pOutEv->type    = ME_NoteOn;
+		pOutEv->channel = ch;
 		pOutEv->noteNo  = nn;
 		pOutEv->velocity= param;
+
+		LSG_LOG_TRACE("NOTE ON   %d  %d", nn, param);
+		break;
+
+		case 0xB0:
+		pOutEv->type    = ME_ControlChange;
+		pOutEv->channel = ch;
+		LSG_LOG_TRACE("CTRLCHG   %d  %d", nn, param);
+		break;
+
+        case 0xE0: {
+            uint16_t raw_word = (nn&0x7f) | ((param&0x7f) << 7);
+            
+            pOutEv->type    = ME_Pitch;
+            pOutEv->channel = ch;
+            pOutEv->currentPitchBend = (int)raw_word - 0x2000;
+        } break;
+
+		default:
+		LSG_LOG_WARN("Unknown status! %02X ******************************", st_type);
+		break;
 	}
 	
 	return LSG_OK;
 }
 
-void smf_event_apply_running_state(MLFEvent_t* newEvent, const MLFEvent_t* prevEvent) {
-	if (newEvent->type == ME_RunningStatus) {
-		newEvent->type = prevEvent->type;
-		newEvent->channel = prevEvent->channel;
-	}
-}
-
 void smf_event_apply_drum_mapping(MLFEvent_t* ev) {
     if (ev->noteNo == 38 || ev->noteNo == 40) {
         ev->noteNo = 1;
@@ -454,93 +662,49 @@ void smf_event_apply_drum_mapping(MLFEvent_t* ev) {
     }
 }
 
-LSGStatus read_smf_meta_event(FILE* fp, int metaEventType, int* pOutReadBytes, MLFEvent_t* pOutEv) {
-	switch(metaEventType) {
-		case 0x01: {
-			// free text
-			*pOutReadBytes += read_1blen_message(fp);
-		} break;
-            
-		case 0x02: {
-			// copyright
-			*pOutReadBytes += read_1blen_message(fp);
-		} break;
+// The body is read in place; its length always comes from the event
+LSGStatus read_smf_meta_event(MLFReader_t* r, int metaEventType, MLFEvent_t* pOutEv) {
+	const uint32_t len = smf_read_vlq(r);
+	if (len > smf_remaining(r)) {
+		smf_skip(r, len);
+		return LSGERR_BAD_FILE;
+	}
 
-		case 0x03: {
-			// title
-			*pOutReadBytes += read_1blen_message(fp);
-		} break;
+	const unsigned char* body = r->p;
+	smf_skip(r, len);
+
+	switch(metaEventType) {
+		case 0x01: // free text
+		case 0x02: // copyright
+		case 0x03: // title
+		case 0x20: // channel
+		case 0x21: // port
+		case 0x58: // rhythm
+		case 0x59: // key
+		case 0x7f: // sequencer dep event
+		break;
             
 		case 0x06: {
 			// marker
-            int body_first_val;
-            const int advance_len = read_1blen_message_get_first(fp, &body_first_val);
-			*pOutReadBytes += advance_len;
-            if (body_first_val == 1 && advance_len == 2) {
+            if (len == 1 && body[0] == 1) {
                 pOutEv->type = ME_LoopMarker;
             }
 		} break;
 
-		case 0x20: {
-			fgetc(fp); // 01
-			fgetc(fp); // ch num
-			*pOutReadBytes += 2;
-		} break;
-
-		case 0x21: {
-			fgetc(fp); // 01
-			fgetc(fp); // port num
-			*pOutReadBytes += 2;
-		} break;
-		
 		case 0x2f: {
-			fgetc(fp); // 00
-			*pOutReadBytes += 1;
-			
-			puts(": Track end :");
-		} break;
-		
-		case 0x58: {
-			// rhythm
-			fgetc(fp); // 04
-			fgetc(fp);
-			fgetc(fp);
-			fgetc(fp);
-			fgetc(fp);
-			*pOutReadBytes += 5;
-		} break;
-		
-		case 0x59: {
-			fgetc(fp); // 02
-			fgetc(fp);
-			fgetc(fp);
-			
-			*pOutReadBytes += 3;
+			LSG_LOG_DEBUG(": Track end :");
 		} break;
 		
 		case 0x51: {
 			// tempo
-			fgetc(fp); // 03
-            
-			const int b3 = fgetc(fp);
-			const int b2 = fgetc(fp);
-			const int b1 = fgetc(fp);
-			int tms = (b3 << 16) | (b2 << 8) | b1;
-            
-            pOutEv->type = ME_Tempo;
-            pOutEv->otherValue = tms;
-            
-			*pOutReadBytes += 4;
-		} break;
-		
-		case 0x7f: {
-			// sequencer dep event
-			*pOutReadBytes += read_1blen_message(fp);
+			if (len >= 3) {
+				pOutEv->type = ME_Tempo;
+				pOutEv->otherValue = (body[0] << 16) | (body[1] << 8) | body[2];
+			}
 		} break;
 		
 		default: {
-			*pOutReadBytes += read_1blen_message(fp);
-            fprintf(stderr, "WARNING: UNKNOWN META EVENT: %02X ******************************\n", metaEventType);
+            LSG_LOG_WARN("UNKNOWN META EVENT: %02X ******************************", metaEventType);
         }
 		break;
 	}
@@ -573,21 +737,48 @@ int lsg_mlf_count_channel_events_in_track(MLFTrack_t* p_track, int channelIndex)
 	return sum;
 }
 
-static int event_sorter_proc(const void *a, const void *b) {
-	return (int)( ((MLFEvent_t*)a)->absoluteTicks ) - (int)( ((MLFEvent_t*)b)->absoluteTicks );
+// Corrected ticks may have gone below 0, so they are compared as signed
+static LSG_INLINE int mlf_event_before(const MLFEvent_t* a, const MLFEvent_t* b) {
+	return (int32_t)a->absoluteTicks < (int32_t)b->absoluteTicks;
 }
 
+static LSG_INLINE int mlf_merge_run_before(const MLFMergeRun_t* a, const MLFMergeRun_t* b) {
+	if (mlf_event_before(a->p, b->p)) { return 1; }
+	if (mlf_event_before(b->p, a->p)) { return 0; }
+	return a->runIndex < b->runIndex;
+}
+
+static void mlf_merge_heap_sift_down(MLFMergeRun_t* heap, int n, int i) {
+	for (;;) {
+		const int l = i * 2 + 1;
+		const int r = l + 1;
+		int m = i;
+		if (l < n && mlf_merge_run_before(&heap[l], &heap[m])) { m = l; }
+		if (r < n && mlf_merge_run_before(&heap[r], &heap[m])) { m = r; }
+		if (m == i) {
+			break;
+		}
+
+		const MLFMergeRun_t tmp = heap[i];
+		heap[i] = heap[m];
+		heap[m] = tmp;
+		i = m;
+	}
+}
+
+// Within one track: a note off followed by a note on of the same channel at the same tick is moved 2 ticks earlier
+// (not below tick 0). The stream applies the same rule (mlf_stream_decode).
 static void correct_0delta_noteon(MLFEvent_t* ls, int len) {
     MLFEvent_t* prevNoteEv = NULL;
-    for (int i = 0;i < (len-1);++i) {
+    for (int i = 0;i < len;++i) {
         MLFEvent_t* ev = &ls[i];
         
-        if (prevNoteEv && ev) {
+        if (prevNoteEv) {
             const MLFEventType t1 = prevNoteEv->type;
             const MLFEventType t2 = ev->type;
 
             if (t1 == ME_NoteOff && t2 == ME_NoteOn) {
-                if (prevNoteEv->absoluteTicks == ev->absoluteTicks) {
+                if (prevNoteEv->absoluteTicks == ev->absoluteTicks && ev->absoluteTicks >= 2) {
                     prevNoteEv->absoluteTicks -= 2;
                 }
             }
@@ -599,35 +790,186 @@ static void correct_0delta_noteon(MLFEvent_t* ls, int len) {
     }
 }
 
-MLFEvent_t* lsg_mlf_create_sorted_channel_events(lsg_mlf_t* p_mlf_t, int channelIndex) {
-	MLFEvent_t* sorted_buf = NULL;
-	
-	const int len = lsg_mlf_count_channel_events(p_mlf_t, channelIndex);
+// Sorts the events of one channel, collected in track order (run i ends at runEnds[i]).
+// Each track is already in time order but for the corrected note offs, so the runs are fixed up
+// and merged. Stable: events at the same tick keep the track order. Frees events when it returns another array.
+static MLFEvent_t* mlf_sort_channel_runs(MLFEvent_t* events, const int* runEnds, int nRuns) {
+	const int len = nRuns ? runEnds[nRuns - 1] : 0;
+
+	int nNonEmpty = 0;
+	for (int i = 0;i < nRuns;++i) {
+		const int start = i ? runEnds[i - 1] : 0;
+		if (runEnds[i] > start) {
+			++nNonEmpty;
+		}
 
-	sorted_buf = (MLFEvent_t*)malloc( sizeof(MLFEvent_t) * len );
-	int writePos = 0;
+		correct_0delta_noteon(&events[start], runEnds[i] - start);
+
+		// Insertion: moves only the few corrected events
+		for (int k = start + 1;k < runEnds[i];++k) {
+			if (!mlf_event_before(&events[k], &events[k - 1])) {
+				continue;
+			}
+
+			const MLFEvent_t tmp = events[k];
+			int j = k;
+			for (;j > start && mlf_event_before(&tmp, &events[j - 1]);--j) {
+				events[j] = events[j - 1];
+			}
+			events[j] = tmp;
+		}
+	}
+
+	if (nNonEmpty < 2) {
+		return events;
+	}
+
+	MLFEvent_t* merged = (MLFEvent_t*)malloc(sizeof(MLFEvent_t) * len);
+	MLFMergeRun_t* heap = (MLFMergeRun_t*)malloc(sizeof(MLFMergeRun_t) * nNonEmpty);
+	if (!merged || !heap) {
+		free(merged);
+		free(heap);
+		free(events);
+		return NULL;
+	}
 
+	int n = 0;
+	for (int i = 0;i < nRuns;++i) {
+		const int start = i ? runEnds[i - 1] : 0;
+		if (runEnds[i] > start) {
+			heap[n].p = &events[start];
+			heap[n].end = &events[runEnds[i]];
+			heap[n].runIndex = i;
+			++n;
+		}
+	}
+
+	for (int i = n / 2 - 1;i >= 0;--i) {
+		mlf_merge_heap_sift_down(heap, n, i);
+	}
+
+	for (int w = 0;w < len;++w) {
+		merged[w] = *(heap[0].p++);
+		if (heap[0].p == heap[0].end) {
+			heap[0] = heap[--n];
+		}
+		mlf_merge_heap_sift_down(heap, n, 0);
+	}
+
+	free(heap);
+	free(events);
+	return merged;
+}
+
+static LSG_INLINE void mlf_copy_channel_event(MLFEvent_t* dest, const MLFEvent_t* ev) {
+	*dest = *ev;
+	if (dest->type == ME_NoteOn && dest->velocity == 0) {
+		dest->type = ME_NoteOff;
+	}
+}
+
+MLFEvent_t* lsg_mlf_create_sorted_channel_events(lsg_mlf_t* p_mlf_t, int channelIndex) {
+	const size_t len = (size_t)lsg_mlf_count_channel_events(p_mlf_t, channelIndex);
 	const int nTracks = p_mlf_t->nTracks;
+
+	MLFEvent_t* sorted_buf = (MLFEvent_t*)malloc( sizeof(MLFEvent_t) * (len ? len : 1) );
+	int* runEnds = (int*)malloc( sizeof(int) * (nTracks > 0 ? (size_t)nTracks : 1) );
+	if (!sorted_buf || !runEnds) {
+		free(sorted_buf);
+		free(runEnds);
+		return NULL;
+	}
+
+	int writePos = 0;
 	for (int i = 0;i < nTracks;++i) {
 		MLFTrack_t* tr = &p_mlf_t->tracks_arr[i];
-		for (int j = 0;j < tr->nEvents;++j) {
+		for (size_t j = 0;j < tr->nEvents;++j) {
 			MLFEvent_t* evs = tr->events_arr;
 			if (evs[j].channel == channelIndex) {
-				MLFEvent_t* dest = &sorted_buf[writePos++];
-				*dest = evs[j];
+				mlf_copy_channel_event(&sorted_buf[writePos++], &evs[j]);
+			}
+		}
+		runEnds[i] = writePos;
+	}
+
+	sorted_buf = mlf_sort_channel_runs(sorted_buf, runEnds, nTracks);
+	free(runEnds);
+	return sorted_buf;
+}
+
+// Counts per track and channel, scatters every event once, then merges each channel's runs
+LSGStatus lsg_mlf_create_all_sorted_channel_events(lsg_mlf_t* p_mlf_t, MLFEvent_t** outEventsArray, int* outLengthArray) {
+	const int nTracks = p_mlf_t->nTracks;
+	for (int ch = 0;ch < kLSGNumMIDIChannels;++ch) {
+		outEventsArray[ch] = NULL;
+		outLengthArray[ch] = 0;
+	}
 
-				if (dest->type == ME_NoteOn && dest->velocity == 0) {
-					dest->type = ME_NoteOff;
+	// runEnds[ch * nTracks + i]: end of track i's events in the channel's array
+	int* runEnds = (int*)calloc((size_t)kLSGNumMIDIChannels * (nTracks ? nTracks : 1), sizeof(int));
+	if (!runEnds) {
+		return LSGERR_GENERIC;
+	}
+
+	for (int i = 0;i < nTracks;++i) {
+		const MLFTrack_t* tr = &p_mlf_t->tracks_arr[i];
+		for (size_t j = 0;j < tr->nEvents;++j) {
+			const int ch = tr->events_arr[j].channel;
+			if (ch >= 0 && ch < kLSGNumMIDIChannels) {
+				++runEnds[ch * nTracks + i];
+			}
+		}
+	}
+
+	int writePos[kLSGNumMIDIChannels];
+	LSGStatus status = LSG_OK;
+	for (int ch = 0;ch < kLSGNumMIDIChannels;++ch) {
+		int* chRunEnds = &runEnds[ch * nTracks];
+		for (int i = 1;i < nTracks;++i) {
+			chRunEnds[i] += chRunEnds[i - 1];
+		}
+
+		writePos[ch] = 0;
+		outLengthArray[ch] = nTracks ? chRunEnds[nTracks - 1] : 0;
+		if (outLengthArray[ch] > 0) {
+			outEventsArray[ch] = (MLFEvent_t*)malloc(sizeof(MLFEvent_t) * outLengthArray[ch]);
+			if (!outEventsArray[ch]) {
+				status = LSGERR_GENERIC;
+			}
+		}
+	}
+
+	if (status == LSG_OK) {
+		for (int i = 0;i < nTracks;++i) {
+			const MLFTrack_t* tr = &p_mlf_t->tracks_arr[i];
+			for (size_t j = 0;j < tr->nEvents;++j) {
+				const MLFEvent_t* ev = &tr->events_arr[j];
+				if (ev->channel >= 0 && ev->channel < kLSGNumMIDIChannels) {
+					mlf_copy_channel_event(&outEventsArray[ev->channel][writePos[ev->channel]++], ev);
 				}
+			}
+		}
 
+		for (int ch = 0;ch < kLSGNumMIDIChannels;++ch) {
+			if (outEventsArray[ch]) {
+				outEventsArray[ch] = mlf_sort_channel_runs(outEventsArray[ch], &runEnds[ch * nTracks], nTracks);
+				if (!outEventsArray[ch]) {
+					status = LSGERR_GENERIC;
+				}
 			}
 		}
 	}
 
-    correct_0delta_noteon(sorted_buf, len);
-	qsort(sorted_buf, len, sizeof(MLFEvent_t), event_sorter_proc);
+	free(runEnds);
+	if (status != LSG_OK) {
+		for (int ch = 0;ch < kLSGNumMIDIChannels;++ch) {
+			free(outEventsArray[ch]);
+			outEventsArray[ch] = NULL;
+			outLengthArray[ch] = 0;
+		}
+	}
 
-	return sorted_buf;
+	return status;
 }
 
 void lsg_mlf_init_play_setup_struct(MLFPlaySetup_t* pSetup) {
@@ -644,6 +986,7 @@ void lsg_mlf_init_channel_mapping(MappedMLFChannel_t* ls, int count) {
     for (int i = 0;i < count;++i) {
         ls[i].customNoteTableIndex = 0;
         ls[i].eventsLength = 0;
+        ls[i].midiChannel = -1;
         ls[i].userData = 0;
         ls[i].sortedEvents = NULL;
         ls[i].bEventsArrayIsStatic = 0;
@@ -666,32 +1009,328 @@ void lsg_mlf_destroy_channel_mapping(MappedMLFChannel_t* ls, int count) {
     }
 }
 
-int read_1blen_message_get_first(FILE* fp, int* outByte) {
-	int len = fgetc(fp);
-	for (int i = 0;i < len;++i) {
-		const int val = fgetc(fp);
-        if (i == 0 && outByte) {
-            *outByte = val;
+// Streaming - - - - - - - - - - - -
+
+#define kMLFStreamReorderLength 32
+
+typedef struct _MLFStreamTrack_t {
+    MLFTrackCursor_t cursor;
+    MLFEvent_t head; // next event of the track (valid while bHasHead)
+    int bHasHead;
+    int bCursorEnded;
+    int nPending;
+    MLFEvent_t pending[kMLFStreamReorderLength]; // decoded after the head, sorted by tick
+} MLFStreamTrack_t;
+
+struct _lsg_mlf_stream_t {
+    lsg_mlf_t info; // no tracks_arr
+    uint32_t lastTicks[kLSGNumMIDIChannels];
+    void* mapped; // NULL: caller's memory
+    size_t mappedLength;
+    
+    int nTracks; // found in the file
+    MLFStreamTrack_t* tracks;     // current position
+    MLFStreamTrack_t* startState; // top of the song
+    MLFStreamTrack_t* loopState;  // first event of the loop
+    int bLoopStateSaved;
+    
+    // Playback (lsg_mlf_stream_start)
+    LSGReservedCommandBuffer_t* pRCBufArray;
+    int nRCBufs;
+    int midiChannels[kLSGNumOutChannels];
+    int deltaScale;
+    MLFLoopDesc loopDesc;
+    int64_t originTime;
+    int64_t lookahead;
+    int64_t timeOffset; // added by the passes of the loop
+    int64_t nextTime;   // time of the next event to write
+    int bPassWritten;
+    int bEnded;
+};
+
+static int mlf_cursor_is_noteon_next(const MLFTrackCursor_t* cur, int channel) {
+    MLFTrackCursor_t peek = *cur;
+    MLFEvent_t ev;
+    while (mlf_cursor_next_event(&peek, &ev) && ev.waitDelta == 0) {
+        if (ev.channel == channel && (ev.type == ME_NoteOn || ev.type == ME_NoteOff)) {
+            return (ev.type == ME_NoteOn && ev.velocity != 0);
+        }
+    }
+    
+    return 0;
+}
+
+// Next event in file order, with the note off fix-up of correct_0delta_noteon
+static int mlf_stream_decode(MLFStreamTrack_t* t, MLFEvent_t* ev) {
+    if (t->bCursorEnded || !mlf_cursor_next_event(&t->cursor, ev)) {
+        t->bCursorEnded = 1;
+        return 0;
+    }
+    
+    if (ev->type == ME_NoteOn && ev->velocity == 0) {
+        ev->type = ME_NoteOff;
+    }
+    
+    if (ev->type == ME_NoteOff && ev->absoluteTicks >= 2 && mlf_cursor_is_noteon_next(&t->cursor, ev->channel)) {
+        ev->absoluteTicks -= 2;
+    }
+    
+    return 1;
+}
+
+// A corrected note off goes before the events of the 2 ticks above it, so the track is decoded
+// until 2 ticks past the head and the pending events are kept sorted, as mlf_sort_channel_runs does.
+// (Beyond kMLFStreamReorderLength events in that range, they are written in file order.)
+static void mlf_stream_load_head(MLFStreamTrack_t* t) {
+    while (t->nPending < kMLFStreamReorderLength &&
+           (t->nPending == 0 || t->cursor.absoluteTicks < t->pending[0].absoluteTicks + 2)) {
+        MLFEvent_t ev;
+        if (!mlf_stream_decode(t, &ev)) {
+            break;
         }
-	}
-	
-	return 1 + len;
+        
+        // Insert after the events at the same tick (stable)
+        int i = t->nPending;
+        for (;i > 0 && ev.absoluteTicks < t->pending[i - 1].absoluteTicks;--i) {
+            t->pending[i] = t->pending[i - 1];
+        }
+        t->pending[i] = ev;
+        ++t->nPending;
+    }
+    
+    t->bHasHead = (t->nPending > 0);
+    if (t->bHasHead) {
+        t->head = t->pending[0];
+        --t->nPending;
+        memmove(t->pending, t->pending + 1, sizeof(MLFEvent_t) * t->nPending);
+    }
+}
+
+// Track with the earliest head (the lower index on ties, as the stable sort of the expanded events)
+static MLFStreamTrack_t* mlf_stream_pick_next(lsg_mlf_stream_t* s) {
+    MLFStreamTrack_t* found = NULL;
+    for (int i = 0;i < s->nTracks;++i) {
+        MLFStreamTrack_t* t = &s->tracks[i];
+        if (t->bHasHead && (!found || t->head.absoluteTicks < found->head.absoluteTicks)) {
+            found = t;
+        }
+    }
+    
+    return found;
 }
 
-int read_1blen_message(FILE* fp) {
-    return read_1blen_message_get_first(fp, NULL);
+// One pass over the track for what playback needs to know in advance
+static void mlf_stream_scan_track(lsg_mlf_stream_t* s, MLFTrackCursor_t cur) {
+    MLFMarkerScan_t scan;
+    mlf_marker_scan_init(&scan);
+    
+    MLFEvent_t ev;
+    while (mlf_cursor_next_event(&cur, &ev)) {
+        if (ev.type == ME_Tempo) {
+            s->info.tempo = ev.otherValue;
+        }
+        
+        if (ev.channel >= 0 && ev.channel < kLSGNumMIDIChannels && ev.absoluteTicks > s->lastTicks[ev.channel]) {
+            s->lastTicks[ev.channel] = ev.absoluteTicks;
+        }
+        
+        mlf_marker_scan_step(&scan, &ev);
+    }
+    
+    if (!lsg_mlf_is_loop_valid(&s->info.loopDesc)) {
+        s->info.loopDesc = scan.loopDesc;
+        if (scan.foundCount >= 2) {
+            LSG_LOG_INFO(" :Loop found: %d <-> %d", scan.loopDesc.startTicks, scan.loopDesc.endTicks);
+        }
+    }
 }
 
-size_t read_smf_u32(FILE* fp) { return read_smf_be(fp, 4); }
-size_t read_smf_u16(FILE* fp) { return read_smf_be(fp, 2); }
+lsg_mlf_stream_t* lsg_mlf_stream_open(const char* filename, int auto_drum_mapping_ch) {
+    void* mapped;
+    size_t fileSize;
+    if (smf_map_file(filename, &mapped, &fileSize) != LSG_OK) {
+        return NULL;
+    }
+    
+    lsg_mlf_stream_t* s = lsg_mlf_stream_open_memory(mapped, fileSize, auto_drum_mapping_ch);
+    if (!s) {
+        munmap(mapped, fileSize);
+        return NULL;
+    }
+    
+    s->mapped = mapped;
+    s->mappedLength = fileSize;
+    return s;
+}
 
-size_t read_smf_be(FILE* fp, int nBytes) {
-	size_t s = 0;
-	for (int i = 0;i < nBytes;++i) {
-		s <<= 8;
-		s |= fgetc(fp);
-	}
-	
-	return s;
+lsg_mlf_stream_t* lsg_mlf_stream_open_memory(const void* pData, size_t length, int auto_drum_mapping_ch) {
+    if (!pData) {
+        return NULL;
+    }
+    
+    lsg_mlf_stream_t* s = (lsg_mlf_stream_t*)calloc(1, sizeof(lsg_mlf_stream_t));
+    if (!s) {
+        return NULL;
+    }
+    
+    lsg_init_mlf(&s->info);
+    s->info.drum_mapping_channel = auto_drum_mapping_ch;
+    s->info.tempo = 120;
+    
+    MLFReader_t r;
+    if (smf_begin(&r, pData, length, &s->info) != LSG_OK) {
+        free(s);
+        return NULL;
+    }
+    
+    // Count the tracks first, then keep three states of each
+    MLFReader_t tr;
+    MLFReader_t counter = r;
+    while (s->nTracks < s->info.nTracks && smf_next_track_chunk(&counter, &tr)) {
+        ++s->nTracks;
+    }
+    
+    const int n = s->nTracks;
+    s->tracks = (MLFStreamTrack_t*)calloc(n ? (n * 3) : 1, sizeof(MLFStreamTrack_t));
+    if (!s->tracks) {
+        free(s);
+        return NULL;
+    }
+    s->startState = s->tracks + n;
+    s->loopState = s->tracks + n * 2;
+    
+    for (int i = 0;i < n;++i) {
+        smf_next_track_chunk(&r, &tr);
+        mlf_init_track_cursor(&s->startState[i].cursor, &tr, i, auto_drum_mapping_ch);
+        mlf_stream_scan_track(s, s->startState[i].cursor);
+        mlf_stream_load_head(&s->startState[i]);
+    }
+    
+    if (n < s->info.nTracks) {
+        LSG_LOG_WARN("SMF: %d of %d tracks found", n, s->info.nTracks);
+    }
+    
+    memcpy(s->tracks, s->startState, sizeof(MLFStreamTrack_t) * n);
+    s->bEnded = 1; // until started
+    
+    LSG_LOG_INFO("%d tracks ready to stream", n);
+    return s;
+}
+
+void lsg_mlf_stream_close(lsg_mlf_stream_t* pStream) {
+    if (!pStream) {
+        return;
+    }
+    
+    if (pStream->mapped) {
+        munmap(pStream->mapped, pStream->mappedLength);
+    }
+    
+    free(pStream->tracks);
+    free(pStream);
+}
+
+const lsg_mlf_t* lsg_mlf_stream_get_info(const lsg_mlf_stream_t* pStream) {
+    return &pStream->info;
+}
+
+uint32_t lsg_mlf_stream_get_last_ticks(const lsg_mlf_stream_t* pStream, int midiChannel) {
+    if (midiChannel < 0 || midiChannel >= kLSGNumMIDIChannels) {
+        return 0;
+    }
+    
+    return pStream->lastTicks[midiChannel];
+}
+
+// Rewinds the stream and writes the commands due within the lookahead
+LSGStatus lsg_mlf_stream_start(lsg_mlf_stream_t* pStream, LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs, const MLFPlaySetup_t* pPlaySetup, int64_t originTime, int64_t lookahead) {
+    if (!pStream || !pRCBufArray || !pPlaySetup) {
+        return LSGERR_NULLPTR;
+    }
+    
+    lsg_mlf_stream_t* s = pStream;
+    if (nRCBufs > kLSGNumOutChannels) { nRCBufs = kLSGNumOutChannels; }
+    s->pRCBufArray = pRCBufArray;
+    s->nRCBufs = nRCBufs;
+    for (int ch = 0;ch < nRCBufs;++ch) {
+        s->midiChannels[ch] = pPlaySetup->chmap[ch].midiChannel;
+    }
+    
+    s->deltaScale = pPlaySetup->deltaScale;
+    s->loopDesc = pPlaySetup->loopDesc;
+    s->originTime = originTime;
+    s->lookahead = lookahead;
+    s->timeOffset = 0;
+    s->nextTime = originTime;
+    s->bLoopStateSaved = 0;
+    s->bPassWritten = 0;
+    s->bEnded = 0;
+    memcpy(s->tracks, s->startState, sizeof(MLFStreamTrack_t) * s->nTracks);
+    
+    lsg_mlf_stream_refill(s, originTime);
+    return LSG_OK;
 }
 
+// Writes the commands due before endTick + lookahead. Stops early when a window is full
+// (the event stays at the head of its track and is written by a later call).
+void lsg_mlf_stream_refill(void* pStream, int64_t endTick) {
+    lsg_mlf_stream_t* s = (lsg_mlf_stream_t*)pStream;
+    const int64_t horizon = endTick + s->lookahead;
+    if (s->bEnded || s->nextTime >= horizon) {
+        return;
+    }
+    
+    const int use_loop = lsg_mlf_is_loop_valid(&s->loopDesc);
+    for (;;) {
+        MLFStreamTrack_t* t = mlf_stream_pick_next(s);
+        if (use_loop) {
+            if (!t || t->head.absoluteTicks > s->loopDesc.endTicks) {
+                // Back to the loop start (an empty loop ends the song)
+                if (!s->bLoopStateSaved || !s->bPassWritten) {
+                    s->bEnded = 1;
+                    return;
+                }
+                
+                memcpy(s->tracks, s->loopState, sizeof(MLFStreamTrack_t) * s->nTracks);
+                s->timeOffset += (int64_t)(s->loopDesc.endTicks - s->loopDesc.startTicks) * s->deltaScale;
+                s->bPassWritten = 0;
+                continue;
+            }
+            
+            if (!s->bLoopStateSaved && t->head.absoluteTicks >= s->loopDesc.startTicks) {
+                memcpy(s->loopState, s->tracks, sizeof(MLFStreamTrack_t) * s->nTracks);
+                s->bLoopStateSaved = 1;
+            }
+        }
+        
+        if (!t) {
+            s->bEnded = 1;
+            return;
+        }
+        
+        const MLFEvent_t* ev = &t->head;
+        const int64_t tick = s->originTime + s->timeOffset + (int64_t)ev->absoluteTicks * s->deltaScale;
+        s->nextTime = tick;
+        if (tick >= horizon) {
+            return;
+        }
+        
+        if (ev->channel >= 0) {
+            // All destinations need room, or none is written
+            for (int ch = 0;ch < s->nRCBufs;++ch) {
+                if (s->midiChannels[ch] == ev->channel && lsg_rsvcmd_get_free_length(&s->pRCBufArray[ch]) == 0) {
+                    return;
+                }
+            }
+            
+            for (int ch = 0;ch < s->nRCBufs;++ch) {
+                if (s->midiChannels[ch] == ev->channel) {
+                    lsg_rsvcmd_add_mlf_event(&s->pRCBufArray[ch], ev, tick);
+                    s->bPassWritten = 1;
+                }
+            }
+        }
+        
+        mlf_stream_load_head(t);
+    }
+}
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "LSGresample.h"
+#include "LSGdsp.h"
+
+#define kLSGResampleMaxChannels 8
+#define kLSGResampleMaxPhases 256 // larger ratios round the phase to the nearest lower filter
+
+struct _lsg_resampler_t {
+    int nChannels;
+    int nTaps;
+    uint32_t L, M;   // outRate / inRate = L / M (reduced)
+    int nPhases;
+    float* bank;     // [nPhases][nTaps], stored reversed so that a dot product with the history applies it
+    uint64_t acc;    // position of the next output in 1/L input frames (from history[0])
+    size_t nFrames;  // frames held in history
+    size_t capacity;
+    float* history[kLSGResampleMaxChannels]; // planar
+};
+
+static const int sQualityTaps[] = {8, 16, 32};
+static const double sQualityRolloff[] = {0.80, 0.90, 0.95};
+static const double sQualityBeta[] = {6.0, 8.0, 10.0};
+
+static uint32_t lsg_resample_gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        const uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+// Modified Bessel function of the first kind, order 0 (for the Kaiser window)
+static double lsg_resample_bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1;k < 32;++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+// Kaiser windowed sinc at nPhases times the input rate, split into phases.
+// Each phase is normalized to unity gain at DC.
+static void lsg_resample_build_bank(lsg_resampler_t* rs, int quality) {
+    const int nTaps = rs->nTaps;
+    const int nPhases = rs->nPhases;
+    const int total = nTaps * nPhases;
+    const double center = (total - 1) * 0.5;
+    const double ratio = (double)rs->L / (double)rs->M;
+    const double cut = ((ratio < 1.0) ? ratio : 1.0) * sQualityRolloff[quality]; // relative to the input Nyquist
+    const double beta = sQualityBeta[quality];
+    const double i0beta = lsg_resample_bessel_i0(beta);
+
+    for (int p = 0;p < nPhases;++p) {
+        float* h = rs->bank + p * nTaps;
+        double sum = 0;
+        for (int k = 0;k < nTaps;++k) {
+            const int j = p + k * nPhases;
+            const double t = (j - center) / nPhases; // in input frames
+            const double x = M_PI * cut * t;
+            const double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(x) / x;
+            const double w = (2.0 * j) / (total - 1) - 1.0;
+            const double win = lsg_resample_bessel_i0(beta * sqrt(fmax(0.0, 1.0 - w * w))) / i0beta;
+
+            const double v = cut * sinc * win;
+            h[nTaps - 1 - k] = (float)v;
+            sum += v;
+        }
+
+        for (int k = 0;k < nTaps;++k) {
+            h[k] = (float)(h[k] / sum);
+        }
+    }
+}
+
+lsg_resampler_t* lsg_resampler_create(int inRate, int outRate, int nChannels, int quality, size_t maxInFrames) {
+    if (inRate <= 0 || outRate <= 0 || nChannels < 1 || nChannels > kLSGResampleMaxChannels || maxInFrames < 1) {
+        return NULL;
+    }
+
+    if (quality < kLSGResampleQuality_Low) { quality = kLSGResampleQuality_Low; }
+    else if (quality > kLSGResampleQuality_High) { quality = kLSGResampleQuality_High; }
+
+    lsg_resampler_t* rs = (lsg_resampler_t*)calloc(1, sizeof(lsg_resampler_t));
+    if (!rs) {
+        return NULL;
+    }
+
+    const uint32_t g = lsg_resample_gcd((uint32_t)outRate, (uint32_t)inRate);
+    rs->L = (uint32_t)outRate / g;
+    rs->M = (uint32_t)inRate / g;
+    rs->nChannels = nChannels;
+    rs->nTaps = sQualityTaps[quality];
+    rs->nPhases = (rs->L > kLSGResampleMaxPhases) ? kLSGResampleMaxPhases : (int)rs->L;
+    rs->capacity = rs->nTaps + maxInFrames;
+
+    rs->bank = (float*)malloc(sizeof(float) * rs->nTaps * rs->nPhases);
+    int bOK = (rs->bank != NULL);
+    for (int c = 0;c < nChannels;++c) {
+        rs->history[c] = (float*)malloc(sizeof(float) * rs->capacity);
+        bOK = bOK && rs->history[c];
+    }
+
+    if (!bOK) {
+        lsg_resampler_destroy(rs);
+        return NULL;
+    }
+
+    lsg_resample_build_bank(rs, quality);
+    lsg_resampler_reset(rs);
+    return rs;
+}
+
+void lsg_resampler_destroy(lsg_resampler_t* rs) {
+    if (!rs) {
+        return;
+    }
+
+    for (int c = 0;c < kLSGResampleMaxChannels;++c) {
+        free(rs->history[c]);
+    }
+
+    free(rs->bank);
+    free(rs);
+}
+
+// Starts from silence: the first output lines up with the first input after the filter delay
+void lsg_resampler_reset(lsg_resampler_t* rs) {
+    rs->nFrames = rs->nTaps - 1;
+    rs->acc = (uint64_t)(rs->nTaps - 1) * rs->L;
+    for (int c = 0;c < rs->nChannels;++c) {
+        memset(rs->history[c], 0, sizeof(float) * rs->nFrames);
+    }
+}
+
+size_t lsg_resampler_input_needed(const lsg_resampler_t* rs, size_t nOutFrames) {
+    if (nOutFrames == 0) {
+        return 0;
+    }
+
+    const uint64_t last = (rs->acc + (uint64_t)(nOutFrames - 1) * rs->M) / rs->L;
+    return (last + 1 > rs->nFrames) ? (size_t)(last + 1 - rs->nFrames) : 0;
+}
+
+size_t lsg_resampler_process(lsg_resampler_t* rs, const float* pIn, size_t nInFrames, float* pOut, size_t maxOutFrames) {
+    const int nCh = rs->nChannels;
+    const int nTaps = rs->nTaps;
+
+    // Append (deinterleave)
+    if (nInFrames > rs->capacity - rs->nFrames) {
+        nInFrames = rs->capacity - rs->nFrames;
+    }
+
+    for (int c = 0;c < nCh;++c) {
+        float* dest = rs->history[c] + rs->nFrames;
+        const float* src = pIn + c;
+        for (size_t i = 0;i < nInFrames;++i) {
+            dest[i] = src[i * nCh];
+        }
+    }
+    rs->nFrames += nInFrames;
+
+    // Filter
+    size_t nOut = 0;
+    for (;nOut < maxOutFrames;++nOut) {
+        const uint64_t i = rs->acc / rs->L;
+        if (i >= rs->nFrames) {
+            break;
+        }
+
+        const uint32_t frac = (uint32_t)(rs->acc % rs->L);
+        const uint32_t p = (rs->nPhases == (int)rs->L) ? frac : (uint32_t)(((uint64_t)frac * rs->nPhases) / rs->L);
+        const float* h = rs->bank + p * nTaps;
+        const size_t first = (size_t)i + 1 - nTaps;
+
+        float* dest = pOut + nOut * nCh;
+        for (int c = 0;c < nCh;++c) {
+            dest[c] = lsg_dsp_dot_f32(h, rs->history[c] + first, nTaps);
+        }
+
+        rs->acc += rs->M;
+    }
+
+    // Drop frames no later output will read
+    const uint64_t nextFirst = rs->acc / rs->L + 1 - nTaps;
+    const size_t drop = (nextFirst < rs->nFrames) ? (size_t)nextFirst : rs->nFrames;
+    if (drop > 0) {
+        for (int c = 0;c < nCh;++c) {
+            memmove(rs->history[c], rs->history[c] + drop, sizeof(float) * (rs->nFrames - drop));
+        }
+
+        rs->nFrames -= drop;
+        rs->acc -= (uint64_t)drop * rs->L;
+    }
+
+    return nOut;
+}
+
+int lsg_resampler_get_latency(const lsg_resampler_t* rs) {
+    return rs->nTaps / 2;
+}
@@ -0,0 +1,37 @@
+// LSG ONGEN - - - Streaming polyphase resampler
+
+#ifndef LSGTest_LSGresample_h
+#define LSGTest_LSGresample_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "LSG.h"
+
+// Quality tiers (filter taps per phase: 8, 16, 32)
+#define kLSGResampleQuality_Low    0
+#define kLSGResampleQuality_Medium 1
+#define kLSGResampleQuality_High   2
+
+typedef struct _lsg_resampler_t lsg_resampler_t;
+
+// Converts interleaved float frames from inRate to outRate.
+// maxInFrames bounds one lsg_resampler_process call; nothing is allocated after creation.
+lsg_resampler_t* lsg_resampler_create(int inRate, int outRate, int nChannels, int quality, size_t maxInFrames);
+void lsg_resampler_destroy(lsg_resampler_t* rs);
+void lsg_resampler_reset(lsg_resampler_t* rs);
+
+// Input frames to feed so that the next process call yields exactly nOutFrames
+size_t lsg_resampler_input_needed(const lsg_resampler_t* rs, size_t nOutFrames);
+
+// Consumes all nInFrames (<= maxInFrames) and returns the number of frames written (<= maxOutFrames)
+size_t lsg_resampler_process(lsg_resampler_t* rs, const float* pIn, size_t nInFrames, float* pOut, size_t maxOutFrames);
+
+// Delay added by the filter, in input frames
+int lsg_resampler_get_latency(const lsg_resampler_t* rs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,38 +1,88 @@
 #include <SDL.h>
+#include <stdlib.h>
 #include "LSGsdl.h"
+#include "LSGresample.h"
 #define LSGSDL_VERBOSE 1
 
 static void sFillAudioBufferCallback(void* userdata, Uint8* stream, int len);
-static int sActualSampleFormat = AUDIO_S16MSB;
+static void sFillResampled(Uint8* stream, int nFrames);
+// Native float when the SDL build has it (no conversion pass on the SDL side)
+#ifdef AUDIO_F32SYS
+#define kLSGSDLDesiredFormat AUDIO_F32SYS
+#else
+#define kLSGSDLDesiredFormat AUDIO_S16MSB
+#endif
+
+static int sActualSampleFormat = kLSGSDLDesiredFormat;
 static char sSDLBufferGo = 0;
 
+// Used when the device does not run at the engine rate
+static int sResampleQuality = kLSGResampleQuality_Medium;
+static lsg_resampler_t* sResampler = NULL;
+static int sResampleChunkFrames = 0; // output frames per resampler call
+static float* sResampleInBuffer = NULL;
+static float* sResampleOutBuffer = NULL;
+
+void lsg_sdl_set_resample_quality(int quality) {
+    sResampleQuality = quality;
+}
+
+static int lsg_sdl_is_32bit_format(int format) {
+#ifdef AUDIO_F32SYS
+    return format == AUDIO_F32SYS || format == AUDIO_S32SYS;
+#else
+    return 0;
+#endif
+}
+
+static int lsg_sdl_prepare_resampler(int engineRate, int deviceRate, int deviceFrames) {
+    sResampleChunkFrames = deviceFrames;
+    const size_t maxIn = (size_t)((double)deviceFrames * engineRate / deviceRate) + 64;
+
+    sResampler = lsg_resampler_create(engineRate, deviceRate, 2, sResampleQuality, maxIn);
+    sResampleInBuffer = (float*)malloc(sizeof(float) * 2 * maxIn);
+    sResampleOutBuffer = (float*)malloc(sizeof(float) * 2 * deviceFrames);
+    if (!sResampler || !sResampleInBuffer || !sResampleOutBuffer) {
+        return -1;
+    }
+
+    return 0;
+}
+
 int lsg_sdl_start() {
     lsg_initialize();
-
+    const int engineRate = lsg_get_sample_rate();
 
     SDL_AudioSpec desired, actualSpec;
-    desired.freq = kLSGOutSamplingRate;
-    desired.format = AUDIO_S16MSB;
+    desired.freq = engineRate;
+    desired.format = kLSGSDLDesiredFormat;
     desired.channels = 2;
     desired.samples = 2048;
     desired.callback = &sFillAudioBufferCallback;
     desired.userdata = NULL;
-    
+
     const int sdlrv = SDL_OpenAudio(&desired, &actualSpec);
     if (sdlrv < 0) {
         return sdlrv;
     }
-    
+
     sActualSampleFormat = actualSpec.format;
     if (desired.format != actualSpec.format) {
         fputs("[ Buffer format changed ]\n", stderr);
     }
-    
+
+    if (actualSpec.freq != engineRate) {
+        if (lsg_sdl_prepare_resampler(engineRate, actualSpec.freq, actualSpec.samples) < 0) {
+            SDL_CloseAudio();
+            return -1;
+        }
+    }
+
 #if LSGSDL_VERBOSE
     fputs("Opened SDL Audio\n", stderr);
-    fprintf(stderr, "Output sampling rate = %d\n", actualSpec.freq);
+    fprintf(stderr, "Output sampling rate = %d%s\n", actualSpec.freq, sResampler ? " (resampled)" : "");
 #endif
-    
+
     SDL_PauseAudio(0);
     return 0;
 }
@@ -43,15 +93,76 @@ void sFillAudioBufferCallback(void* userdata, Uint8* stream, int len) {
     }
 
     // ***WARNING*** Here is NOT main thread.
-    const int nSamples = len / 4;
+    if (sResampler) {
+        sFillResampled(stream, len / (lsg_sdl_is_32bit_format(sActualSampleFormat) ? 8 : 4));
+        return;
+    }
+
+    switch (sActualSampleFormat) {
+#ifdef AUDIO_F32SYS
+        case AUDIO_F32SYS:
+            lsg_synthesize_f32((float*)stream, len / 8, 2, 1);
+            break;
 
-    if (sActualSampleFormat == AUDIO_S16MSB) {
-        lsg_synthesize_BE16(stream, nSamples, 4, 1);
-    } else {
-        lsg_synthesize_LE16(stream, nSamples, 4, 1);
+        case AUDIO_S32SYS:
+            lsg_synthesize_s32((int32_t*)stream, len / 8, 2, 1);
+            break;
+#endif
+
+        case AUDIO_S16MSB:
+            lsg_synthesize_BE16(stream, len / 4, 4, 1);
+            break;
+
+        default:
+            lsg_synthesize_LE16(stream, len / 4, 4, 1);
+            break;
+    }
+}
+
+// Renders just enough frames at the internal rate, then converts them to the device rate
+void sFillResampled(Uint8* stream, int nFrames) {
+    const int b32 = lsg_sdl_is_32bit_format(sActualSampleFormat);
+    const int frameBytes = b32 ? 8 : 4;
+
+    for (int done = 0;done < nFrames;) {
+        int n = nFrames - done;
+        if (n > sResampleChunkFrames) { n = sResampleChunkFrames; }
+
+        Uint8* pOut = stream + done * frameBytes;
+#ifdef AUDIO_F32SYS
+        float* dest = (sActualSampleFormat == AUDIO_F32SYS) ? (float*)pOut : sResampleOutBuffer;
+#else
+        float* dest = sResampleOutBuffer;
+#endif
+
+        const size_t nIn = lsg_resampler_input_needed(sResampler, n);
+        lsg_synthesize_f32(sResampleInBuffer, nIn, 2, 1);
+        lsg_resampler_process(sResampler, sResampleInBuffer, nIn, dest, n);
+
+        if (dest == sResampleOutBuffer) {
+            // Other device formats
+            for (int i = 0;i < n * 2;++i) {
+                float v = dest[i] * 32768.0f;
+                if (v > 32767.0f) { v = 32767.0f; }
+                else if (v < -32767.0f) { v = -32767.0f; }
+
+                const int val = (int)v;
+                if (b32) {
+                    ((int32_t*)pOut)[i] = (int32_t)((uint32_t)val << 16);
+                } else if (sActualSampleFormat == AUDIO_S16MSB) {
+                    pOut[i * 2    ] = (val & 0xff00) >> 8;
+                    pOut[i * 2 + 1] =  val & 0xff;
+                } else {
+                    pOut[i * 2    ] =  val & 0xff;
+                    pOut[i * 2 + 1] = (val & 0xff00) >> 8;
+                }
+            }
+        }
+
+        done += n;
     }
 }
 
 void lsg_sdl_set_running(char b) {
     sSDLBufferGo = b;
-}
\ No newline at end of file
+}
@@ -9,6 +9,9 @@ extern "C" {
 int lsg_sdl_start();
 void lsg_sdl_set_running(char b);
 
+// kLSGResampleQuality_* used when the device rate differs (call before lsg_sdl_start)
+void lsg_sdl_set_resample_quality(int quality);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "LSGsong.h"
+
+#define kLSGSongFileMagic   0x4347534c // "LSGC" read as little endian
+#define kLSGSongFileVersion 1
+#define kLSGSongWriteBlockLength 1024 // commands per fwrite
+#define kLSGSongMaxVoicePoolSize 4096 // sanity limit for loading
+#define lsg_align8(x) (((x) + 7) & ~(size_t)7)
+
+typedef struct _LSGSongFileHeader_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t commandSize;
+    uint32_t nChannels;
+    int32_t sampleRate;
+    int32_t voicePoolSize;
+    int32_t deltaScale;
+    uint32_t loopStartTicks;
+    uint32_t loopEndTicks;
+    uint32_t reserved;
+    int64_t endTime;
+    float customNoteFrequencies[kLSGNoteMappingLength];
+} LSGSongFileHeader_t;
+
+// Followed by the channels' data: coefficients, then commands (from time 0) at 8 byte boundaries
+typedef struct _LSGSongFileChannel_t {
+    int32_t bEnabled;
+    int32_t generatorKind;
+    uint32_t nCoefficients;
+    int32_t polyphony;
+    float detune;
+    int32_t volume;
+    int32_t customNoteTableIndex;
+    int32_t attackRate;
+    int32_t decayRate;
+    int32_t sustainLevel;
+    int32_t releaseRate;
+    int32_t fadeRate;
+    uint64_t loopFirstIndex;
+    uint64_t loopLastIndex;
+    int64_t loopStartTime;
+    int64_t loopEndTime;
+    uint64_t nCommands;
+    uint64_t commandsOffset;
+    uint64_t coefficientsOffset;
+} LSGSongFileChannel_t;
+
+struct _lsg_song_t {
+    void* mapped;
+    size_t mappedSize;
+    const LSGSongFileHeader_t* header;
+    const LSGSongFileChannel_t* channels;
+    LSGReservedCommandBuffer_t rcbufs[kLSGNumOutChannels]; // arrays point into the mapping
+};
+
+static int lsg_song_file_channel_good(const LSGSongFileChannel_t* fch, size_t fileSize);
+static LSGStatus lsg_song_write_commands(FILE* fp, const LSGReservedCommandBuffer_t* rb);
+
+void lsg_song_init_conf(LSGSongConf_t* pConf) {
+    memset(pConf, 0, sizeof(LSGSongConf_t));
+    pConf->sampleRate = kLSGOutSamplingRate;
+    pConf->voicePoolSize = kLSGDefaultVoicePoolSize;
+    
+    for (int i = 0;i < kLSGNumOutChannels;++i) {
+        pConf->channels[i].generatorKind = kLSGSongGenerator_Square;
+        pConf->channels[i].volume = kLSGChannelVolumeMax;
+        pConf->channels[i].polyphony = 1;
+    }
+    
+    for (int i = 0;i < kLSGNoteMappingLength;++i) {
+        pConf->customNoteFrequencies[i] = -1.0f;
+    }
+}
+
+LSGStatus lsg_song_write_file(const char* path, const LSGSongConf_t* pConf, const MLFPlaySetup_t* pPlaySetup, const LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs) {
+    if (!path || !pConf || !pPlaySetup || !pRCBufArray) {
+        return LSGERR_NULLPTR;
+    }
+    
+    if (nRCBufs < 0 || nRCBufs > kLSGNumOutChannels) {
+        return LSGERR_PARAM_OUTBOUND;
+    }
+    
+    // Streamed buffers only hold a window of the song
+    for (int ch = 0;ch < nRCBufs;++ch) {
+        if (pRCBufArray[ch].bWindow || pConf->channels[ch].nCoefficients > kLSGSongMaxCoefficients) {
+            return LSGERR_PARAM_OUTBOUND;
+        }
+    }
+    
+    LSGSongFileHeader_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kLSGSongFileMagic;
+    header.version = kLSGSongFileVersion;
+    header.commandSize = sizeof(LSGReservedCommand_t);
+    header.nChannels = (uint32_t)nRCBufs;
+    header.sampleRate = pConf->sampleRate;
+    header.voicePoolSize = pConf->voicePoolSize;
+    header.deltaScale = pPlaySetup->deltaScale;
+    header.loopStartTicks = pPlaySetup->loopDesc.startTicks;
+    header.loopEndTicks = pPlaySetup->loopDesc.endTicks;
+    header.endTime = pConf->endTime;
+    memcpy(header.customNoteFrequencies, pConf->customNoteFrequencies, sizeof(header.customNoteFrequencies));
+    
+    LSGSongFileChannel_t channels[kLSGNumOutChannels];
+    memset(channels, 0, sizeof(channels));
+    size_t offset = sizeof(LSGSongFileHeader_t) + sizeof(LSGSongFileChannel_t) * nRCBufs;
+    for (int ch = 0;ch < nRCBufs;++ch) {
+        const LSGSongChannelConf_t* chconf = &pConf->channels[ch];
+        const MappedMLFChannel_t* mappedCh = &pPlaySetup->chmap[ch];
+        const LSGReservedCommandBuffer_t* rb = &pRCBufArray[ch];
+        LSGSongFileChannel_t* fch = &channels[ch];
+        
+        fch->bEnabled = chconf->bEnabled;
+        fch->generatorKind = chconf->generatorKind;
+        fch->nCoefficients = chconf->coefficients ? chconf->nCoefficients : 0;
+        fch->polyphony = chconf->polyphony;
+        fch->detune = chconf->detune;
+        fch->volume = chconf->volume;
+        fch->customNoteTableIndex = mappedCh->customNoteTableIndex;
+        fch->attackRate = mappedCh->defaultADSR.attack_rate;
+        fch->decayRate = mappedCh->defaultADSR.decay_rate;
+        fch->sustainLevel = mappedCh->defaultADSR.sustain_level;
+        fch->releaseRate = mappedCh->defaultADSR.release_rate;
+        fch->fadeRate = mappedCh->defaultADSR.fade_rate;
+        fch->loopFirstIndex = rb->loopFirstIndex;
+        fch->loopLastIndex = rb->loopLastIndex;
+        fch->loopStartTime = rb->loopStartTime;
+        fch->loopEndTime = rb->loopEndTime;
+        fch->nCommands = rb->writtenLength;
+        
+        fch->coefficientsOffset = offset;
+        offset = lsg_align8(offset + sizeof(float) * fch->nCoefficients);
+        fch->commandsOffset = offset;
+        offset += sizeof(LSGReservedCommand_t) * rb->writtenLength;
+    }
+    
+    const size_t tmpPathLength = strlen(path) + 32;
+    char* tmpPath = (char*)malloc(tmpPathLength);
+    if (!tmpPath) {
+        return LSGERR_GENERIC;
+    }
+    
+    snprintf(tmpPath, tmpPathLength, "%s.%d.tmp", path, (int)getpid());
+    FILE* fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        free(tmpPath);
+        return LSGERR_GENERIC;
+    }
+    
+    int bGood = (fwrite(&header, sizeof(header), 1, fp) == 1) &&
+                (fwrite(channels, sizeof(LSGSongFileChannel_t), nRCBufs, fp) == (size_t)nRCBufs);
+    
+    static const unsigned char padding[8] = {0};
+    for (int ch = 0;bGood && ch < nRCBufs;++ch) {
+        const LSGSongFileChannel_t* fch = &channels[ch];
+        if (fch->nCoefficients) {
+            bGood = (fwrite(pConf->channels[ch].coefficients, sizeof(float), fch->nCoefficients, fp) == fch->nCoefficients);
+        }
+        
+        const size_t padLength = (size_t)(fch->commandsOffset - fch->coefficientsOffset) - sizeof(float) * fch->nCoefficients;
+        if (bGood && padLength) {
+            bGood = (fwrite(padding, 1, padLength, fp) == padLength);
+        }
+        
+        if (bGood) {
+            bGood = (lsg_song_write_commands(fp, &pRCBufArray[ch]) == LSG_OK);
+        }
+    }
+    
+    bGood = (fclose(fp) == 0) && bGood;
+    if (bGood) {
+        bGood = (rename(tmpPath, path) == 0);
+    }
+    
+    if (!bGood) {
+        unlink(tmpPath);
+    }
+    
+    free(tmpPath);
+    return bGood ? LSG_OK : LSGERR_GENERIC;
+}
+
+// Copies through a cleared block so the struct padding is written as zeros
+LSGStatus lsg_song_write_commands(FILE* fp, const LSGReservedCommandBuffer_t* rb) {
+    LSGReservedCommand_t block[kLSGSongWriteBlockLength];
+    memset(block, 0, sizeof(block));
+    
+    for (size_t done = 0;done < rb->writtenLength;) {
+        size_t n = rb->writtenLength - done;
+        if (n > kLSGSongWriteBlockLength) { n = kLSGSongWriteBlockLength; }
+        
+        for (size_t i = 0;i < n;++i) {
+            block[i].tick = rb->array[done + i].tick + rb->tickOffset;
+            block[i].cmd = rb->array[done + i].cmd;
+        }
+        
+        if (fwrite(block, sizeof(LSGReservedCommand_t), n, fp) != n) {
+            return LSGERR_GENERIC;
+        }
+        done += n;
+    }
+    
+    return LSG_OK;
+}
+
+lsg_song_t* lsg_song_open(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LSGSongFileHeader_t)) {
+        close(fd);
+        return NULL;
+    }
+    
+    const size_t fileSize = (size_t)st.st_size;
+    void* mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return NULL;
+    }
+    
+    const LSGSongFileHeader_t* header = (const LSGSongFileHeader_t*)mapped;
+    int bGood = (header->magic == kLSGSongFileMagic &&
+                 header->version == kLSGSongFileVersion &&
+                 header->commandSize == sizeof(LSGReservedCommand_t) &&
+                 header->nChannels <= kLSGNumOutChannels &&
+                 header->sampleRate >= kLSGMinSamplingRate && header->sampleRate <= kLSGMaxSamplingRate &&
+                 header->voicePoolSize >= 1 && header->voicePoolSize <= kLSGSongMaxVoicePoolSize &&
+                 fileSize >= sizeof(LSGSongFileHeader_t) + sizeof(LSGSongFileChannel_t) * header->nChannels);
+    
+    const LSGSongFileChannel_t* channels = (const LSGSongFileChannel_t*)(header + 1);
+    for (uint32_t ch = 0;bGood && ch < header->nChannels;++ch) {
+        bGood = lsg_song_file_channel_good(&channels[ch], fileSize);
+    }
+    
+    lsg_song_t* pSong = bGood ? (lsg_song_t*)calloc(1, sizeof(lsg_song_t)) : NULL;
+    if (!pSong) {
+        munmap(mapped, fileSize);
+        return NULL;
+    }
+    
+    pSong->mapped = mapped;
+    pSong->mappedSize = fileSize;
+    pSong->header = header;
+    pSong->channels = channels;
+    return pSong;
+}
+
+int lsg_song_file_channel_good(const LSGSongFileChannel_t* fch, size_t fileSize) {
+    if (fch->generatorKind < kLSGSongGenerator_Square || fch->generatorKind > kLSGSongGenerator_Noise ||
+        fch->nCoefficients > kLSGSongMaxCoefficients ||
+        fch->polyphony < 1 || fch->polyphony > kLSGSongMaxVoicePoolSize) {
+        return 0;
+    }
+    
+    if ((fch->coefficientsOffset & 3) || fch->coefficientsOffset > fileSize ||
+        sizeof(float) * fch->nCoefficients > fileSize - fch->coefficientsOffset) {
+        return 0;
+    }
+    
+    // The engine reads the commands in place and indexes them with int
+    if ((fch->commandsOffset & 7) || fch->commandsOffset > fileSize ||
+        fch->nCommands > (fileSize - fch->commandsOffset) / sizeof(LSGReservedCommand_t) ||
+        fch->nCommands > INT_MAX) {
+        return 0;
+    }
+    
+    if (fch->loopFirstIndex > fch->loopLastIndex || (fch->loopLastIndex && fch->loopLastIndex >= fch->nCommands) ||
+        fch->loopStartTime < 0 || fch->loopEndTime < fch->loopStartTime) {
+        return 0;
+    }
+    
+    return 1;
+}
+
+void lsg_song_close(lsg_song_t* pSong) {
+    if (!pSong) {
+        return;
+    }
+    
+    munmap(pSong->mapped, pSong->mappedSize);
+    free(pSong);
+}
+
+int lsg_song_get_sample_rate(const lsg_song_t* pSong) {
+    return pSong->header->sampleRate;
+}
+
+int64_t lsg_song_calc_end_tick(const lsg_song_t* pSong, int64_t originTime, int nLoops) {
+    const LSGSongFileHeader_t* header = pSong->header;
+    MLFLoopDesc loopDesc = {header->loopStartTicks, header->loopEndTicks};
+    if (lsg_mlf_is_loop_valid(&loopDesc)) {
+        const int64_t loopStart = (int64_t)loopDesc.startTicks * header->deltaScale;
+        const int64_t loopEnd   = (int64_t)loopDesc.endTicks   * header->deltaScale;
+        return originTime + loopStart + (loopEnd - loopStart) * nLoops;
+    }
+    
+    return originTime + header->endTime;
+}
+
+LSGStatus lsg_song_bind(lsg_song_t* pSong, int64_t originTime) {
+    return lsg_ctx_song_bind(lsg_get_default_context(), pSong, originTime);
+}
+
+// Same setup as filling the buffers from the SMF and configuring the channels from a preset
+LSGStatus lsg_ctx_song_bind(lsg_context_t* ctx, lsg_song_t* pSong, int64_t originTime) {
+    if (!ctx || !pSong) {
+        return LSGERR_NULLPTR;
+    }
+    
+    const LSGSongFileHeader_t* header = pSong->header;
+    if (lsg_ctx_get_sample_rate(ctx) != header->sampleRate) {
+        return LSGERR_PARAM_OUTBOUND;
+    }
+    
+    const int nChannels = (int)header->nChannels;
+    for (int ch = 0;ch < nChannels;++ch) {
+        const LSGSongFileChannel_t* fch = &pSong->channels[ch];
+        LSGReservedCommandBuffer_t* rb = &pSong->rcbufs[ch];
+        
+        memset(rb, 0, sizeof(LSGReservedCommandBuffer_t));
+        rb->array = (LSGReservedCommand_t*)((unsigned char*)pSong->mapped + fch->commandsOffset);
+        rb->length = rb->writtenLength = (size_t)fch->nCommands;
+        rb->tickOffset = originTime;
+        rb->loopFirstIndex = (size_t)fch->loopFirstIndex;
+        rb->loopLastIndex = (size_t)fch->loopLastIndex;
+        rb->loopStartTime = originTime + fch->loopStartTime;
+        rb->loopEndTime = originTime + fch->loopEndTime;
+        
+        if (fch->attackRate) {
+            LSG_ADSR adsr = {fch->attackRate, fch->decayRate, fch->sustainLevel, fch->releaseRate, fch->fadeRate};
+            lsg_ctx_set_channel_adsr(ctx, ch, &adsr);
+        }
+        
+        lsg_ctx_use_custom_notes(ctx, ch, fch->customNoteTableIndex);
+        lsg_ctx_channel_bind_rsvcmd(ctx, ch, rb);
+    }
+    
+    LSGStatus status = lsg_ctx_set_voice_pool_size(ctx, header->voicePoolSize);
+    for (int ch = 0;ch < nChannels && status == LSG_OK;++ch) {
+        const LSGSongFileChannel_t* fch = &pSong->channels[ch];
+        if (!fch->bEnabled) {
+            continue;
+        }
+        
+        switch (fch->generatorKind) {
+            case kLSGSongGenerator_Triangle:
+                status = lsg_ctx_generate_triangle(ctx, ch);
+                break;
+            
+            case kLSGSongGenerator_Noise:
+                status = lsg_ctx_generate_short_noise(ctx, ch);
+                break;
+            
+            case kLSGSongGenerator_Square13:
+                status = lsg_ctx_generate_square_13(ctx, ch);
+                break;
+            
+            case kLSGSongGenerator_Sin: {
+                const float* coefs = (const float*)((const unsigned char*)pSong->mapped + fch->coefficientsOffset);
+                status = lsg_ctx_generate_sin_v(ctx, ch, coefs, fch->nCoefficients);
+            } break;
+            
+            default:
+                status = lsg_ctx_generate_square(ctx, ch);
+                break;
+        }
+        lsg_ctx_set_channel_source_generator(ctx, ch, ch);
+        
+        lsg_ctx_set_channel_global_detune(ctx, ch, fch->detune);
+        lsg_ctx_set_channel_global_volume(ctx, ch, fch->volume);
+        lsg_ctx_set_channel_polyphony(ctx, ch, fch->polyphony);
+    }
+    
+    for (int i = 1;i < kLSGNoteMappingLength;++i) {
+        const float fq = header->customNoteFrequencies[i];
+        if (fq >= 0.0f) {
+            lsg_ctx_set_custom_note_frequency(ctx, i, fq);
+        }
+    }
+    
+    return status;
+}
@@ -0,0 +1,61 @@
+// LSG ONGEN - - - Compiled songs (.lsgc)
+
+#ifndef LSGTest_LSGsong_h
+#define LSGTest_LSGsong_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "LSG.h"
+
+// A compiled song holds the expanded reserved commands of every channel and the channel setup,
+// so playing it needs neither the SMF nor the preset. The commands are used in place from the mapping.
+
+#define kLSGSongGenerator_Square   0
+#define kLSGSongGenerator_Square13 1
+#define kLSGSongGenerator_Triangle 2
+#define kLSGSongGenerator_Sin      3 // lsg_generate_sin_v with the coefficients
+#define kLSGSongGenerator_Noise    4
+
+#define kLSGSongMaxCoefficients 64
+
+typedef struct _LSGSongChannelConf_t {
+    int bEnabled;
+    int generatorKind;
+    const float* coefficients;
+    unsigned int nCoefficients;
+    float detune;
+    int volume;
+    int polyphony;
+} LSGSongChannelConf_t;
+
+// What the preset would configure
+typedef struct _LSGSongConf_t {
+    int sampleRate;
+    int voicePoolSize;
+    int64_t endTime; // from time 0, for songs without a loop
+    LSGSongChannelConf_t channels[kLSGNumOutChannels];
+    float customNoteFrequencies[kLSGNoteMappingLength]; // < 0: not set
+} LSGSongConf_t;
+
+typedef struct _lsg_song_t lsg_song_t;
+
+void lsg_song_init_conf(LSGSongConf_t* pConf);
+// pRCBufArray: filled by lsg_rsvcmd_fill_mlf with originTime 0. The file is replaced atomically.
+LSGStatus lsg_song_write_file(const char* path, const LSGSongConf_t* pConf, const MLFPlaySetup_t* pPlaySetup, const LSGReservedCommandBuffer_t* pRCBufArray, int nRCBufs);
+
+lsg_song_t* lsg_song_open(const char* path); // NULL when missing or malformed
+void lsg_song_close(lsg_song_t* pSong); // unbind it first
+int lsg_song_get_sample_rate(const lsg_song_t* pSong);
+int64_t lsg_song_calc_end_tick(const lsg_song_t* pSong, int64_t originTime, int nLoops); // after nLoops passes of the loop
+
+// Sets up the channels and binds the commands. One song can be bound to one context at a time.
+// Fails with LSGERR_PARAM_OUTBOUND when the context does not run at the song's sample rate.
+LSGStatus lsg_song_bind(lsg_song_t* pSong, int64_t originTime);
+LSGStatus lsg_ctx_song_bind(lsg_context_t* ctx, lsg_song_t* pSong, int64_t originTime);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,605 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "LSGwavetable.h"
+
+#define kLSGWavetableCacheNumBuckets 64
+#define kLSGWavetableFileMagic   0x5747534c // "LSGW" read as little endian
+#define kLSGWavetableFileVersion 1
+#define lsg_align8(x) (((x) + 7) & ~(size_t)7)
+
+typedef struct _LSGWavetableCacheEntry_t {
+    LSGWavetable_t table; // must be the first member
+    struct _LSGWavetableCacheEntry_t* next;
+    uint32_t hash;
+    unsigned int serial;
+    int refCount;
+    int kind;
+    int bMapped; // samples live in a cache file mapping, not after the params
+    size_t paramsSize;
+    unsigned char params[]; // copy of the key params, then the samples (unless mapped from a file)
+} LSGWavetableCacheEntry_t;
+
+typedef struct _LSGWavetableFileHeader_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t lengthBits;
+    uint32_t numLevels;
+    uint32_t storageLength;
+    uint32_t recordSize;
+    uint32_t nRecords;
+    uint32_t reserved;
+} LSGWavetableFileHeader_t;
+
+// Followed by kLSGWavetableStorageLength samples, padded to recordSize
+typedef struct _LSGWavetableFileRecord_t {
+    int32_t kind;
+    int32_t nLevels;
+    int32_t bNearest;
+    int32_t levelOffset[kLSGWavetableNumLevels];
+    int32_t levelLengthBits[kLSGWavetableNumLevels];
+    int32_t reserved;
+} LSGWavetableFileRecord_t;
+
+static LSGWavetableCacheEntry_t* sCacheBuckets[kLSGWavetableCacheNumBuckets];
+static int sCacheNumTables = 0;
+static int sCacheNumMappedTables = 0;
+static size_t sCacheMappedBytes = 0; // cache file mappings kept alive by their tables
+static unsigned int sCacheNextSerial = 1;
+static pthread_mutex_t sCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct _LSGComplex_t {
+    double re;
+    double im;
+} LSGComplex_t;
+
+static void lsg_fft(LSGComplex_t* buf, int lengthBits, int bInverse);
+static void lsg_apply_spectrum_filter(LSGComplex_t* spectrum, int lengthBits, const LSGWavetableFilter_t* pFilter);
+static void lsg_wavetable_store_level(LSGWavetable_t* wt, int level, int writeOffset, int lengthBits, const LSGComplex_t* levelBuf, double scale);
+static uint32_t lsg_wavetable_key_hash(const LSGWavetableKey_t* key);
+static LSGWavetableCacheEntry_t* lsg_wavetable_cache_find(const LSGWavetableKey_t* key, uint32_t hash);
+static void lsg_wavetable_cache_insert(LSGWavetableCacheEntry_t* e);
+static size_t lsg_wavetable_file_record_size();
+static int lsg_wavetable_file_record_good(const LSGWavetableFileRecord_t* rec);
+
+void lsg_wavetable_clear(LSGWavetable_t* wt) {
+    memset(wt->data, 0, sizeof(LSGSample) * kLSGWavetableStorageLength);
+    wt->nLevels = 1;
+    wt->bNearest = 0;
+    wt->levelOffset[0] = 0;
+    wt->levelLengthBits[0] = kLSGWavetableLengthBits;
+}
+
+int lsg_wavetable_get_length(const LSGWavetable_t* wt) {
+    return 1 << wt->levelLengthBits[0];
+}
+
+LSGSample lsg_wavetable_get_sample(const LSGWavetable_t* wt, int sampleIndex) {
+    if (sampleIndex < 0 || sampleIndex >= lsg_wavetable_get_length(wt)) {
+        return 0;
+    }
+    
+    return wt->data[ wt->levelOffset[0] + sampleIndex ];
+}
+
+LSGStatus lsg_wavetable_build(LSGWavetable_t* wt, const LSGSample* cycle, int lengthBits, int flags, const LSGWavetableFilter_t* pFilter) {
+    if (!wt || !cycle) {
+        return LSGERR_NULLPTR;
+    }
+    
+    if (lengthBits > kLSGWavetableMaxLengthBits || (!(flags & kLSGWavetableFlag_Nearest) && lengthBits != kLSGWavetableLengthBits)) {
+        return LSGERR_PARAM_OUTBOUND;
+    }
+
+    const int len = 1 << lengthBits;
+    if (flags & kLSGWavetableFlag_Nearest) {
+        // Noise: keep every sample as is
+        memcpy(wt->data, cycle, sizeof(LSGSample) * len);
+        wt->data[len] = cycle[0];
+        wt->nLevels = 1;
+        wt->bNearest = 1;
+        wt->levelOffset[0] = 0;
+        wt->levelLengthBits[0] = lengthBits;
+        return LSG_OK;
+    }
+    
+    LSGComplex_t* spectrum = (LSGComplex_t*)malloc(sizeof(LSGComplex_t) * len * 2);
+    if (!spectrum) {
+        return LSGERR_GENERIC;
+    }
+    
+    LSGComplex_t* levelBuf = spectrum + len;
+    for (int i = 0;i < len;++i) {
+        spectrum[i].re = cycle[i];
+        spectrum[i].im = 0;
+    }
+    
+    lsg_fft(spectrum, lengthBits, 0);
+    if (pFilter) {
+        lsg_apply_spectrum_filter(spectrum, lengthBits, pFilter);
+    }
+    
+    // Each level keeps harmonics below its own Nyquist
+    int writeOffset = 0;
+    for (int k = 0;k < kLSGWavetableNumLevels;++k) {
+        const int levelBits = lengthBits - k;
+        const int levelLen = 1 << levelBits;
+        
+        memset(levelBuf, 0, sizeof(LSGComplex_t) * levelLen);
+        levelBuf[0] = spectrum[0];
+        for (int h = 1;h < (levelLen >> 1);++h) {
+            levelBuf[h] = spectrum[h];
+            levelBuf[levelLen - h] = spectrum[len - h];
+        }
+        
+        lsg_fft(levelBuf, levelBits, 1);
+        lsg_wavetable_store_level(wt, k, writeOffset, levelBits, levelBuf, 1.0 / (double)len);
+        writeOffset += levelLen + 1;
+    }
+    
+    wt->nLevels = kLSGWavetableNumLevels;
+    wt->bNearest = 0;
+    
+    free(spectrum);
+    return LSG_OK;
+}
+
+void lsg_wavetable_store_level(LSGWavetable_t* wt, int level, int writeOffset, int lengthBits, const LSGComplex_t* levelBuf, double scale) {
+    const int levelLen = 1 << lengthBits;
+    LSGSample* p = wt->data + writeOffset;
+    
+    for (int i = 0;i < levelLen;++i) {
+        double v = levelBuf[i].re * scale;
+        if (v > 32767) { v = 32767; }
+        else if (v < -32767) { v = -32767; }
+        
+        p[i] = (LSGSample)lrint(v);
+    }
+    
+    // Guard sample for interpolation
+    p[levelLen] = p[0];
+    
+    wt->levelOffset[level] = writeOffset;
+    wt->levelLengthBits[level] = lengthBits;
+}
+
+// Multiplies each harmonic by the frequency response of the FIR.
+// H(z) = sum(taps[j] * z^j) at z = e^(-i 2pi h tapSpacing) is evaluated by Horner's rule,
+// so each harmonic needs one sin/cos instead of one per tap.
+void lsg_apply_spectrum_filter(LSGComplex_t* spectrum, int lengthBits, const LSGWavetableFilter_t* pFilter) {
+    const int len = 1 << lengthBits;
+    const double DPI = M_PI * 2.0;
+    const float* taps = pFilter->taps;
+    
+    for (int h = 0;h <= (len >> 1);++h) {
+        const double w = DPI * (double)h * pFilter->tapSpacing;
+        const double zr = cos(w);
+        const double zi = -sin(w);
+        
+        double re = taps[pFilter->nTaps - 1];
+        double im = 0;
+        for (int j = pFilter->nTaps - 2;j >= 0;--j) {
+            const double nr = re * zr - im * zi + taps[j];
+            im = re * zi + im * zr;
+            re = nr;
+        }
+        
+        LSGComplex_t* x = &spectrum[h];
+        const double xr = x->re * re - x->im * im;
+        const double xi = x->re * im + x->im * re;
+        x->re = xr;
+        x->im = xi;
+        
+        // Negative frequency gets the conjugate response
+        if (h > 0 && h < (len >> 1)) {
+            LSGComplex_t* y = &spectrum[len - h];
+            const double yr = y->re * re + y->im * im;
+            const double yi = y->im * re - y->re * im;
+            y->re = yr;
+            y->im = yi;
+        }
+    }
+}
+
+// In-place radix-2 FFT (unscaled)
+void lsg_fft(LSGComplex_t* buf, int lengthBits, int bInverse) {
+    const int len = 1 << lengthBits;
+    
+    // Bit reversal
+    for (int i = 1, j = 0;i < len;++i) {
+        int bit = len >> 1;
+        for (;j & bit;bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        
+        if (i < j) {
+            const LSGComplex_t t = buf[i];
+            buf[i] = buf[j];
+            buf[j] = t;
+        }
+    }
+    
+    const double sign = bInverse ? 1.0 : -1.0;
+    for (int half = 1;half < len;half <<= 1) {
+        const double theta = sign * M_PI / (double)half;
+        const double wr = cos(theta);
+        const double wi = sin(theta);
+        
+        for (int start = 0;start < len;start += half << 1) {
+            double cr = 1.0;
+            double ci = 0.0;
+            for (int k = 0;k < half;++k) {
+                LSGComplex_t* a = &buf[start + k];
+                LSGComplex_t* b = &buf[start + k + half];
+                const double tr = b->re * cr - b->im * ci;
+                const double ti = b->re * ci + b->im * cr;
+                b->re = a->re - tr;
+                b->im = a->im - ti;
+                a->re += tr;
+                a->im += ti;
+                
+                const double nr = cr * wr - ci * wi;
+                ci = cr * wi + ci * wr;
+                cr = nr;
+            }
+        }
+    }
+}
+
+// Shared table cache - - - - - - - - - - - -
+
+// FNV-1a over kind and params
+uint32_t lsg_wavetable_key_hash(const LSGWavetableKey_t* key) {
+    uint32_t h = 2166136261u;
+    const unsigned char* kindBytes = (const unsigned char*)&key->kind;
+    for (size_t i = 0;i < sizeof(key->kind);++i) {
+        h = (h ^ kindBytes[i]) * 16777619u;
+    }
+    
+    const unsigned char* p = (const unsigned char*)key->params;
+    for (size_t i = 0;i < key->paramsSize;++i) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    
+    return h;
+}
+
+// Call with sCacheMutex locked (inserts only shared entries into the buckets)
+void lsg_wavetable_cache_insert(LSGWavetableCacheEntry_t* e) {
+    e->serial = sCacheNextSerial++;
+    if (e->kind != 0) {
+        LSGWavetableCacheEntry_t** pBucket = &sCacheBuckets[e->hash % kLSGWavetableCacheNumBuckets];
+        e->next = *pBucket;
+        *pBucket = e;
+    }
+    
+    ++sCacheNumTables;
+    if (e->bMapped) {
+        ++sCacheNumMappedTables;
+    }
+}
+
+// Call with sCacheMutex locked
+LSGWavetableCacheEntry_t* lsg_wavetable_cache_find(const LSGWavetableKey_t* key, uint32_t hash) {
+    LSGWavetableCacheEntry_t* e = sCacheBuckets[hash % kLSGWavetableCacheNumBuckets];
+    for (;e;e = e->next) {
+        if (e->hash == hash && e->kind == key->kind && e->paramsSize == key->paramsSize &&
+            (key->paramsSize == 0 || memcmp(e->params, key->params, key->paramsSize) == 0)) {
+            return e;
+        }
+    }
+    
+    return NULL;
+}
+
+const LSGWavetable_t* lsg_wavetable_cache_acquire(const LSGWavetableKey_t* key, LSGWavetableBuilder builder, void* userData) {
+    const int bShared = (key->kind != 0);
+    const uint32_t hash = bShared ? lsg_wavetable_key_hash(key) : 0;
+    LSGWavetableCacheEntry_t* found;
+    
+    if (bShared) {
+        pthread_mutex_lock(&sCacheMutex);
+        found = lsg_wavetable_cache_find(key, hash);
+        if (found) {
+            ++found->refCount;
+        }
+        pthread_mutex_unlock(&sCacheMutex);
+        
+        if (found) {
+            return &found->table;
+        }
+    }
+    
+    // Build outside the lock
+    const size_t paramsSize = bShared ? key->paramsSize : 0;
+    LSGWavetableCacheEntry_t* e = (LSGWavetableCacheEntry_t*)malloc(sizeof(LSGWavetableCacheEntry_t) + lsg_align8(paramsSize) + sizeof(LSGSample) * kLSGWavetableStorageLength);
+    if (!e) {
+        return NULL;
+    }
+    
+    e->table.data = (LSGSample*)(e->params + lsg_align8(paramsSize));
+    if (builder(&e->table, userData) != LSG_OK) {
+        free(e);
+        return NULL;
+    }
+    
+    e->next = NULL;
+    e->hash = hash;
+    e->refCount = 1;
+    e->kind = key->kind;
+    e->bMapped = 0;
+    e->paramsSize = paramsSize;
+    if (paramsSize) {
+        memcpy(e->params, key->params, paramsSize);
+    }
+    
+    pthread_mutex_lock(&sCacheMutex);
+    found = bShared ? lsg_wavetable_cache_find(key, hash) : NULL;
+    if (found) {
+        // Another thread built the same table meanwhile
+        ++found->refCount;
+    } else {
+        lsg_wavetable_cache_insert(e);
+    }
+    pthread_mutex_unlock(&sCacheMutex);
+    
+    if (found) {
+        free(e);
+        return &found->table;
+    }
+    
+    return &e->table;
+}
+
+void lsg_wavetable_cache_release(const LSGWavetable_t* wt) {
+    if (!wt) {
+        return;
+    }
+    
+    LSGWavetableCacheEntry_t* e = (LSGWavetableCacheEntry_t*)wt;
+    pthread_mutex_lock(&sCacheMutex);
+    const int bLast = (--e->refCount == 0);
+    if (bLast) {
+        if (e->kind != 0) {
+            LSGWavetableCacheEntry_t** pp = &sCacheBuckets[e->hash % kLSGWavetableCacheNumBuckets];
+            while (*pp != e) {
+                pp = &(*pp)->next;
+            }
+            *pp = e->next;
+        }
+        --sCacheNumTables;
+        if (e->bMapped) {
+            --sCacheNumMappedTables;
+        }
+    }
+    pthread_mutex_unlock(&sCacheMutex);
+    
+    if (bLast) {
+        free(e);
+    }
+}
+
+unsigned int lsg_wavetable_cache_serial(const LSGWavetable_t* wt) {
+    return ((const LSGWavetableCacheEntry_t*)wt)->serial;
+}
+
+void lsg_get_generator_cache_info(int* pNumTables, size_t* pHeapBytes, size_t* pMappedBytes) {
+    pthread_mutex_lock(&sCacheMutex);
+    const int n = sCacheNumTables;
+    const int nMapped = sCacheNumMappedTables;
+    const size_t mappedBytes = sCacheMappedBytes;
+    pthread_mutex_unlock(&sCacheMutex);
+    
+    if (pNumTables) {
+        *pNumTables = n;
+    }
+    
+    // A mapped table only has its entry on the heap
+    if (pHeapBytes) {
+        *pHeapBytes = (size_t)n * sizeof(LSGWavetableCacheEntry_t) + (size_t)(n - nMapped) * sizeof(LSGSample) * kLSGWavetableStorageLength;
+    }
+    
+    if (pMappedBytes) {
+        *pMappedBytes = mappedBytes;
+    }
+}
+
+// Cache file - - - - - - - - - - - -
+
+size_t lsg_wavetable_file_record_size() {
+    return lsg_align8(sizeof(LSGWavetableFileRecord_t) + sizeof(LSGSample) * kLSGWavetableStorageLength);
+}
+
+// Every level has to stay inside the storage, or reads would run off the mapping
+int lsg_wavetable_file_record_good(const LSGWavetableFileRecord_t* rec) {
+    if (rec->kind == 0 || rec->nLevels < 1 || rec->nLevels > kLSGWavetableNumLevels) {
+        return 0;
+    }
+    
+    for (int k = 0;k < rec->nLevels;++k) {
+        const int bits = rec->levelLengthBits[k];
+        if (bits < 1 || bits > kLSGWavetableMaxLengthBits || rec->levelOffset[k] < 0 ||
+            rec->levelOffset[k] + (1 << bits) + 1 > kLSGWavetableStorageLength) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+LSGStatus lsg_wavetable_cache_load_file(const char* path, const int* kinds, int nKinds) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return LSGERR_GENERIC;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LSGWavetableFileHeader_t)) {
+        close(fd);
+        return LSGERR_GENERIC;
+    }
+    
+    const size_t fileSize = (size_t)st.st_size;
+    void* mapped = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return LSGERR_GENERIC;
+    }
+    
+    const LSGWavetableFileHeader_t* header = (const LSGWavetableFileHeader_t*)mapped;
+    const size_t recordSize = lsg_wavetable_file_record_size();
+    if (header->magic != kLSGWavetableFileMagic ||
+        header->version != kLSGWavetableFileVersion ||
+        header->lengthBits != kLSGWavetableLengthBits ||
+        header->numLevels != kLSGWavetableNumLevels ||
+        header->storageLength != kLSGWavetableStorageLength ||
+        header->recordSize != recordSize ||
+        fileSize < sizeof(LSGWavetableFileHeader_t) + (size_t)header->nRecords * recordSize) {
+        munmap(mapped, fileSize);
+        return LSGERR_GENERIC;
+    }
+    
+    const unsigned char* pRecords = (const unsigned char*)mapped + sizeof(LSGWavetableFileHeader_t);
+    for (uint32_t i = 0;i < header->nRecords;++i) {
+        if (!lsg_wavetable_file_record_good((const LSGWavetableFileRecord_t*)(pRecords + i * recordSize))) {
+            munmap(mapped, fileSize);
+            return LSGERR_GENERIC;
+        }
+    }
+    
+    // The mapping is released only when no table was taken from it;
+    // otherwise the loaded tables stay in the cache with a reference of their own
+    int nInserted = 0;
+    pthread_mutex_lock(&sCacheMutex);
+    for (uint32_t i = 0;i < header->nRecords;++i) {
+        const LSGWavetableFileRecord_t* rec = (const LSGWavetableFileRecord_t*)(pRecords + i * recordSize);
+        const LSGWavetableKey_t key = {rec->kind, NULL, 0};
+        const uint32_t hash = lsg_wavetable_key_hash(&key);
+        if (lsg_wavetable_cache_find(&key, hash)) {
+            continue;
+        }
+        
+        LSGWavetableCacheEntry_t* e = (LSGWavetableCacheEntry_t*)malloc(sizeof(LSGWavetableCacheEntry_t));
+        if (!e) {
+            break;
+        }
+        
+        e->table.nLevels = rec->nLevels;
+        e->table.bNearest = rec->bNearest;
+        for (int k = 0;k < kLSGWavetableNumLevels;++k) {
+            e->table.levelOffset[k] = rec->levelOffset[k];
+            e->table.levelLengthBits[k] = rec->levelLengthBits[k];
+        }
+        e->table.data = (LSGSample*)(rec + 1);
+        
+        e->next = NULL;
+        e->hash = hash;
+        e->refCount = 1;
+        e->kind = rec->kind;
+        e->bMapped = 1;
+        e->paramsSize = 0;
+        lsg_wavetable_cache_insert(e);
+        ++nInserted;
+    }
+    
+    if (nInserted) {
+        sCacheMappedBytes += fileSize;
+    }
+    
+    LSGStatus status = LSG_OK;
+    for (int i = 0;i < nKinds;++i) {
+        const LSGWavetableKey_t key = {kinds[i], NULL, 0};
+        if (!lsg_wavetable_cache_find(&key, lsg_wavetable_key_hash(&key))) {
+            status = LSGERR_GENERIC;
+        }
+    }
+    pthread_mutex_unlock(&sCacheMutex);
+    
+    if (!nInserted) {
+        munmap(mapped, fileSize);
+    }
+    
+    return status;
+}
+
+// Writes the cached tables of the given kinds (those without params). The file is replaced atomically.
+LSGStatus lsg_wavetable_cache_save_file(const char* path, const int* kinds, int nKinds) {
+    const size_t recordSize = lsg_wavetable_file_record_size();
+    const size_t tmpPathLength = strlen(path) + 32;
+    char* tmpPath = (char*)malloc(tmpPathLength);
+    unsigned char* recordBuf = (unsigned char*)calloc(1, recordSize);
+    if (!tmpPath || !recordBuf) {
+        free(tmpPath);
+        free(recordBuf);
+        return LSGERR_GENERIC;
+    }
+    
+    snprintf(tmpPath, tmpPathLength, "%s.%d.tmp", path, (int)getpid());
+    FILE* fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        free(tmpPath);
+        free(recordBuf);
+        return LSGERR_GENERIC;
+    }
+    
+    LSGWavetableFileHeader_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kLSGWavetableFileMagic;
+    header.version = kLSGWavetableFileVersion;
+    header.lengthBits = kLSGWavetableLengthBits;
+    header.numLevels = kLSGWavetableNumLevels;
+    header.storageLength = kLSGWavetableStorageLength;
+    header.recordSize = (uint32_t)recordSize;
+    
+    int bGood = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    
+    pthread_mutex_lock(&sCacheMutex);
+    for (int i = 0;bGood && i < nKinds;++i) {
+        const LSGWavetableKey_t key = {kinds[i], NULL, 0};
+        const LSGWavetableCacheEntry_t* e = lsg_wavetable_cache_find(&key, lsg_wavetable_key_hash(&key));
+        if (!e) {
+            continue;
+        }
+        
+        LSGWavetableFileRecord_t* rec = (LSGWavetableFileRecord_t*)recordBuf;
+        rec->kind = e->kind;
+        rec->nLevels = e->table.nLevels;
+        rec->bNearest = e->table.bNearest;
+        for (int k = 0;k < kLSGWavetableNumLevels;++k) {
+            rec->levelOffset[k] = e->table.levelOffset[k];
+            rec->levelLengthBits[k] = e->table.levelLengthBits[k];
+        }
+        memcpy(rec + 1, e->table.data, sizeof(LSGSample) * kLSGWavetableStorageLength);
+        
+        bGood = (fwrite(recordBuf, recordSize, 1, fp) == 1);
+        ++header.nRecords;
+    }
+    pthread_mutex_unlock(&sCacheMutex);
+    
+    // Record count is known only now
+    if (bGood) {
+        bGood = (fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1);
+    }
+    
+    bGood = (fclose(fp) == 0) && bGood;
+    if (bGood) {
+        bGood = (rename(tmpPath, path) == 0);
+    }
+    
+    if (!bGood) {
+        unlink(tmpPath);
+    }
+    
+    free(tmpPath);
+    free(recordBuf);
+    return bGood ? LSG_OK : LSGERR_GENERIC;
+}
@@ -0,0 +1,89 @@
+// LSG ONGEN - - - Wavetables (internal)
+
+#ifndef LSGTest_LSGwavetable_h
+#define LSGTest_LSGwavetable_h
+#include "LSG.h"
+
+// Level k holds one band-limited cycle of (kLSGWavetableLength >> k) samples,
+// so each level carries one octave fewer harmonics than the level above.
+#define kLSGWavetableNumLevels 9
+#define kLSGWavetableStorageLength (kLSGWavetableLength * 2 + kLSGWavetableNumLevels)
+#define kLSGWavetableMaxLengthBits 13
+
+// Build flags
+#define kLSGWavetableFlag_Nearest 0x01 // single level, no interpolation (noise tables)
+
+typedef struct _LSGWavetable_t {
+    int nLevels;
+    int bNearest;
+    int levelOffset[kLSGWavetableNumLevels];     // into data
+    int levelLengthBits[kLSGWavetableNumLevels];
+    LSGSample* data; // kLSGWavetableStorageLength samples; each level is followed by a copy of its first sample
+} LSGWavetable_t;
+
+typedef struct _LSGWavetableLevel_t {
+    const LSGSample* samples;
+    int lengthBits;
+    int bInterpolate;
+} LSGWavetableLevel_t;
+
+// Optional FIR applied to the cycle while building (taps are tapSpacing cycles apart)
+typedef struct _LSGWavetableFilter_t {
+    const float* taps;
+    int nTaps;
+    double tapSpacing;
+} LSGWavetableFilter_t;
+
+void lsg_wavetable_clear(LSGWavetable_t* wt);
+LSGStatus lsg_wavetable_build(LSGWavetable_t* wt, const LSGSample* cycle, int lengthBits, int flags, const LSGWavetableFilter_t* pFilter);
+LSGSample lsg_wavetable_get_sample(const LSGWavetable_t* wt, int sampleIndex);
+int lsg_wavetable_get_length(const LSGWavetable_t* wt);
+
+// Picks the highest level which does not alias at the given phase increment
+static LSG_INLINE void lsg_wavetable_select_level(const LSGWavetable_t* wt, uint32_t phaseInc, LSGWavetableLevel_t* pOut) {
+    int k = 0;
+    const int shift0 = 32 - wt->levelLengthBits[0];
+    while (k < (wt->nLevels - 1) && phaseInc > ((uint32_t)1 << (shift0 + k))) {
+        ++k;
+    }
+
+    pOut->samples = wt->data + wt->levelOffset[k];
+    pOut->lengthBits = wt->levelLengthBits[k];
+    pOut->bInterpolate = !wt->bNearest;
+}
+
+static LSG_INLINE int lsg_wavetable_level_read(const LSGWavetableLevel_t* lv, uint32_t phase) {
+    const int shift = 32 - lv->lengthBits;
+    const uint32_t index = phase >> shift;
+    const int a = lv->samples[index];
+    if (!lv->bInterpolate) {
+        return a;
+    }
+
+    // 15bit fraction
+    const int frac = (int)((phase >> (shift - 15)) & 0x7fff);
+    const int b = lv->samples[index + 1];
+    return a + (((b - a) * frac) >> 15);
+}
+
+// Shared table cache - - - - - - - - - - - -
+// Tables are read-only once acquired. Identical keys share one table per process.
+
+typedef struct _LSGWavetableKey_t {
+    int kind;           // defined by the caller; 0 = never shared
+    const void* params; // compared byte by byte
+    size_t paramsSize;
+} LSGWavetableKey_t;
+
+typedef LSGStatus (*LSGWavetableBuilder)(LSGWavetable_t* wt, void* userData);
+
+// Returns a table with one reference added (builder runs only on miss), NULL on failure
+const LSGWavetable_t* lsg_wavetable_cache_acquire(const LSGWavetableKey_t* key, LSGWavetableBuilder builder, void* userData);
+void lsg_wavetable_cache_release(const LSGWavetable_t* wt);
+unsigned int lsg_wavetable_cache_serial(const LSGWavetable_t* wt); // unique for each table ever built
+
+// Cache file: tables without params, memory-mapped on load and kept for the process lifetime
+LSGStatus lsg_wavetable_cache_load_file(const char* path, const int* kinds, int nKinds); // fails unless all kinds are present
+LSGStatus lsg_wavetable_cache_save_file(const char* path, const int* kinds, int nKinds);
+
+#endif